@@ -5,12 +5,20 @@
 #ifndef __ANALYSER_H__
 #define __ANALYSER_H__
 
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
+#include "binary.h"
+#include "compressed.h"
 #include "property.h"
 
 namespace clayer {
@@ -49,6 +57,146 @@ std::vector<float> get_numbers(const std::string &line,
   return numbers;
 }
 
+/**
+ * @brief Reads the members of a flat JSON object, such as a line written by a
+ * logger::JsonLogger, without regex
+ *
+ * @param line the text of the object
+ * @param f function called with the key and the value of each member: strings
+ * unescaped, anything else as it is written
+ * @return if the line holds a flat object that could be read
+ */
+template <typename F> bool read_json_object(const std::string &line, F &&f) {
+  std::size_t i = 0;
+  auto skip = [&]() {
+    while (i < line.size() && std::isspace((unsigned char)line[i]))
+      ++i;
+  };
+  auto string = [&](std::string &out) {
+    if (line[i++] != '"')
+      return false;
+    while (i < line.size() && line[i] != '"') {
+      char c = line[i++];
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (i == line.size())
+        return false;
+      switch (c = line[i++]) {
+        case 'n': out += '\n'; break;
+        case 't': out += '\t'; break;
+        case 'r': out += '\r'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u': {
+          unsigned u = 0;
+          const char *hex = line.data() + i;
+          if (i + 4 > line.size() ||
+              std::from_chars(hex, hex + 4, u, 16).ptr != hex + 4)
+            return false;
+          i += 4;
+          if (u < 0x80) {
+            out += char(u);
+          } else if (u < 0x800) {
+            out += char(0xc0 | (u >> 6));
+            out += char(0x80 | (u & 0x3f));
+          } else {
+            out += char(0xe0 | (u >> 12));
+            out += char(0x80 | ((u >> 6) & 0x3f));
+            out += char(0x80 | (u & 0x3f));
+          }
+          break;
+        }
+        default: out += c;
+      }
+    }
+    return i++ < line.size();
+  };
+
+  skip();
+  if (i == line.size() || line[i++] != '{')
+    return false;
+  for (skip(); i < line.size() && line[i] != '}'; skip()) {
+    std::string key, value;
+    skip();
+    if (i == line.size() || !string(key))
+      return false;
+    skip();
+    if (i == line.size() || line[i++] != ':')
+      return false;
+    skip();
+    if (i == line.size())
+      return false;
+    if (line[i] == '"') {
+      if (!string(value))
+        return false;
+    } else {
+      std::size_t end = line.find_first_of(",}", i);
+      if (end == std::string::npos)
+        return false;
+      value = line.substr(i, end - i);
+      while (!value.empty() && std::isspace((unsigned char)value.back()))
+        value.pop_back();
+      i = end;
+    }
+    f(key, std::move(value));
+    skip();
+    if (i < line.size() && line[i] == ',')
+      ++i;
+  }
+  return i < line.size();
+}
+
+/**
+ * @brief Reads the key=value pairs of a logfmt line, such as one written by a
+ * logger::LogfmtLogger, without regex
+ *
+ * @param line the text of the line
+ * @param f function called with the key and the value of each pair, quoted
+ * values unescaped
+ * @return if the whole line could be read
+ */
+template <typename F> bool read_logfmt_pairs(const std::string &line, F &&f) {
+  std::size_t i = 0;
+  while (i < line.size()) {
+    if (line[i] == ' ') {
+      ++i;
+      continue;
+    }
+    std::size_t eq = line.find_first_of("= ", i);
+    if (eq == std::string::npos || line[eq] != '=')
+      return false;
+    std::string key = line.substr(i, eq - i), value;
+    i = eq + 1;
+    if (i < line.size() && line[i] == '"') {
+      for (++i; i < line.size() && line[i] != '"'; ++i) {
+        char c = line[i];
+        unsigned u = 0;
+        const char *hex = line.data() + i + 2;
+        if (c == '\\' && i + 5 < line.size() && line[i + 1] == 'u' &&
+            std::from_chars(hex, hex + 4, u, 16).ptr == hex + 4 && u < 0x20) {
+          // a control character, written as JSON does
+          c = char(u);
+          i += 5;
+        } else if (c == '\\' && i + 1 < line.size()) {
+          c = line[++i];
+          c = c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c;
+        }
+        value += c;
+      }
+      if (i++ == line.size())
+        return false;
+    } else {
+      std::size_t end = std::min(line.find(' ', i), line.size());
+      value = line.substr(i, end - i);
+      i = end;
+    }
+    f(key, std::move(value));
+  }
+  return true;
+}
+
 /**
  * @brief Parses a log file into log records and also provides a set of states
  * if required
@@ -56,23 +204,149 @@ std::vector<float> get_numbers(const std::string &line,
 class Parser {
   std::vector<LogRecord> records;
 
+  /**
+   * @brief Reads a structured log file line by line, skipping lines that
+   * can't be read
+   * @param read function reading a line, with a function to call for each of
+   * its properties and fields by name
+   */
+  template <typename Read>
+  const std::vector<LogRecord> &read_structured(const std::string &filename,
+                                                Read &&read) {
+    records.clear();
+    std::ifstream f(filename);
+    for (std::string line; std::getline(f, line);) {
+      LogRecord p;
+      auto named = [&p](const std::string &key, std::string value) {
+        read_named(p, key, std::move(value));
+      };
+      if (!read(line, named))
+        continue;
+      p.numbers = get_numbers(p.message);
+      records.push_back(p);
+    }
+    return records;
+  }
+
+  /**
+   * @return If a file starts as gzip does, as logs written by a
+   * logger::CompressedSink do
+   */
+  static bool is_compressed(const std::string &filename) {
+    char magic[2] = {};
+    std::ifstream(filename, std::ios::binary).read(magic, 2);
+    return magic[0] == '\x1f' && magic[1] == '\x8b';
+  }
+
+  /**
+   * @brief Reads the frames of a compressed log that overlap a time range, in
+   * parallel, each thread decompressing and parsing whole frames; what
+   * follows the last frame of the index, a frame still open or, without an
+   * index, the whole log, is read as a single frame
+   */
+  template <log_properties... I>
+  void read_frames(const std::string &filename, const std::regex &log_format,
+                   std::chrono::system_clock::time_point from,
+                   std::chrono::system_clock::time_point to) {
+    using logger::frames::Frame;
+    using clock = std::chrono::system_clock;
+    std::int64_t lo = from == clock::time_point::min()
+                          ? INT64_MIN
+                          : logger::frames::nanoseconds(from);
+    std::int64_t hi = to == clock::time_point::max()
+                          ? INT64_MAX
+                          : logger::frames::nanoseconds(to);
+    std::vector<Frame> index = logger::frames::read_index(filename), frames;
+    std::uint64_t length =
+        std::ifstream(filename, std::ios::binary | std::ios::ate).tellg();
+    for (const Frame &e : index)
+      if (e.last >= lo && e.first <= hi)
+        frames.push_back(e);
+    // the frame the sink still has open, read as far as it was written
+    std::uint64_t indexed = index.empty() ? 0 : index.back().offset +
+                                                    index.back().size;
+    if (length > indexed)
+      frames.push_back({indexed, length - indexed, INT64_MIN, INT64_MAX});
+    std::vector<std::vector<LogRecord>> parsed(frames.size());
+    std::atomic<std::size_t> next(0);
+    auto work = [&]() {
+      std::ifstream f(filename, std::ios::binary);
+      std::string compressed, text;
+      for (std::size_t i; (i = next++) < frames.size();) {
+        const Frame &e = frames[i];
+        compressed.resize(
+            std::min(e.size, length - std::min(length, e.offset)));
+        f.seekg(e.offset);
+        f.read(&compressed[0], compressed.size());
+        // a frame cut short by a crash still yields the records before the cut
+        text.clear();
+        logger::frames::inflate_frame(compressed, text);
+        std::istringstream lines(text);
+        for (std::string line; std::getline(lines, line);) {
+          LogRecord p;
+          parse_props<I...>(p, line, log_format);
+          p.numbers = get_numbers(p.message);
+          parsed[i].push_back(std::move(p));
+        }
+      }
+    };
+    std::size_t workers = std::min<std::size_t>(
+        std::thread::hardware_concurrency(), frames.size());
+    std::vector<std::thread> threads;
+    for (std::size_t k = 1; k < workers; ++k)
+      threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+      t.join();
+    for (auto &v : parsed)
+      records.insert(records.end(), std::make_move_iterator(v.begin()),
+                     std::make_move_iterator(v.end()));
+  }
+
 public:
   /**
    * @brief Reads log properties from a file according to the log format regex
-   * supplied
+   * supplied; compressed logs written by a logger::CompressedSink are
+   * decompressed, in parallel, and only their frames that overlap the time
+   * range are read
    * @param filename name of the file to read from
    * @param log_format the regular expression to match the line with; it should
    * contain as many matching groups (excluding the default group) as there are
    * properties in the template argument; each group will be parsed into the
    * respective property
+   * @param from, to the time range of a compressed log to read; a frame is read
+   * whole if any part of it falls in the range, so records just outside it can
+   * still be returned
    * @return const reference to the records thus read
    */
   template <log_properties... I>
-  const std::vector<LogRecord> &read_file(std::string filename,
-                                          std::regex log_format) {
+  const std::vector<LogRecord> &read_file(
+      std::string filename, std::regex log_format,
+      std::chrono::system_clock::time_point from =
+          std::chrono::system_clock::time_point::min(),
+      std::chrono::system_clock::time_point to =
+          std::chrono::system_clock::time_point::max()) {
+    if (!is_compressed(filename)) {
+      std::ifstream f(filename);
+      return read_stream<I...>(f, log_format);
+    }
     records.clear();
-    std::ifstream f(filename);
-    for (std::string line; std::getline(f, line);) {
+    read_frames<I...>(filename, log_format, from, to);
+    return records;
+  }
+
+  /**
+   * @brief Reads log properties from the lines of a stream, as read_file does
+   * from a text file, e.g. from records received by a collector
+   * @param in the stream to read from, up to its end
+   * @param log_format the regular expression to match the lines with
+   * @return const reference to the records thus read
+   */
+  template <log_properties... I>
+  const std::vector<LogRecord> &read_stream(std::istream &in,
+                                            std::regex log_format) {
+    records.clear();
+    for (std::string line; std::getline(in, line);) {
       LogRecord p;
       parse_props<I...>(p, line, log_format);
       p.numbers = get_numbers(p.message);
@@ -81,6 +355,100 @@ public:
     return records;
   }
 
+  /**
+   * @brief Reads log records from a file of JSON lines written by a
+   * logger::JsonLogger, by property name instead of by regex; members that
+   * aren't properties become fields of the records
+   * @param filename name of the file to read from
+   * @return const reference to the records thus read
+   */
+  const std::vector<LogRecord> &read_json_file(std::string filename) {
+    return read_structured(filename, [](const std::string &line, auto f) {
+      return read_json_object(line, f);
+    });
+  }
+
+  /**
+   * @brief Reads log records from a logfmt file written by a
+   * logger::LogfmtLogger, as read_json_file does
+   * @param filename name of the file to read from
+   * @return const reference to the records thus read
+   */
+  const std::vector<LogRecord> &read_logfmt_file(std::string filename) {
+    return read_structured(filename, [](const std::string &line, auto f) {
+      return read_logfmt_pairs(line, f);
+    });
+  }
+
+  /**
+   * @brief Reads log records from a binary log written by a BinaryLogger,
+   * without any text parsing
+   * @param filename name of the file to read from
+   * @return const reference to the records thus read
+   */
+  const std::vector<LogRecord> &read_binary_file(std::string filename) {
+    records.clear();
+    std::ifstream f(filename, std::ios::binary);
+    logger::binary::Reader reader(f);
+    auto render = [](auto prop, const logger::Line &line) {
+      std::ostringstream s;
+      prop(s, line);
+      return s.str();
+    };
+    for (logger::Line line; reader.next(line);) {
+      LogRecord p;
+      p.code = CodeContext(line.info.file, line.info.fn,
+                           render(logger::prop_level<std::ostream>, line),
+                           line.info.line, line.hash);
+      p.run = RunContext(render(logger::prop_date<std::ostream>, line),
+                         render(logger::prop_thread<std::ostream>, line),
+                         render(logger::prop_time<std::ostream>, line));
+      p.message = line.message.str();
+      p.numbers = get_numbers(p.message);
+      line.fields.for_each([&p](const logger::Field &f) {
+        std::ostringstream value;
+        logger::write_value<logger::encode::Text>(value, f);
+        p.fields.emplace_back(f.key, value.str());
+      });
+      records.push_back(p);
+    }
+    return records;
+  }
+
+  /**
+   * @brief Groups the records by the hash identifier of the log statement that
+   * wrote them, which is the same across runs and machines
+   * @return the indices of the records written by each statement
+   */
+  std::unordered_map<std::uint64_t, std::vector<std::size_t>>
+  group_by_hash() const {
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> groups;
+    for (std::size_t i = 0; i < records.size(); ++i)
+      groups[records[i].code.hash].push_back(i);
+    return groups;
+  }
+
+  /**
+   * @brief Totals the records a queued logger dropped under backpressure, as
+   * told by the "dropped" field of the records that followed each gap: a
+   * field of structured and binary logs, ` dropped=N` at the end of the
+   * message of text logs
+   * @return the number of records missing from the records read
+   */
+  std::uint64_t dropped() const {
+    std::uint64_t n = 0;
+    for (auto &r : records) {
+      if (const std::string *v = r.field("dropped")) {
+        n += std::strtoull(v->c_str(), nullptr, 10);
+        continue;
+      }
+      std::size_t at = r.message.rfind(" dropped=");
+      if (at != std::string::npos)
+        n += std::strtoull(r.message.c_str() + at + 9, nullptr, 10);
+    }
+    return n;
+  }
+
   /**
    * @brief creates a set of states identified in the log records
    * @return the set thus created
@@ -0,0 +1,849 @@
+/**
+ * Loggers that hand records over to a background thread for formatting and
+ * writing, so that logging threads never wait on each other's I/O.
+ */
+#ifndef __ASYNC_H__
+#define __ASYNC_H__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "backpressure.h"
+#include "crash.h"
+#include "logger.h"
+#include "queue.h"
+
+namespace logger {
+
+/**
+ * @brief A logger with the same interface as Logger that pushes completed
+ * Lines into a bounded lock-free queue. A single background writer thread pops
+ * them, applies the filter, formats them and writes them to the stream.
+ *
+ * @detailed Logging threads only pay for moving their Line into the queue; all
+ * the Prop evaluation and I/O happens on the writer thread. Since only the
+ * writer touches the stream no lock is needed, and the stream is flushed once
+ * per batch of records rather than once per record; a RecordSink, which
+ * flushes as its own policy says, only on flush() and when the logger stops.
+ * When the queue is full the
+ * logging thread yields until the writer makes room, or drops the record, as
+ * its Backpressure says.
+ *
+ * @remark The stream must outlive the logger. The destructor writes out every
+ * record pushed before it was called.
+ */
+template <typename Stream, int threshold, const char *fmt,
+          Prop<Stream>... props>
+class AsyncLogger : public Leveled<threshold> {
+private:
+  /**
+   * @brief The underlying stream to which the writer thread logs.
+   */
+  Stream &stream;
+
+  /**
+   * @brief An optional filter that post-processes log records on the writer
+   * thread, possibly throwing them out if they don't satisfy the condition.
+   */
+  Filter filter;
+
+  /**
+   * @brief The queue of completed Lines waiting to be written.
+   */
+  MPSCQueue<Line> queue;
+
+  /**
+   * @brief The queue of the severe records under Backpressure::PRIORITY,
+   * which the writer empties first; null otherwise.
+   */
+  std::unique_ptr<MPSCQueue<Line>> lane;
+
+  /**
+   * @brief The backpressure applied to pushes, and the count of drops.
+   */
+  Overload overload;
+
+  /**
+   * @brief The number of records the writer has finished with (written, or
+   * filtered out).
+   */
+  std::atomic<std::size_t> written;
+
+  /**
+   * @brief flush() requests and the last one the writer has served.
+   */
+  std::atomic<std::size_t> flush_requests, flushes_done;
+
+  /**
+   * @brief Cleared to ask the writer to drain the queue and stop.
+   */
+  std::atomic<bool> running;
+
+  /**
+   * @brief The optional collapsing of repeated messages, done by the writer.
+   */
+  DedupStage<> dedup;
+
+  /**
+   * @brief The optional counters of what logging costs, see enable_metrics.
+   */
+  MetricsStage metering;
+
+  using steady = std::chrono::steady_clock;
+
+  /**
+   * @brief Writes the queued records straight to the stream's descriptor when
+   * the process crashes, see crash::install.
+   */
+  static int crash_drain(void *self, const char *, std::size_t) {
+    AsyncLogger &l = *static_cast<AsyncLogger *>(self);
+    int fd = crash::descriptor(l.stream);
+    auto write = [fd](const Line &line) { crash::write_line(fd, line); };
+    if (l.lane)
+      l.lane->for_each_pending(write);
+    l.queue.for_each_pending(write);
+    return fd;
+  }
+
+  crash::Watch watch{this, crash_drain, crash::QUEUES};
+
+  /**
+   * @brief The background writer thread.
+   */
+  std::thread writer;
+
+  /**
+   * @brief Applies the filter to a Line and writes it out.
+   */
+  void write(Line &line) {
+    Metrics *m = metering.get();
+    if ((*filter)(line)) {
+      steady::time_point start = m ? steady::now() : steady::time_point();
+      std::uint64_t bytes = print_counted(stream, m != nullptr, [&] {
+        Formatter<fmt, Stream, props...>::print(stream, line);
+        stream << '\n';
+      });
+      if constexpr (RecordSink<Stream>)
+        record_ended(stream, line);
+      if (m != nullptr)
+        m->wrote(line.info.level, bytes, steady::now() - start);
+    } else if (m != nullptr) {
+      m->filtered(line.info.level);
+    }
+  }
+
+  /**
+   * @brief Pops the next Line, from the priority lane if it has one.
+   */
+  bool pop(Line &line) {
+    return (lane && lane->try_pop(line)) || queue.try_pop(line);
+  }
+
+  /**
+   * @return The number of pushes claimed so far, in both queues.
+   */
+  std::size_t claimed() const {
+    return queue.claimed() + (lane ? lane->claimed() : 0);
+  }
+
+  /**
+   * @return The number of Lines popped so far, from both queues.
+   */
+  std::size_t consumed() const {
+    return queue.consumed() + (lane ? lane->consumed() : 0);
+  }
+
+  /**
+   * @return The number of Lines waiting in both queues.
+   */
+  std::uint64_t depth() const {
+    std::size_t popped = consumed();
+    return claimed() - popped;
+  }
+
+  /**
+   * @brief The writer thread's loop: drains the queue in batches, flushing the
+   * stream after each batch unless it is a RecordSink, and backs off while the
+   * queue is empty.
+   */
+  void run() {
+    Line line;
+    unsigned idle = 0;
+    auto write_line = [this](Line &l) { write(l); };
+    for (;;) {
+      crash::park_if_halted();
+      std::size_t requested = flush_requests.load(std::memory_order_acquire);
+      std::size_t batch = 0;
+      while (pop(line)) {
+        Dedup *d = dedup.get();
+        if (d == nullptr || d->admit(line, write_line))
+          write(line);
+        else if (Metrics *m = metering.get())
+          m->filtered(line.info.level);
+        ++batch;
+        crash::park_if_halted();
+      }
+      if (Dedup *d = dedup.get()) {
+        if (batch == 0 && !running.load(std::memory_order_acquire))
+          d->drain(write_line);
+        else
+          d->expire(write_line);
+      }
+      Metrics *m = metering.get();
+      if (m != nullptr && m->due(steady::now())) {
+        Line report = metrics_record(m->snapshot(depth()), m->level);
+        write(report);
+        ++batch;
+      }
+      if constexpr (!RecordSink<Stream>)
+        if (batch)
+          stream << std::flush;
+      if (batch)
+        written.store(consumed(), std::memory_order_release);
+      if (requested != flushes_done.load(std::memory_order_relaxed)) {
+        stream << std::flush;
+        flushes_done.store(requested, std::memory_order_release);
+      }
+      if (batch) {
+        idle = 0;
+      } else if (!running.load(std::memory_order_acquire) &&
+                 claimed() == consumed()) {
+        overload.report(write_line);
+        stream << std::flush;
+        return;
+      } else if (++idle < 64) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+    }
+  }
+
+public:
+  /**
+   * @brief Constructs a logger from a stream and starts its writer thread.
+   *
+   * @param s The stream to which to log.
+   * @param capacity The number of records that can wait in the queue before
+   * logging threads have to wait for the writer, or drop them.
+   * @param b What logging threads do when the queue is full; a priority lane
+   * holds a quarter of the capacity.
+   */
+  AsyncLogger(Stream &s, std::size_t capacity = 1 << 13,
+              Backpressure b = Backpressure())
+      : stream(s), filter([](Line &l) { return true; }), queue(capacity),
+        lane(b.mode == Backpressure::PRIORITY
+                 ? new MPSCQueue<Line>(std::max<std::size_t>(capacity / 4, 2))
+                 : nullptr),
+        overload(b), written(0), flush_requests(0), flushes_done(0),
+        running(true), writer(&AsyncLogger::run, this) {}
+
+  /**
+   * @brief Writes out all pending records and stops the writer thread.
+   */
+  ~AsyncLogger() {
+    running.store(false, std::memory_order_release);
+    writer.join();
+  }
+
+  /**
+   * @brief Set the filter for the log.
+   *
+   * @param A boolean function taking in a reference to a Line and outputting a
+   * boolean, so it can modify and report whether to finally output or not.
+   */
+  void set_filter(Filter f) { filter = f; }
+
+  /**
+   * @brief Collapses repeated messages on the writer thread, see
+   * Logger::set_dedup. Counts still pending are written when the writer runs
+   * out of records to write after their window, and when the logger stops.
+   */
+  void set_dedup(std::chrono::system_clock::duration window,
+                 std::size_t slots = 16) {
+    dedup.enable(window, slots);
+  }
+
+  /**
+   * @brief Blocks until every record committed before the call has been
+   * written and the stream flushed.
+   */
+  void flush() {
+    std::size_t target = claimed();
+    while (written.load(std::memory_order_acquire) < target)
+      std::this_thread::yield();
+    std::size_t request = flush_requests.fetch_add(1) + 1;
+    while (flushes_done.load(std::memory_order_acquire) < request)
+      std::this_thread::yield();
+  }
+
+  /**
+   * @brief Pushes a completed Line to the queue for the writer thread. Called
+   * by Record at the end of the log statement.
+   *
+   * @param line The completed line; moved from.
+   */
+  void commit(Line &line) {
+    overload.push(overload.priority(line) ? *lane : queue, line);
+    if (Metrics *m = metering.get())
+      m->queued(depth());
+  }
+
+  /**
+   * @return The number of records of a severity dropped so far, see
+   * Overload::dropped.
+   */
+  std::uint64_t dropped(int level) const { return overload.dropped(level); }
+
+  /**
+   * @return The number of records dropped so far.
+   */
+  std::uint64_t dropped() const { return overload.dropped(); }
+
+  /**
+   * @brief Counts what logging costs, as Logger::enable_metrics does: the
+   * records written and filtered out by severity, the bytes written and the
+   * time spent writing them on the writer thread, and the depth of the queue,
+   * taken after each push, and its peak. Periodic snapshots are written by
+   * the writer thread.
+   */
+  void enable_metrics(steady::duration every = steady::duration::zero(),
+                      int level = 20) {
+    if (metering.enable(every, level))
+      this->count_rejections(metering.get());
+  }
+
+  /**
+   * @return The counts so far, all zero while counting is off.
+   */
+  MetricsSnapshot metrics() const {
+    Metrics *m = metering.get();
+    return m != nullptr ? m->snapshot(depth()) : MetricsSnapshot();
+  }
+
+  /**
+   * @brief Queues a snapshot of the counts as a record. Does nothing while
+   * counting is off.
+   */
+  void report_metrics() {
+    if (Metrics *m = metering.get()) {
+      Line line = metrics_record(m->snapshot(depth()), m->level);
+      commit(line);
+    }
+  }
+
+  /**
+   * @brief Constructs a logging record from contextual information when the
+   * logging level exceeds the threshold of the logger.
+   *
+   * @param N the level at which to log.
+   * @param info Contextual information about the log statement: line, file, and
+   * function name.
+   *
+   * @return A Record with the logger's format and specified level that can be
+   * streamed to.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N >= threshold>::type * = nullptr>
+  Record<AsyncLogger> log(ContextInfo info) {
+    return {*this, info};
+  }
+
+  /**
+   * @brief For logging levels below the threshold of the logger, this overload
+   * is called and does nothing.
+   *
+   * @param N logging level, below the threshold of the logger.
+   * @param info Ignored.
+   *
+   * @return A NoRecord that does nothing when you stream to it.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N<threshold>::type * = nullptr> NoRecord
+                log(ContextInfo info) {
+    return {};
+  }
+};
+
+/**
+ * @brief A single thread's ring of Lines for a MergingLogger, along with the
+ * flags that tell when it can be forgotten.
+ */
+struct LocalRing {
+  SPSCRing<Line> ring;
+
+  // Set by the producing thread when it exits: once drained, the ring can be
+  // unregistered.
+  std::atomic<bool> closed;
+
+  // Set by the logger when it's destroyed: the thread can drop the ring.
+  std::atomic<bool> retired;
+
+  explicit LocalRing(std::size_t capacity)
+      : ring(capacity), closed(false), retired(false) {}
+};
+
+/**
+ * @brief The rings the current thread produces into, keyed by logger id. Marks
+ * all of them closed when the thread exits.
+ */
+struct LocalRings {
+  std::vector<std::pair<std::size_t, std::shared_ptr<LocalRing>>> rings;
+
+  ~LocalRings() {
+    for (auto &r : rings)
+      r.second->closed.store(true, std::memory_order_release);
+  }
+};
+
+/**
+ * @return The current thread's rings.
+ */
+inline LocalRings &local_rings() {
+  static thread_local LocalRings local;
+  return local;
+}
+
+/**
+ * @brief A logger with the same interface as Logger where every thread pushes
+ * its Lines into its own single-producer ring, and a background writer thread
+ * merges the rings into the stream in order of capture time.
+ *
+ * @detailed A thread's ring is registered lazily by its first log statement;
+ * from then on logging threads share nothing with each other and only a
+ * release store with the writer. The writer repeatedly picks the oldest Line
+ * at the front of all rings. Since a thread may be about to push a Line older
+ * than everything seen so far, the oldest Line is only written once every live
+ * ring has something queued, or once it is older than a grace period. When a
+ * thread exits its ring is drained and unregistered.
+ *
+ * @remark The stream must outlive the logger. The destructor writes out every
+ * record pushed before it was called.
+ */
+template <typename Stream, int threshold, const char *fmt,
+          Prop<Stream>... props>
+class MergingLogger : public Leveled<threshold> {
+private:
+  /**
+   * @brief The underlying stream to which the writer thread logs.
+   */
+  Stream &stream;
+
+  /**
+   * @brief An optional filter that post-processes log records on the writer
+   * thread, possibly throwing them out if they don't satisfy the condition.
+   */
+  Filter filter;
+
+  /**
+   * @brief The key for this logger's rings in each thread's LocalRings.
+   */
+  const std::size_t id;
+
+  /**
+   * @brief The capacity of each thread's ring.
+   */
+  const std::size_t capacity;
+
+  /**
+   * @brief How long the writer waits for a silent thread before writing a
+   * newer Line from another one.
+   */
+  const std::chrono::system_clock::duration grace;
+
+  /**
+   * @brief The backpressure applied to pushes, and the count of drops.
+   */
+  Overload overload;
+
+  /**
+   * @brief The registered rings, guarded by registry_lock. The writer keeps
+   * its own copy and refreshes it whenever version changes.
+   */
+  std::mutex registry_lock;
+  std::vector<std::shared_ptr<LocalRing>> registry;
+  std::atomic<std::size_t> version;
+
+  /**
+   * @brief flush() requests and the last one the writer has served.
+   */
+  std::atomic<std::size_t> flush_requests, flushes_done;
+
+  /**
+   * @brief Cleared to ask the writer to drain the rings and stop.
+   */
+  std::atomic<bool> running;
+
+  /**
+   * @brief The optional collapsing of repeated messages, done by the writer.
+   */
+  DedupStage<> dedup;
+
+  /**
+   * @brief The optional counters of what logging costs, see enable_metrics.
+   */
+  MetricsStage metering;
+
+  using steady = std::chrono::steady_clock;
+
+  /**
+   * @brief Writes the queued records straight to the stream's descriptor when
+   * the process crashes, ring after ring, see crash::install. The registry is
+   * read without its lock, which the crashed thread may hold.
+   */
+  static int crash_drain(void *self, const char *, std::size_t) {
+    MergingLogger &l = *static_cast<MergingLogger *>(self);
+    int fd = crash::descriptor(l.stream);
+    for (auto &r : l.registry)
+      r->ring.for_each_pending([fd](const Line &line) {
+        crash::write_line(fd, line);
+      });
+    return fd;
+  }
+
+  crash::Watch watch{this, crash_drain, crash::QUEUES};
+
+  /**
+   * @brief The background writer thread.
+   */
+  std::thread writer;
+
+  /**
+   * @brief Registers a new ring for the current thread.
+   */
+  LocalRing &add_ring(LocalRings &local) {
+    auto &rings = local.rings;
+    for (auto it = rings.begin(); it != rings.end();)
+      it = it->second->retired.load(std::memory_order_acquire) ? rings.erase(it)
+                                                              : it + 1;
+    auto ring = std::make_shared<LocalRing>(capacity);
+    {
+      std::lock_guard<std::mutex> lock(registry_lock);
+      registry.push_back(ring);
+      version.fetch_add(1, std::memory_order_release);
+    }
+    rings.emplace_back(id, ring);
+    return *ring;
+  }
+
+  /**
+   * @return The current thread's ring, registering it on first use.
+   */
+  LocalRing &local_ring() {
+    LocalRings &local = local_rings();
+    for (auto &r : local.rings)
+      if (r.first == id)
+        return *r.second;
+    return add_ring(local);
+  }
+
+  /**
+   * @brief Applies the filter to a Line and writes it out.
+   */
+  void write(Line &line) {
+    Metrics *m = metering.get();
+    if ((*filter)(line)) {
+      steady::time_point start = m ? steady::now() : steady::time_point();
+      std::uint64_t bytes = print_counted(stream, m != nullptr, [&] {
+        Formatter<fmt, Stream, props...>::print(stream, line);
+        stream << '\n';
+      });
+      if constexpr (RecordSink<Stream>)
+        record_ended(stream, line);
+      if (m != nullptr)
+        m->wrote(line.info.level, bytes, steady::now() - start);
+    } else if (m != nullptr) {
+      m->filtered(line.info.level);
+    }
+  }
+
+  /**
+   * @brief Writes the oldest Line if it is safe to do so.
+   *
+   * @param rings The writer's copy of the registry.
+   * @param drain Whether to ignore the grace period, when no more Lines are
+   * expected.
+   * @return false if nothing was written.
+   */
+  bool write_oldest(std::vector<std::shared_ptr<LocalRing>> &rings,
+                    bool drain) {
+    LocalRing *oldest = nullptr;
+    Line *line = nullptr;
+    bool waiting = false;
+    for (auto &r : rings) {
+      bool closed = r->closed.load(std::memory_order_acquire);
+      Line *front = r->ring.front();
+      if (front == nullptr) {
+        waiting = waiting || !closed;
+      } else if (line == nullptr || front->time < line->time) {
+        oldest = r.get();
+        line = front;
+      }
+    }
+    if (line == nullptr)
+      return false;
+    if (waiting && !drain &&
+        std::chrono::system_clock::now() - line->time < grace)
+      return false;
+    Dedup *d = dedup.get();
+    if (d == nullptr || d->admit(*line, [this](Line &l) { write(l); }))
+      write(*line);
+    else if (Metrics *m = metering.get())
+      m->filtered(line->info.level);
+    oldest->ring.pop();
+    return true;
+  }
+
+  /**
+   * @return The number of Lines waiting in a set of rings.
+   */
+  static std::uint64_t
+  depth(const std::vector<std::shared_ptr<LocalRing>> &rings) {
+    std::uint64_t n = 0;
+    for (auto &r : rings)
+      n += r->ring.size();
+    return n;
+  }
+
+  /**
+   * @brief Drops drained rings of exited threads from the registry.
+   */
+  void unregister_closed() {
+    std::lock_guard<std::mutex> lock(registry_lock);
+    auto it = registry.begin();
+    bool erased = false;
+    while (it != registry.end()) {
+      if ((*it)->closed.load(std::memory_order_acquire) &&
+          (*it)->ring.size() == 0) {
+        it = registry.erase(it);
+        erased = true;
+      } else {
+        ++it;
+      }
+    }
+    if (erased)
+      version.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * @brief The writer thread's loop: merges the rings into the stream,
+   * flushing the stream whenever it runs out of Lines to write, unless it is a
+   * RecordSink, which is only flushed on flush() and when the logger stops.
+   */
+  void run() {
+    std::vector<std::shared_ptr<LocalRing>> rings;
+    std::size_t seen = 0;
+    unsigned idle = 0;
+    for (;;) {
+      crash::park_if_halted();
+      // Read before the registry, so that a flush also sees rings registered
+      // by the flushing thread.
+      std::size_t requested = flush_requests.load(std::memory_order_acquire);
+      bool stopping = !running.load(std::memory_order_acquire);
+      if (version.load(std::memory_order_acquire) != seen) {
+        std::lock_guard<std::mutex> lock(registry_lock);
+        rings = registry;
+        seen = version.load(std::memory_order_relaxed);
+      }
+      bool drain = stopping || requested != flushes_done.load();
+
+      Metrics *m = metering.get();
+      if (m != nullptr)
+        m->queued(depth(rings));
+      std::size_t batch = 0;
+      for (; write_oldest(rings, drain); crash::park_if_halted())
+        ++batch;
+      if (Dedup *d = dedup.get()) {
+        auto write_line = [this](Line &l) { write(l); };
+        if (drain)
+          d->drain(write_line);
+        else
+          d->expire(write_line);
+      }
+      if (m != nullptr && m->due(steady::now())) {
+        Line report = metrics_record(m->snapshot(depth(rings)), m->level);
+        write(report);
+        ++batch;
+      }
+
+      if constexpr (!RecordSink<Stream>)
+        if (batch && !drain)
+          stream << std::flush;
+      if (drain) {
+        stream << std::flush;
+        flushes_done.store(requested, std::memory_order_release);
+      }
+      if (batch)
+        idle = 0;
+      if (stopping) {
+        overload.report([this](Line &l) { write(l); });
+        stream << std::flush;
+        return;
+      }
+      if (batch)
+        continue;
+      unregister_closed();
+      if (++idle < 64)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }
+
+public:
+  /**
+   * @brief Constructs a logger from a stream and starts its writer thread.
+   *
+   * @param s The stream to which to log.
+   * @param capacity The number of records each thread can have waiting before
+   * it has to wait for the writer.
+   * @param grace How long to hold back a Line while some thread has nothing
+   * queued, in case it is about to push an older one.
+   * @param b What a thread does when its ring is full; PRIORITY works as
+   * DROP_BELOW without the reserve, since records are merged by time.
+   */
+  MergingLogger(Stream &s, std::size_t capacity = 1 << 10,
+                std::chrono::system_clock::duration grace =
+                    std::chrono::milliseconds(2),
+                Backpressure b = Backpressure())
+      : stream(s), filter([](Line &l) { return true; }),
+        id(next_logger_id()), capacity(capacity), grace(grace), overload(b),
+        version(0),
+        flush_requests(0), flushes_done(0), running(true),
+        writer(&MergingLogger::run, this) {}
+
+  /**
+   * @brief Writes out all pending records, stops the writer thread and lets
+   * logging threads know that their rings can be dropped.
+   */
+  ~MergingLogger() {
+    running.store(false, std::memory_order_release);
+    writer.join();
+    for (auto &r : registry)
+      r->retired.store(true, std::memory_order_release);
+  }
+
+  /**
+   * @brief Set the filter for the log.
+   *
+   * @param A boolean function taking in a reference to a Line and outputting a
+   * boolean, so it can modify and report whether to finally output or not.
+   */
+  void set_filter(Filter f) { filter = f; }
+
+  /**
+   * @brief Collapses repeated messages on the writer thread, see
+   * Logger::set_dedup. Counts still pending are written when the writer runs
+   * out of records to write after their window, on flush(), and when the
+   * logger stops.
+   */
+  void set_dedup(std::chrono::system_clock::duration window,
+                 std::size_t slots = 16) {
+    dedup.enable(window, slots);
+  }
+
+  /**
+   * @brief Blocks until every record committed before the call has been
+   * written and the stream flushed, regardless of the grace period.
+   */
+  void flush() {
+    std::size_t target = flush_requests.fetch_add(1) + 1;
+    while (flushes_done.load(std::memory_order_acquire) < target)
+      std::this_thread::yield();
+  }
+
+  /**
+   * @brief Pushes a completed Line to the current thread's ring. Called by
+   * Record at the end of the log statement.
+   *
+   * @param line The completed line; moved from.
+   */
+  void commit(Line &line) {
+    overload.push(local_ring().ring, line);
+  }
+
+  /**
+   * @return The number of records of a severity dropped so far, see
+   * Overload::dropped.
+   */
+  std::uint64_t dropped(int level) const { return overload.dropped(level); }
+
+  /**
+   * @return The number of records dropped so far.
+   */
+  std::uint64_t dropped() const { return overload.dropped(); }
+
+  /**
+   * @brief Counts what logging costs, as Logger::enable_metrics does: the
+   * records written and filtered out by severity, the bytes written and the
+   * time spent writing them on the writer thread, and the number of records
+   * in all the rings, whose peak is taken by the writer before each batch.
+   * Periodic snapshots are written by the writer thread.
+   */
+  void enable_metrics(steady::duration every = steady::duration::zero(),
+                      int level = 20) {
+    if (metering.enable(every, level))
+      this->count_rejections(metering.get());
+  }
+
+  /**
+   * @return The counts so far, all zero while counting is off.
+   */
+  MetricsSnapshot metrics() {
+    Metrics *m = metering.get();
+    if (m == nullptr)
+      return MetricsSnapshot();
+    std::lock_guard<std::mutex> lock(registry_lock);
+    return m->snapshot(depth(registry));
+  }
+
+  /**
+   * @brief Pushes a snapshot of the counts as a record. Does nothing while
+   * counting is off.
+   */
+  void report_metrics() {
+    if (Metrics *m = metering.get()) {
+      Line line = metrics_record(metrics(), m->level);
+      commit(line);
+    }
+  }
+
+  /**
+   * @brief Constructs a logging record from contextual information when the
+   * logging level exceeds the threshold of the logger.
+   *
+   * @param N the level at which to log.
+   * @param info Contextual information about the log statement: line, file, and
+   * function name.
+   *
+   * @return A Record with the logger's format and specified level that can be
+   * streamed to.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N >= threshold>::type * = nullptr>
+  Record<MergingLogger> log(ContextInfo info) {
+    return {*this, info};
+  }
+
+  /**
+   * @brief For logging levels below the threshold of the logger, this overload
+   * is called and does nothing.
+   *
+   * @param N logging level, below the threshold of the logger.
+   * @param info Ignored.
+   *
+   * @return A NoRecord that does nothing when you stream to it.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N<threshold>::type * = nullptr> NoRecord
+                log(ContextInfo info) {
+    return {};
+  }
+};
+}
+
+#endif /*__ASYNC_H__*/
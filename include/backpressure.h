@@ -0,0 +1,151 @@
+/**
+ * Backpressure for the loggers that queue records (see async.h): what a
+ * logging thread does when the queue is full, and the accounting of the
+ * records it drops.
+ */
+#ifndef __BACKPRESSURE_H__
+#define __BACKPRESSURE_H__
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "line.h"
+
+namespace logger {
+
+/**
+ * @brief What a queued logger does with a record its queue has no room for.
+ *
+ * @usage AsyncLogger<...> logger(sink, 1 << 13, {Backpressure::DROP_BELOW,
+ * WARNING});
+ */
+struct Backpressure {
+  enum Mode {
+    // Wait for the writer to make room; nothing is lost.
+    BLOCK,
+
+    // Drop the record.
+    DROP_NEWEST,
+
+    // Drop records below the severity once the queue is three quarters full,
+    // keeping the rest of it for the others, which wait for room.
+    DROP_BELOW,
+
+    // Queue records at or above the severity in a lane of their own, which
+    // the writer always empties first and which they wait for; drop the
+    // others when their lane is full. Records then come out of order, though
+    // with their times. A MergingLogger, which writes in order of time, has
+    // no lanes and treats this as DROP_BELOW without the reserve.
+    PRIORITY
+  };
+
+  Mode mode = BLOCK;
+
+  // The severity that separates the records to keep from those to drop; ERROR
+  // by default (Severity is declared after the loggers).
+  int severity = 40;
+};
+
+/**
+ * @brief Applies a Backpressure to the pushes to a logger's queues, and counts
+ * the records dropped.
+ *
+ * @detailed Drops are counted by severity for good, and as a count not yet
+ * reported. The next record queued takes that count as a "dropped" field, so
+ * that it marks the gap where the dropped records would have been, in every
+ * format: ` dropped=N` after the message in text, a member in JSON. See
+ * analyser::Parser::dropped to total them.
+ */
+class Overload {
+  Backpressure policy;
+  std::array<std::atomic<std::uint64_t>, 6> by_level{};
+  std::atomic<std::uint64_t> unreported{0};
+
+  static std::size_t slot(int level) {
+    return std::min(std::max(level, 0) / 10, 5);
+  }
+
+  void drop(const Line &line, std::uint64_t carried) {
+    by_level[slot(line.info.level)].fetch_add(1, std::memory_order_relaxed);
+    unreported.fetch_add(carried + 1, std::memory_order_relaxed);
+  }
+
+public:
+  explicit Overload(Backpressure b = Backpressure()) : policy(b) {}
+
+  const Backpressure &backpressure() const { return policy; }
+
+  /**
+   * @brief Whether a record goes to the priority lane.
+   */
+  bool priority(const Line &line) const {
+    return policy.mode == Backpressure::PRIORITY &&
+           line.info.level >= policy.severity;
+  }
+
+  /**
+   * @brief Pushes a line to a queue, waiting for room or dropping it as the
+   * policy says. Adds the count of the drops not yet reported to the line.
+   *
+   * @param q An MPSCQueue or SPSCRing of Lines.
+   * @param line The line; moved from unless dropped.
+   */
+  template <typename Queue> void push(Queue &q, Line &line) {
+    bool severe = line.info.level >= policy.severity;
+    if (policy.mode == Backpressure::DROP_BELOW && !severe &&
+        q.size() >= q.capacity() - q.capacity() / 4) {
+      drop(line, 0);
+      return;
+    }
+    std::uint64_t carried = 0;
+    if (unreported.load(std::memory_order_relaxed) != 0) {
+      carried = unreported.exchange(0, std::memory_order_relaxed);
+      line.fields.add("dropped", carried);
+    }
+    while (!q.try_push(std::move(line))) {
+      if (policy.mode == Backpressure::DROP_NEWEST ||
+          (policy.mode != Backpressure::BLOCK && !severe)) {
+        drop(line, carried);
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * @brief Writes the count of the drops not yet reported, if any, as a
+   * WARNING record of its own; for when no record is left to carry it.
+   */
+  template <typename Write> void report(Write &&write) {
+    if (unreported.load(std::memory_order_relaxed) == 0)
+      return;
+    Line notice({__FILE__, __func__, __LINE__, 30});
+    notice.message.append("dropped records");
+    notice.fields.add("dropped", unreported.exchange(0));
+    write(notice);
+  }
+
+  /**
+   * @return The number of records of a severity dropped so far; levels
+   * between the named ones count with the one below.
+   */
+  std::uint64_t dropped(int level) const {
+    return by_level[slot(level)].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @return The number of records dropped so far.
+   */
+  std::uint64_t dropped() const {
+    std::uint64_t n = 0;
+    for (auto &c : by_level)
+      n += c.load(std::memory_order_relaxed);
+    return n;
+  }
+};
+}
+
+#endif /*__BACKPRESSURE_H__*/
@@ -0,0 +1,642 @@
+/**
+ * A binary logging mode that defers all formatting: log statements only store
+ * a compact entry with raw argument bytes, and the text is produced offline by
+ * a Reader (see src/decoder.cpp and analyser::Parser::read_binary_file).
+ */
+#ifndef __BINARY_H__
+#define __BINARY_H__
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "logconfig.h"
+#include "logger.h"
+
+namespace logger {
+
+/**
+ * @brief Definitions of the binary log format.
+ *
+ * @detailed A binary log starts with a header: the magic string, the format
+ * string (u32 length and bytes) and the Props (u8 count and one code per Prop,
+ * see prop_code). Then follows a sequence of entries, each starting with a tag:
+ *
+ * - SITE: u64 site id, i32 line, i32 level, then file and function name as
+ *   strings. Written once per log statement, before its first RECORD.
+ * - RECORD: u64 site id, i64 nanoseconds since the epoch, the raw thread id,
+ *   u64 hash, u32 payload length, and the payload: the streamed arguments, each
+ *   an Arg tag followed by its raw bytes (strings as u32 length and bytes).
+ *   Fields streamed with kv() are a FIELD tag, the key as a string, then the
+ *   value as any other argument.
+ *
+ * Numbers are stored in host byte order; logs are meant to be decoded on the
+ * machine (architecture) that wrote them.
+ */
+namespace binary {
+
+constexpr char magic[8] = {'C', 'L', 'A', 'Y', 'E', 'R', 'B', '1'};
+
+enum Tag : char { SITE = 'S', RECORD = 'R' };
+
+enum Arg : char {
+  BOOL = 'b',
+  CHAR = 'c',
+  INT = 'i',
+  UINT = 'u',
+  DOUBLE = 'd',
+  LDOUBLE = 'e',
+  PTR = 'p',
+  STR = 's',
+  FIELD = 'f'
+};
+
+static_assert(std::is_trivially_copyable<std::thread::id>::value &&
+                  sizeof(std::thread::id) <= 8,
+              "thread ids are stored as 8 raw bytes");
+
+/**
+ * @brief The offsets of the fields in the fixed-size head of a RECORD.
+ */
+enum Offset : std::size_t {
+  SITE_AT = 1,
+  TIME_AT = 9,
+  THREAD_AT = 17,
+  HASH_AT = 25,
+  LENGTH_AT = 33,
+  PAYLOAD_AT = 37
+};
+
+/**
+ * @brief The code under which a Prop is stored in the header of a binary log.
+ * Only the Props from logger.h and logconfig.h can be decoded.
+ */
+template <typename Stream, Prop<Stream> p> constexpr char prop_code() {
+  return p == prop_date<Stream>     ? 'D'
+         : p == prop_time<Stream>   ? 'T'
+         : p == prop_time_us<Stream> ? 'U'
+         : p == prop_time_ns<Stream> ? 'S'
+         : p == prop_level<Stream>  ? 'L'
+         : p == prop_thread<Stream> ? 'R'
+         : p == prop_file<Stream>   ? 'F'
+         : p == prop_func<Stream>   ? 'N'
+         : p == prop_line<Stream>   ? 'I'
+         : p == prop_msg<Stream>    ? 'M'
+         : p == prop_hash<Stream>   ? 'H'
+                                    : '\0';
+}
+
+/**
+ * @return The Prop stored under a code, or nullptr for an unknown code.
+ */
+inline Prop<std::ostream> prop_for(char code) {
+  switch (code) {
+    case 'D': return prop_date<std::ostream>;
+    case 'T': return prop_time<std::ostream>;
+    case 'U': return prop_time_us<std::ostream>;
+    case 'S': return prop_time_ns<std::ostream>;
+    case 'L': return prop_level<std::ostream>;
+    case 'R': return prop_thread<std::ostream>;
+    case 'F': return prop_file<std::ostream>;
+    case 'N': return prop_func<std::ostream>;
+    case 'I': return prop_line<std::ostream>;
+    case 'M': return prop_msg<std::ostream>;
+    case 'H': return prop_hash<std::ostream>;
+    default: return nullptr;
+  }
+}
+
+/**
+ * @brief Appends the raw bytes of a value to a buffer.
+ */
+template <typename T> inline void put(LineBuffer &b, const T &v) {
+  b.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+/**
+ * @brief Appends a string to a buffer as its u32 length and bytes.
+ */
+inline void put_string(LineBuffer &b, std::string_view s) {
+  put(b, std::uint32_t(s.size()));
+  b.append(s);
+}
+}
+
+/**
+ * @brief A log record that stores what's streamed to it as raw bytes, leaving
+ * all formatting to the decoder. The counterpart of Record for BinaryLogger.
+ *
+ * @detailed Arithmetic types, pointers and strings are stored as they are;
+ * anything else streamable is formatted on the spot and stored as a string.
+ * Manipulators have no effect.
+ */
+template <typename Sink> class BinaryRecord {
+  /**
+   * @brief The sink to commit the record to once completed.
+   */
+  Sink &sink;
+
+  /**
+   * @brief The context of the log statement.
+   */
+  ContextInfo info;
+
+  /**
+   * @brief The encoded entry, see binary.
+   */
+  LineBuffer entry;
+
+  /**
+   * @brief The hash identifier of the message and whether streamed objects
+   * currently influence it; as in Record.
+   */
+  std::uint64_t hash;
+  bool hash_enabled;
+
+  /**
+   * @brief Encodes a streamed object into the entry.
+   */
+  template <typename T> void encode(const T &v) {
+    using namespace binary;
+    if constexpr (std::is_same<T, bool>::value) {
+      put(entry, BOOL);
+      put(entry, v);
+    } else if constexpr (std::is_same<T, char>::value ||
+                         std::is_same<T, signed char>::value ||
+                         std::is_same<T, unsigned char>::value) {
+      put(entry, CHAR);
+      put(entry, char(v));
+    } else if constexpr (std::is_integral<T>::value &&
+                         std::is_signed<T>::value) {
+      put(entry, INT);
+      put(entry, std::int64_t(v));
+    } else if constexpr (std::is_integral<T>::value) {
+      put(entry, UINT);
+      put(entry, std::uint64_t(v));
+    } else if constexpr (std::is_same<T, long double>::value) {
+      put(entry, LDOUBLE);
+      put(entry, v);
+    } else if constexpr (std::is_floating_point<T>::value) {
+      put(entry, DOUBLE);
+      put(entry, double(v));
+    } else if constexpr (std::is_same<T, const char *>::value ||
+                         std::is_same<T, char *>::value) {
+      put(entry, STR);
+      put_string(entry, v ? std::string_view(v) : std::string_view());
+    } else if constexpr (std::is_convertible<const T &,
+                                             std::string_view>::value) {
+      put(entry, STR);
+      put_string(entry, std::string_view(v));
+    } else if constexpr (std::is_pointer<T>::value &&
+                         !std::is_function<
+                             typename std::remove_pointer<T>::type>::value) {
+      put(entry, PTR);
+      put(entry, std::uint64_t(reinterpret_cast<std::uintptr_t>(v)));
+    } else {
+      std::ostringstream s;
+      s << v;
+      put(entry, STR);
+      put_string(entry, s.str());
+    }
+  }
+
+public:
+  /**
+   * @brief Constructs a BinaryRecord, capturing the time and thread.
+   *
+   * @param s the sink to which to commit the record.
+   * @param input_info the contextual information about the log command.
+   */
+  BinaryRecord(Sink &s, ContextInfo input_info)
+      : sink(s), info(input_info), hash(input_info.site), hash_enabled(true) {
+    using namespace std::chrono;
+    std::int64_t ns =
+        duration_cast<nanoseconds>(clock_now().time_since_epoch()).count();
+    std::uint64_t thread = 0;
+    std::thread::id id = std::this_thread::get_id();
+    std::memcpy(&thread, &id, sizeof(id));
+
+    using binary::put;
+    put(entry, binary::RECORD);
+    put(entry, info.site);
+    put(entry, ns);
+    put(entry, thread);
+    put(entry, std::uint64_t(0));
+    put(entry, std::uint32_t(0));
+  }
+
+  /**
+   * @brief Fills in the hash and payload length and commits the entry.
+   */
+  ~BinaryRecord() {
+    std::uint64_t h = hash;
+    std::uint32_t length = entry.size() - binary::PAYLOAD_AT;
+    std::memcpy(entry.data() + binary::HASH_AT, &h, sizeof(h));
+    std::memcpy(entry.data() + binary::LENGTH_AT, &length, sizeof(length));
+    sink.commit(info, entry.data(), entry.size());
+  }
+
+  /**
+   * @brief Stores an object in the entry. Also modifies the hash identifier if
+   * the option is enabled.
+   *
+   * @param s The object to be streamed.
+   * @return The same record, for stringing stream commands.
+   */
+  template <Streamable S> BinaryRecord &operator<<(const S &s) {
+    if (hash_enabled)
+      hash = hash_piece(hash, s);
+    encode(s);
+    return *this;
+  }
+
+  /**
+   * @brief Stores a character array that can be written to, hashed by its
+   * type, see Record.
+   */
+  template <std::size_t N> BinaryRecord &operator<<(char (&s)[N]) {
+    if (hash_enabled)
+      hash = hash_piece(hash, s);
+    encode(s);
+    return *this;
+  }
+
+  /**
+   * @brief Stores a typed field, see Record. Also modifies the hash identifier
+   * if the option is enabled.
+   *
+   * @param f The field, see kv().
+   * @return The same record, for stringing stream commands.
+   */
+  template <typename T> BinaryRecord &operator<<(const KeyValue<T> &f) {
+    if (hash_enabled)
+      hash = mix(mix(hash, fnv1a(f.key)),
+                 std::integral_constant<std::uint64_t, type_id<T>()>::value);
+    binary::put(entry, binary::FIELD);
+    binary::put_string(entry, f.key);
+    encode(f.value);
+    return *this;
+  }
+
+  /**
+   * @brief Set the flag that determines whether or not subsequent objects to be
+   * streamed should influence the hash or not.
+   *
+   * @return The same record, for stringing stream commands.
+   */
+  template <bool Val> BinaryRecord &operator<<(const hash::Flag<Val> &s) {
+    hash_enabled = Val;
+    return *this;
+  }
+};
+
+/**
+ * @brief A logger with the same interface as Logger that writes binary
+ * entries instead of text. The format and Props are only written once, in the
+ * header, and are applied when the log is decoded.
+ *
+ * @remark The stream should be opened in binary mode. Filters aren't supported
+ * since there is no message text to filter on.
+ */
+template <typename Stream, int threshold, const char *fmt,
+          Prop<Stream>... props>
+class BinaryLogger : public Leveled<threshold> {
+  static_assert(((binary::prop_code<Stream, props>() != '\0') && ...),
+                "a binary log can only store the predefined Props");
+  static_assert(wildcards(fmt) == sizeof...(props),
+                "the format must have exactly one % per Prop");
+
+  /**
+   * @brief The lock associated with the logger, to prevent concurrent access to
+   * the stream and the set of sites.
+   */
+  std::mutex logging_lock;
+
+  /**
+   * @brief The underlying stream to which we log.
+   */
+  Stream &stream;
+
+  /**
+   * @brief The log statements whose SITE entry has been written already.
+   */
+  std::unordered_set<std::uint64_t> sites;
+
+public:
+  /**
+   * @brief Constructs a logger from a stream and writes the header.
+   *
+   * @param s The stream to which to log.
+   */
+  BinaryLogger(Stream &s) : stream(s) {
+    LineBuffer header;
+    header.append(binary::magic, sizeof(binary::magic));
+    binary::put_string(header, fmt);
+    binary::put(header, std::uint8_t(sizeof...(props)));
+    for (char code : {binary::prop_code<Stream, props>()...})
+      binary::put(header, code);
+    stream.write(header.data(), header.size());
+  }
+
+  /**
+   * @brief Writes an entry to the stream, preceded by its SITE entry if this
+   * is the first time the statement logs. Called by BinaryRecord.
+   *
+   * @param info The context of the log statement.
+   * @param data The encoded RECORD.
+   * @param size The size of the encoded RECORD.
+   */
+  void commit(const ContextInfo &info, const char *data, std::size_t size) {
+    std::lock_guard<std::mutex> lock(logging_lock);
+    if (sites.insert(info.site).second) {
+      LineBuffer site;
+      binary::put(site, binary::SITE);
+      binary::put(site, info.site);
+      binary::put(site, std::int32_t(info.line));
+      binary::put(site, std::int32_t(info.level));
+      binary::put_string(site, info.file);
+      binary::put_string(site, info.fn);
+      stream.write(site.data(), site.size());
+    }
+    stream.write(data, size);
+    if constexpr (RecordSink<Stream>)
+      stream.end_record(info.level);
+  }
+
+  /**
+   * @brief Flushes the underlying stream.
+   */
+  void flush() {
+    std::lock_guard<std::mutex> lock(logging_lock);
+    stream.flush();
+  }
+
+  /**
+   * @brief Constructs a binary record from contextual information when the
+   * logging level exceeds the threshold of the logger.
+   *
+   * @param N the level at which to log.
+   * @param info Contextual information about the log statement: line, file, and
+   * function name.
+   *
+   * @return A BinaryRecord that can be streamed to.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N >= threshold>::type * = nullptr>
+  BinaryRecord<BinaryLogger> log(ContextInfo info) {
+    return {*this, info};
+  }
+
+  /**
+   * @brief For logging levels below the threshold of the logger, this overload
+   * is called and does nothing.
+   *
+   * @param N logging level, below the threshold of the logger.
+   * @param info Ignored.
+   *
+   * @return A NoRecord that does nothing when you stream to it.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N<threshold>::type * = nullptr> NoRecord
+                log(ContextInfo info) {
+    return {};
+  }
+};
+
+/**
+ * @brief The binary counterpart of FullLogger; decodes to the same text.
+ *
+ * @usage std::ofstream f("log.bin", std::ios::binary);
+ * BinaryFullLogger<std::ostream, DEBUG> my_logger(f);
+ */
+template <typename Stream, int threshold = INFO>
+using BinaryFullLogger =
+    BinaryLogger<Stream, threshold, full_fmt, prop_date, prop_time, prop_level,
+                 prop_thread, prop_file, prop_func, prop_line, prop_msg,
+                 prop_hash>;
+
+namespace binary {
+
+/**
+ * @brief Decodes a binary log back into Lines, and formats them as the logger
+ * that wrote them would have.
+ */
+class Reader {
+  /**
+   * @brief The stream to decode from.
+   */
+  std::istream &in;
+
+  /**
+   * @brief The format and the Props from the header.
+   */
+  std::string fmt;
+  std::vector<Prop<std::ostream>> props;
+
+  /**
+   * @brief The sites read so far. Lines point into these, so they must stay
+   * put: unordered_map never moves its elements.
+   */
+  struct Site {
+    std::string file, func;
+    int line, level;
+  };
+  std::unordered_map<std::uint64_t, Site> sites;
+
+  /**
+   * @brief Whether the header was read successfully.
+   */
+  bool valid;
+
+  template <typename T> bool get(T &v) {
+    return bool(in.read(reinterpret_cast<char *>(&v), sizeof(v)));
+  }
+
+  bool get(std::string &s) {
+    std::uint32_t n;
+    if (!get(n))
+      return false;
+    s.resize(n);
+    return n == 0 || bool(in.read(&s[0], n));
+  }
+
+  bool read_site() {
+    std::uint64_t id;
+    std::int32_t line, level;
+    Site s;
+    if (!get(id) || !get(line) || !get(level) || !get(s.file) ||
+        !get(s.func))
+      return false;
+    s.line = line;
+    s.level = level;
+    sites[id] = std::move(s);
+    return true;
+  }
+
+  /**
+   * @brief Decodes the value of one argument of a payload and passes it to a
+   * function, with the type it was stored with.
+   */
+  template <typename F>
+  static bool read_value(std::istringstream &payload, char tag, F &&f) {
+    auto get = [&payload](auto &v) {
+      return bool(payload.read(reinterpret_cast<char *>(&v), sizeof(v)));
+    };
+    switch (tag) {
+      case BOOL: { bool v; return get(v) && f(v); }
+      case CHAR: { char v; return get(v) && f(v); }
+      case INT: { std::int64_t v; return get(v) && f(v); }
+      case UINT: { std::uint64_t v; return get(v) && f(v); }
+      case DOUBLE: { double v; return get(v) && f(v); }
+      case LDOUBLE: { long double v; return get(v) && f(v); }
+      case PTR: {
+        std::uint64_t v;
+        return get(v) && f(reinterpret_cast<const void *>(std::uintptr_t(v)));
+      }
+      case STR: {
+        std::uint32_t n;
+        if (!get(n))
+          return false;
+        std::string s(n, '\0');
+        return (n == 0 || payload.read(&s[0], n)) && f(s);
+      }
+      default: return false;
+    }
+  }
+
+  /**
+   * @brief Decodes one argument of a payload: streams it to the message, or
+   * adds it to the fields of the line if it is a field.
+   */
+  static bool read_arg(std::istringstream &payload, std::ostream &message,
+                       Line &line) {
+    char tag;
+    if (!payload.get(tag))
+      return false;
+    if (tag != FIELD)
+      return read_value(payload, tag,
+                        [&message](const auto &v) { return bool(message << v); });
+    std::uint32_t n;
+    if (!payload.read(reinterpret_cast<char *>(&n), sizeof(n)))
+      return false;
+    std::string key(n, '\0');
+    if ((n != 0 && !payload.read(&key[0], n)) || !payload.get(tag))
+      return false;
+    return read_value(payload, tag, [&key, &line](const auto &v) {
+      using T = typename std::decay<decltype(v)>::type;
+      if constexpr (Fields::storable<T>) {
+        line.fields.add(key, v);
+      } else {
+        std::ostringstream s;
+        s << v;
+        line.fields.add(key, s.str());
+      }
+      return true;
+    });
+  }
+
+public:
+  /**
+   * @brief Constructs a Reader and reads the header of the log.
+   *
+   * @param s The stream to decode from, opened in binary mode.
+   */
+  explicit Reader(std::istream &s) : in(s), valid(false) {
+    char m[sizeof(magic)];
+    std::uint8_t n;
+    if (!in.read(m, sizeof(m)) || std::memcmp(m, magic, sizeof(m)) != 0 ||
+        !get(fmt) || !get(n))
+      return;
+    for (std::uint8_t i = 0; i < n; ++i) {
+      char code;
+      if (!get(code) || prop_for(code) == nullptr)
+        return;
+      props.push_back(prop_for(code));
+    }
+    valid = true;
+  }
+
+  /**
+   * @return Whether the stream holds a binary log that can be decoded.
+   */
+  explicit operator bool() const { return valid; }
+
+  /**
+   * @brief Decodes the next record.
+   *
+   * @param line The Line to decode into. Its ContextInfo points into the
+   * Reader, which must outlive it.
+   * @return false at the end of the log, or if it is corrupt.
+   */
+  bool next(Line &line) {
+    char tag;
+    while (valid && get(tag)) {
+      if (tag == SITE) {
+        if (!read_site())
+          return false;
+        continue;
+      }
+      std::uint64_t id, thread, hash;
+      std::int64_t ns;
+      std::string payload;
+      if (tag != RECORD || !get(id) || !get(ns) || !get(thread) ||
+          !get(hash) || !get(payload))
+        return false;
+      auto site = sites.find(id);
+      if (site == sites.end())
+        return false;
+
+      const Site &s = site->second;
+      line = Line({s.file.c_str(), s.func.c_str(), s.line, s.level, id});
+      line.hash = hash;
+      std::memcpy(static_cast<void *>(&line.thread), &thread,
+                  sizeof(line.thread));
+      // the ordinal stamped above is that of the decoding thread: print the
+      // stored id instead
+      line.ordinal = 0;
+      line.time = std::chrono::system_clock::time_point(
+          std::chrono::duration_cast<std::chrono::system_clock::duration>(
+              std::chrono::nanoseconds(ns)));
+      std::istringstream args(payload);
+      MessageStream &message = message_stream();
+      message.reset();
+      message.into(line.message);
+      while (args.peek() != std::char_traits<char>::eof())
+        if (!read_arg(args, message, line))
+          return false;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Prints a decoded Line according to the format and Props of the log,
+   * without a line ending.
+   */
+  void print(std::ostream &o, const Line &line) const {
+    const char *format = fmt.c_str();
+    for (auto prop : props) {
+      while (*format != '\0' && *format != '%')
+        o << *(format++);
+      if (*format == '\0')
+        return;
+      ++format;
+      prop(o, line);
+    }
+    o << format;
+  }
+};
+}
+}
+
+#endif /*__BINARY_H__*/
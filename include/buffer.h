@@ -0,0 +1,335 @@
+/**
+ * An allocation-free buffer for log messages, and the stream adapter that lets
+ * anything streamable be written into it.
+ */
+#ifndef __BUFFER_H__
+#define __BUFFER_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace logger {
+
+/**
+ * @brief Something is Writable if it can take a run of characters in one call,
+ * like an ostream.
+ */
+template <typename T>
+concept bool Writable = requires(T o, const char *p, std::streamsize n) {
+  o.write(p, n);
+};
+
+/**
+ * @brief Writes a run of characters to a stream: with a single call to write
+ * when the stream supports it, otherwise by streaming it as a string.
+ */
+template <typename Stream>
+inline void write_run(Stream &stream, const char *p, std::size_t n) {
+  if constexpr (Writable<Stream>)
+    stream.write(p, n);
+  else
+    stream << std::string(p, n);
+}
+
+/**
+ * @brief A small per-thread cache of heap blocks for buffers that outgrow
+ * their inline storage, so that long messages don't allocate every time
+ * either.
+ *
+ * @remark Blocks are freed into the cache of whichever thread releases them;
+ * they don't need to return to the thread that took them.
+ */
+class SpillArena {
+  struct Block {
+    char *data;
+    std::size_t capacity;
+  };
+
+  /**
+   * @brief The number of blocks kept around; larger blocks are preferred.
+   */
+  static constexpr std::size_t max_blocks = 4;
+
+  Block blocks[max_blocks];
+  std::size_t count = 0;
+
+public:
+  SpillArena() = default;
+  SpillArena(const SpillArena &) = delete;
+  SpillArena &operator=(const SpillArena &) = delete;
+
+  ~SpillArena() {
+    for (std::size_t i = 0; i < count; ++i)
+      delete[] blocks[i].data;
+    gone() = true;
+  }
+
+  /**
+   * @return Whether the current thread's arena has been destroyed, which
+   * happens before other thread_local objects holding buffers are destroyed
+   * if they were created first.
+   */
+  static bool &gone() {
+    static thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  /**
+   * @brief Takes a block of at least the given capacity, from the cache if
+   * possible.
+   *
+   * @param capacity The minimum capacity needed.
+   * @param[out] got The capacity of the returned block.
+   */
+  char *take(std::size_t capacity, std::size_t &got) {
+    for (std::size_t i = 0; i < count; ++i) {
+      if (blocks[i].capacity >= capacity) {
+        char *data = blocks[i].data;
+        got = blocks[i].capacity;
+        blocks[i] = blocks[--count];
+        return data;
+      }
+    }
+    got = std::max<std::size_t>(capacity, 1024);
+    return new char[got];
+  }
+
+  /**
+   * @brief Returns a block to the cache, or frees it if the cache is full of
+   * larger blocks.
+   */
+  void give(char *data, std::size_t capacity) {
+    if (count < max_blocks) {
+      blocks[count++] = {data, capacity};
+      return;
+    }
+    auto smallest = std::min_element(
+        blocks, blocks + count,
+        [](const Block &a, const Block &b) { return a.capacity < b.capacity; });
+    if (smallest->capacity < capacity) {
+      std::swap(smallest->data, data);
+      std::swap(smallest->capacity, capacity);
+    }
+    delete[] data;
+  }
+};
+
+/**
+ * @return The current thread's SpillArena.
+ */
+inline SpillArena &spill_arena() {
+  static thread_local SpillArena arena;
+  return arena;
+}
+
+/**
+ * @brief A growable character buffer that keeps short contents inline and
+ * spills longer ones into blocks from the thread's SpillArena. Meant to replace
+ * std::ostringstream for log messages, without its allocations and locale
+ * copies.
+ *
+ * @param local_capacity The number of characters kept inline.
+ */
+template <std::size_t local_capacity> class InlineBuffer {
+  char *data_;
+  std::size_t size_, capacity_;
+  char local[local_capacity];
+
+  bool spilled() const { return data_ != local; }
+
+  /**
+   * @brief Moves the contents to a block with room for at least n more
+   * characters.
+   */
+  void grow(std::size_t n) {
+    std::size_t got = std::max(size_ + n, 2 * capacity_);
+    char *block = SpillArena::gone() ? new char[got]
+                                     : spill_arena().take(got, got);
+    std::memcpy(block, data_, size_);
+    release();
+    data_ = block;
+    capacity_ = got;
+  }
+
+  /**
+   * @brief Gives the spill block, if any, back to the arena.
+   */
+  void release() {
+    if (spilled() && SpillArena::gone())
+      delete[] data_;
+    else if (spilled())
+      spill_arena().give(data_, capacity_);
+    data_ = local;
+    capacity_ = local_capacity;
+  }
+
+  /**
+   * @brief Takes over the contents of another buffer, leaving it empty.
+   */
+  void steal(InlineBuffer &o) {
+    if (o.spilled()) {
+      data_ = o.data_;
+      capacity_ = o.capacity_;
+    } else {
+      std::memcpy(local, o.local, o.size_);
+    }
+    size_ = o.size_;
+    o.data_ = o.local;
+    o.size_ = 0;
+    o.capacity_ = local_capacity;
+  }
+
+public:
+  InlineBuffer() : data_(local), size_(0), capacity_(local_capacity) {}
+
+  InlineBuffer(const InlineBuffer &) = delete;
+  InlineBuffer &operator=(const InlineBuffer &) = delete;
+
+  InlineBuffer(InlineBuffer &&o) : InlineBuffer() { steal(o); }
+
+  InlineBuffer &operator=(InlineBuffer &&o) {
+    if (this != &o) {
+      release();
+      steal(o);
+    }
+    return *this;
+  }
+
+  ~InlineBuffer() { release(); }
+
+  /**
+   * @brief Appends a run of characters.
+   */
+  void append(const char *p, std::size_t n) {
+    if (size_ + n > capacity_)
+      grow(n);
+    std::memcpy(data_ + size_, p, n);
+    size_ += n;
+  }
+
+  void append(std::string_view s) { append(s.data(), s.size()); }
+
+  void push_back(char c) {
+    if (size_ == capacity_)
+      grow(1);
+    data_[size_++] = c;
+  }
+
+  /**
+   * @brief Makes room for n characters at the end, to be written in place and
+   * then committed with commit().
+   *
+   * @return A pointer to the room.
+   */
+  char *reserve(std::size_t n) {
+    if (size_ + n > capacity_)
+      grow(n);
+    return data_ + size_;
+  }
+
+  /**
+   * @brief Adds n characters written in place after a call to reserve().
+   */
+  void commit(std::size_t n) { size_ += n; }
+
+  /**
+   * @brief Empties the buffer, keeping any spill block for reuse.
+   */
+  void clear() { size_ = 0; }
+
+  char *data() { return data_; }
+  const char *data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  std::string_view view() const { return {data_, size_}; }
+
+  /**
+   * @return A copy of the contents, like std::ostringstream::str().
+   */
+  std::string str() const { return {data_, size_}; }
+};
+
+/**
+ * @brief The buffer for log messages, sized to fit the typical one inline.
+ */
+using LineBuffer = InlineBuffer<224>;
+
+/**
+ * @brief A streambuf that appends everything written to it to a LineBuffer.
+ */
+class LineStreambuf : public std::streambuf {
+public:
+  LineBuffer *target = nullptr;
+
+protected:
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+      target->push_back(traits_type::to_char_type(c));
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    target->append(s, n);
+    return n;
+  }
+};
+
+/**
+ * @brief An ostream that writes into a LineBuffer, so that any type with an
+ * operator<< for ostreams can be written into one. There is one per thread,
+ * see message_stream(), lent to one record at a time.
+ */
+class MessageStream : public std::ostream {
+  LineStreambuf buf;
+
+public:
+  MessageStream() : std::ostream(nullptr) { rdbuf(&buf); }
+
+  /**
+   * @brief Directs the output of the stream to a buffer.
+   *
+   * @return The stream itself.
+   */
+  MessageStream &into(LineBuffer &target) {
+    buf.target = &target;
+    return *this;
+  }
+
+  /**
+   * @brief Restores the formatting state of a freshly constructed stream,
+   * undoing manipulators streamed for a previous message.
+   */
+  void reset() {
+    flags(std::ios_base::dec | std::ios_base::skipws);
+    precision(6);
+    width(0);
+    fill(' ');
+    clear();
+  }
+};
+
+/**
+ * @return The current thread's MessageStream.
+ */
+inline MessageStream &message_stream() {
+  static thread_local MessageStream stream;
+  return stream;
+}
+
+/**
+ * @return Whether the current thread's MessageStream is lent to a record; one
+ * logged from inside the operator<< of a type streamed into that record uses a
+ * stream of its own.
+ */
+inline bool &message_stream_lent() {
+  static thread_local bool lent = false;
+  return lent;
+}
+}
+
+#endif /*__BUFFER_H__*/
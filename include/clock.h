@@ -0,0 +1,168 @@
+/**
+ * Timestamps for log lines: the clock they are read from when a Line is
+ * created, and a per-thread cache that renders them without a call to
+ * localtime for every line.
+ */
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+#if defined(CLAYER_TSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CLAYER_USE_TSC 1
+#endif
+
+namespace logger {
+
+#ifdef CLAYER_USE_TSC
+/**
+ * @brief The relation between the time stamp counter and the system clock,
+ * measured once per process.
+ *
+ * @remark Later adjustments of the system clock are not followed, and the
+ * counter is assumed to be invariant and synchronized across cores, as it is
+ * on any recent x86 processor.
+ */
+struct TscCalibration {
+  std::uint64_t tsc;
+  std::int64_t ns;
+  double ns_per_tick;
+
+  /**
+   * @brief Measures the rate of the counter against the steady clock over a
+   * few milliseconds, and anchors it to the system clock.
+   */
+  TscCalibration() {
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    std::uint64_t begin = __rdtsc();
+    ns = duration_cast<nanoseconds>(system_clock::now().time_since_epoch())
+             .count();
+    tsc = begin;
+    while (steady_clock::now() - start < milliseconds(10))
+      ;
+    std::uint64_t end = __rdtsc();
+    auto took = duration_cast<nanoseconds>(steady_clock::now() - start);
+    ns_per_tick = double(took.count()) / double(end - begin);
+  }
+};
+
+inline const TscCalibration &tsc_calibration() {
+  static const TscCalibration calibration;
+  return calibration;
+}
+#endif
+
+/**
+ * @return The current time for a log line. Reads the system clock, or the time
+ * stamp counter if CLAYER_TSC is defined and the target is x86, which is
+ * cheaper but calibrated only once.
+ */
+inline std::chrono::system_clock::time_point clock_now() {
+#ifdef CLAYER_USE_TSC
+  const TscCalibration &c = tsc_calibration();
+  auto ns = c.ns + std::int64_t(double(__rdtsc() - c.tsc) * c.ns_per_tick);
+  return std::chrono::system_clock::time_point(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::nanoseconds(ns)));
+#else
+  return std::chrono::system_clock::now();
+#endif
+}
+
+/**
+ * @brief Splits a time point into whole seconds since the epoch and the
+ * nanoseconds into the second, rounding towards the past.
+ */
+inline void split_time(std::chrono::system_clock::time_point t,
+                       std::int64_t &seconds, std::int64_t &nanoseconds) {
+  std::int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        t.time_since_epoch())
+                        .count();
+  seconds = ns / 1000000000;
+  nanoseconds = ns % 1000000000;
+  if (nanoseconds < 0) {
+    --seconds;
+    nanoseconds += 1000000000;
+  }
+}
+
+/**
+ * @brief The local date and time of day of the last second rendered on this
+ * thread. Lines logged within the same second reuse the rendered text, so
+ * localtime only runs once per second per thread.
+ */
+class TimeCache {
+  std::int64_t second;
+  char date_[24], time_[16];
+  std::size_t date_size = 0, time_size = 0;
+
+public:
+  TimeCache() : second(INT64_MIN) {}
+
+  /**
+   * @brief Renders the second containing a time point, unless it is the one
+   * already rendered.
+   *
+   * @return The nanoseconds into the second.
+   */
+  std::int64_t at(std::chrono::system_clock::time_point t) {
+    std::int64_t s, ns;
+    split_time(t, s, ns);
+    if (s != second) {
+      std::time_t now = s;
+      std::tm tm;
+      localtime_r(&now, &tm);
+      date_size = std::strftime(date_, sizeof(date_), "%F", &tm);
+      time_size = std::strftime(time_, sizeof(time_), "%T", &tm);
+      second = s;
+    }
+    return ns;
+  }
+
+  /**
+   * @return The rendered date, as YYYY-MM-DD.
+   */
+  const char *date() const { return date_; }
+  std::size_t date_length() const { return date_size; }
+
+  /**
+   * @return The rendered time of day, as HH:MM:SS.
+   */
+  const char *time() const { return time_; }
+  std::size_t time_length() const { return time_size; }
+
+  /**
+   * @brief Writes the time of day followed by a fraction of the second with
+   * the given number of digits (at most 9) into a buffer of at least 26
+   * characters.
+   *
+   * @return The number of characters written.
+   */
+  std::size_t fraction(char *out, std::int64_t nanoseconds,
+                       int digits) const {
+    std::memcpy(out, time_, time_size);
+    char *p = out + time_size;
+    *p++ = '.';
+    for (int i = 9; i > digits; --i)
+      nanoseconds /= 10;
+    for (int i = digits - 1; i >= 0; --i, nanoseconds /= 10)
+      p[i] = char('0' + nanoseconds % 10);
+    return p + digits - out;
+  }
+};
+
+/**
+ * @return The current thread's TimeCache.
+ */
+inline TimeCache &time_cache() {
+  static thread_local TimeCache cache;
+  return cache;
+}
+}
+
+#endif /*__CLOCK_H__*/
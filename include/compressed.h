@@ -0,0 +1,455 @@
+/**
+ * A file sink that compresses records in independent frames, each a gzip
+ * member, and indexes them by offset and time so that a reader can decompress
+ * them in parallel and skip those outside a time range.
+ *
+ * Compression uses zlib: link with -lz.
+ */
+#ifndef __COMPRESSED_H__
+#define __COMPRESSED_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "clock.h"
+#include "crash.h"
+#include "sink.h"
+
+namespace logger {
+
+/**
+ * @brief Definitions of the compressed log format.
+ *
+ * @detailed The log is a sequence of frames, each a complete gzip member
+ * holding whole records, so that the file as a whole can be read by zcat. Next
+ * to it, the index (the path with an .idx suffix) has one entry per frame, in
+ * the order of the frames, written once the frame is: see Frame.
+ */
+namespace frames {
+
+/**
+ * @brief An entry of the index: where a frame is in the log, the time at which
+ * its earliest record was logged and the time it was closed, in nanoseconds
+ * since the epoch; every record of the frame was logged between the two.
+ */
+struct Frame {
+  std::uint64_t offset;
+  std::uint64_t size;
+  std::int64_t first;
+  std::int64_t last;
+};
+
+inline std::string index_path(const std::string &path) {
+  return path + ".idx";
+}
+
+inline std::int64_t nanoseconds(std::chrono::system_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Writes a whole buffer to a descriptor, retrying short writes.
+ */
+inline bool write_all(int fd, const char *data, std::size_t size) {
+  while (size > 0) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Ends a gzip member with two runs of text in stored, uncompressed,
+ * blocks, with bare write calls: for the crash handler, which can't allocate
+ * what deflate needs. The member is either started here, or continued from a
+ * deflate stream flushed to a block boundary.
+ *
+ * @param started The size of the member written so far, or 0 to start one.
+ * @param crc The CRC-32 of the text in the member so far.
+ * @param before The length of that text.
+ * @return The size of the member, or 0 if it couldn't be written whole.
+ */
+inline std::uint64_t write_stored(int fd, std::uint64_t started, uLong crc,
+                                  std::uint64_t before, const char *a,
+                                  std::size_t an, const char *b,
+                                  std::size_t bn) {
+  // magic, deflate, no flags, no time, no extra flags, Unix
+  const char header[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3};
+  bool ok = started > 0 || crash::write_all(fd, header, sizeof(header));
+  std::uint64_t size = started > 0 ? started : sizeof(header);
+  const char *runs[] = {a, b};
+  std::size_t lengths[] = {an, bn};
+  for (int r = 0; r < 2; ++r) {
+    const char *p = runs[r];
+    std::size_t left = lengths[r];
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(p), left);
+    // the second run always has a block, if empty, to be the final one
+    while (ok && (left > 0 || r == 1)) {
+      std::size_t n = std::min<std::size_t>(left, 0xffff);
+      bool last = r == 1 && n == left;
+      char block[5] = {char(last), char(n), char(n >> 8), char(~n),
+                       char(~n >> 8)};
+      ok = crash::write_all(fd, block, 5) && crash::write_all(fd, p, n);
+      size += 5 + n;
+      p += n;
+      left -= n;
+      if (last)
+        break;
+    }
+  }
+  std::uint32_t total = before + an + bn;
+  char trailer[8];
+  for (int i = 0; i < 4; ++i) {
+    trailer[i] = char(crc >> (8 * i));
+    trailer[4 + i] = char(total >> (8 * i));
+  }
+  ok = ok && crash::write_all(fd, trailer, sizeof(trailer));
+  return ok ? size + sizeof(trailer) : 0;
+}
+
+/**
+ * @return The index of a log; empty if it has none, in which case the log can
+ * still be read as one frame. A trailing partial entry is ignored.
+ */
+inline std::vector<Frame> read_index(const std::string &path) {
+  std::vector<Frame> index;
+  std::ifstream f(index_path(path), std::ios::binary);
+  for (Frame e; f.read(reinterpret_cast<char *>(&e), sizeof(e));)
+    index.push_back(e);
+  return index;
+}
+
+/**
+ * @brief Decompresses a frame read from a log, or any sequence of gzip
+ * members.
+ *
+ * @param in The compressed bytes.
+ * @param out The string to append the records to.
+ *
+ * @return If the bytes could be decompressed to the end.
+ */
+inline bool inflate_frame(const std::string &in, std::string &out) {
+  z_stream z{};
+  // 15 + 32: any window, zlib or gzip header
+  if (inflateInit2(&z, 15 + 32) != Z_OK)
+    return false;
+  z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+  z.avail_in = in.size();
+  int r = Z_OK;
+  char chunk[1 << 16];
+  while (r == Z_OK || (r == Z_STREAM_END && z.avail_in > 0)) {
+    if (r == Z_STREAM_END)
+      r = inflateReset(&z);
+    z.next_out = reinterpret_cast<Bytef *>(chunk);
+    z.avail_out = sizeof(chunk);
+    r = inflate(&z, Z_NO_FLUSH);
+    out.append(chunk, sizeof(chunk) - z.avail_out);
+    if (r == Z_BUF_ERROR && z.avail_in == 0)
+      break;
+  }
+  inflateEnd(&z);
+  return r == Z_STREAM_END;
+}
+}
+
+/**
+ * @brief A streambuf that compresses what is written to it into frames, and
+ * writes them to a file descriptor. Characters are collected in a buffer and
+ * compressed into the open frame when it fills up or on sync, flushed to a
+ * block boundary so that everything written so far can be read back; the
+ * frame itself is only closed, and indexed, by close_frame().
+ */
+class FrameStreambuf : public std::streambuf {
+  int fd, index;
+  std::size_t capacity;
+  z_stream z{};
+  bool deflating;
+  std::vector<char> buffer;
+  std::vector<char> compressed;
+  // where the open frame starts in the log, and how much of it is written
+  std::uint64_t offset;
+  std::uint64_t written = 0;
+  // the time the earliest record of the frame was logged, if any
+  std::int64_t first = INT64_MAX;
+  std::chrono::steady_clock::time_point drained;
+
+  /**
+   * @brief Compresses what the buffer holds into the open frame, writes it out
+   * and empties the buffer.
+   *
+   * @param flush Z_SYNC_FLUSH, to end at a block boundary, where the crash
+   * handler can carry on with stored blocks, or Z_FINISH, to end the frame.
+   */
+  bool deflate_buffer(int flush) {
+    bool ok = is_open() && deflating;
+    if (ok) {
+      compressed.resize(1 << 16);
+      z.next_in = reinterpret_cast<Bytef *>(pbase());
+      z.avail_in = pptr() - pbase();
+      do {
+        z.next_out = reinterpret_cast<Bytef *>(compressed.data());
+        z.avail_out = compressed.size();
+        ok = deflate(&z, flush) != Z_STREAM_ERROR;
+        std::size_t n = compressed.size() - z.avail_out;
+        ok = ok && frames::write_all(fd, compressed.data(), n);
+        written += n;
+      } while (ok && z.avail_out == 0);
+    }
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return ok;
+  }
+
+  /**
+   * @brief Makes room for at least n more characters: compresses what the
+   * buffer holds, and grows it if that isn't enough.
+   */
+  bool reserve(std::size_t n) {
+    if (buffer.empty()) {
+      buffer.resize(std::max(capacity, n));
+      setp(buffer.data(), buffer.data() + buffer.size());
+    }
+    if (std::size_t(epptr() - pptr()) >= n)
+      return true;
+    if (pptr() != pbase() && !deflate_buffer(Z_SYNC_FLUSH))
+      return false;
+    if (buffer.size() < n) {
+      buffer.resize(n);
+      setp(buffer.data(), buffer.data() + buffer.size());
+    }
+    return true;
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+      return sync() == 0 ? traits_type::not_eof(c) : traits_type::eof();
+    if (!reserve(1))
+      return traits_type::eof();
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    if (!reserve(n))
+      return 0;
+    std::memcpy(pptr(), s, n);
+    pbump(int(n));
+    return n;
+  }
+
+  /**
+   * @brief Writes out what the buffer holds, leaving the frame open.
+   */
+  int sync() override {
+    return pptr() == pbase() || deflate_buffer(Z_SYNC_FLUSH) ? 0 : -1;
+  }
+
+public:
+  /**
+   * @param fd The descriptor of the log, opened for appending.
+   * @param index The descriptor of its index, opened for appending.
+   * @param level The zlib compression level, from 1 to 9.
+   * @param capacity The size of the buffer.
+   */
+  FrameStreambuf(int fd, int index, int level, std::size_t capacity)
+      : fd(fd), index(index), capacity(capacity), offset(0),
+        drained(std::chrono::steady_clock::now()) {
+    // 15 + 16: the default window, with a gzip header
+    deflating = deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8,
+                             Z_DEFAULT_STRATEGY) == Z_OK;
+    struct stat st;
+    if (fd >= 0 && ::fstat(fd, &st) == 0)
+      offset = st.st_size;
+  }
+
+  FrameStreambuf(const FrameStreambuf &) = delete;
+  FrameStreambuf &operator=(const FrameStreambuf &) = delete;
+
+  ~FrameStreambuf() {
+    close_frame();
+    if (deflating)
+      deflateEnd(&z);
+    if (fd >= 0)
+      ::close(fd);
+    if (index >= 0)
+      ::close(index);
+  }
+
+  /**
+   * @brief Ends the open frame, if it holds anything, and writes its index
+   * entry; the next characters start a new one.
+   */
+  bool close_frame() {
+    if (z.total_in == 0 && pptr() == pbase())
+      return true;
+    bool ok = deflate_buffer(Z_FINISH);
+    std::int64_t now = frames::nanoseconds(clock_now());
+    frames::Frame e{offset, written, std::min(first, now), now};
+    // the frame before its entry, so that the index never points past the end
+    // of the log
+    ok = ok && frames::write_all(index, reinterpret_cast<const char *>(&e),
+                                 sizeof(e));
+    offset += written;
+    written = 0;
+    if (deflating)
+      deflateReset(&z);
+    first = INT64_MAX;
+    drained = std::chrono::steady_clock::now();
+    return ok;
+  }
+
+  /**
+   * @brief Marks the end of a record.
+   *
+   * @param logged When the record was logged, in nanoseconds since the epoch;
+   * the earliest record of a frame gives it its first time.
+   */
+  void end_record(std::int64_t logged) { first = std::min(first, logged); }
+
+  /**
+   * @return The number of characters in the open frame.
+   */
+  std::uint64_t frame_size() const {
+    return z.total_in + std::uint64_t(pptr() - pbase());
+  }
+
+  bool is_open() const { return fd >= 0 && index >= 0; }
+
+  /**
+   * @brief Ends the open frame with what the buffer holds, and some text after
+   * it, in stored blocks written with bare system calls, for the crash
+   * handler.
+   */
+  void write_stored(const char *text, std::size_t n) {
+    if (!is_open())
+      return;
+    std::int64_t now = frames::nanoseconds(crash::now());
+    std::size_t used = pptr() - pbase();
+    // the frame so far ends at a block boundary, see deflate_buffer; in gzip
+    // mode, zlib keeps the CRC-32 of its input in adler
+    uLong crc = written > 0 ? z.adler : crc32(0L, Z_NULL, 0);
+    std::uint64_t size =
+        frames::write_stored(fd, written, crc, written > 0 ? z.total_in : 0,
+                             pbase(), used, text, n);
+    frames::Frame e{offset, size, std::min(first, now), now};
+    if (size > 0)
+      crash::write_all(index, reinterpret_cast<const char *>(&e), sizeof(e));
+    offset += size;
+    written = 0;
+    setp(pbase(), epptr());
+  }
+
+  std::chrono::steady_clock::time_point last_drain() const { return drained; }
+};
+
+/**
+ * @brief A file sink that writes records in independently compressed frames
+ * and keeps an index of them, for files several times smaller than text logs
+ * that can still be read quickly, and by time range, see
+ * analyser::Parser::read_file.
+ *
+ * @detailed Records are compressed into a frame, a gzip member, until it
+ * holds as many characters as the flush policy's buffer size, or it has been
+ * open for the policy's interval; the frame is then closed and its offset,
+ * size and times appended to the index. Records as severe as the policy's, and
+ * an explicit flush(), write out what is buffered without closing the frame,
+ * so frames keep their size however often the sink is flushed; a frame still
+ * open is read as far as it was written.
+ *
+ * @remark The records are compressed by the thread that writes them out; put
+ * an AsyncLogger in front of the sink to keep that off the threads that log.
+ * Frames are indexed by when their records were logged, which the loggers
+ * pass to end_record, so that records queued by an AsyncLogger are found in
+ * the range they were logged in.
+ *
+ * @usage CompressedSink sink("app.log.gz"); FullLogger<CompressedSink>
+ * logger(sink);
+ */
+class CompressedSink : public std::ostream {
+  FrameStreambuf buf;
+  FlushPolicy policy;
+
+  // the marker goes in the last frame, so that the log remains gzip
+  static int crash_drain(void *self, const char *marker, std::size_t n) {
+    static_cast<CompressedSink *>(self)->buf.write_stored(marker, n);
+    return -1;
+  }
+
+  crash::Watch watch{this, crash_drain, crash::BUFFERS};
+
+  static constexpr int open_flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+
+public:
+  /**
+   * @brief Constructs a sink appending to a log and its index, created if
+   * needed.
+   *
+   * @param level The zlib compression level, from 1 (fastest) to 9 (smallest).
+   */
+  explicit CompressedSink(
+      const std::string &path,
+      FlushPolicy p = FlushPolicy{1 << 20, std::chrono::seconds(1), CRITICAL},
+      int level = Z_DEFAULT_COMPRESSION)
+      : std::ostream(nullptr),
+        buf(::open(path.c_str(), open_flags, 0644),
+            ::open(frames::index_path(path).c_str(), open_flags, 0644), level,
+            p.buffer_size),
+        policy(p) {
+    rdbuf(&buf);
+    if (!buf.is_open())
+      setstate(std::ios_base::badbit);
+  }
+
+  CompressedSink(const CompressedSink &) = delete;
+  CompressedSink &operator=(const CompressedSink &) = delete;
+
+  ~CompressedSink() { flush(); }
+
+  /**
+   * @brief Called by the loggers after each record: closes the frame once it
+   * is full or old enough, and writes out severe records.
+   *
+   * @param level The severity of the record.
+   * @param logged When the record was logged.
+   */
+  void end_record(int level, std::chrono::system_clock::time_point logged) {
+    buf.end_record(frames::nanoseconds(logged));
+    if (buf.frame_size() >= policy.buffer_size ||
+        (policy.interval != std::chrono::milliseconds::max() &&
+         std::chrono::steady_clock::now() - buf.last_drain() >=
+             policy.interval)) {
+      if (!buf.close_frame())
+        setstate(std::ios_base::badbit);
+    } else if (level >= policy.severity) {
+      flush();
+    }
+  }
+
+  /**
+   * @brief Called after a record whose time isn't known, such as a binary one:
+   * it is taken to be logged now.
+   */
+  void end_record(int level) { end_record(level, clock_now()); }
+};
+}
+
+#endif /*__COMPRESSED_H__*/
@@ -0,0 +1,340 @@
+/**
+ * Changing the runtime thresholds of a running process: from a config file,
+ * re-read when it changes or on a signal, and from a shared memory block that
+ * bin/clayerctl edits for every process on the host.
+ */
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "levels.h"
+#include "logconfig.h"
+
+namespace logger {
+
+/**
+ * @brief Reads a severity: one of the Severity names, a number, or "unset"
+ * (file thresholds only).
+ *
+ * @return Whether the text was a severity.
+ */
+inline bool parse_level(const std::string &s, int &level) {
+  static const std::pair<const char *, int> names[] = {
+      {"NOTSET", NOTSET}, {"DEBUG", DEBUG},       {"INFO", INFO},
+      {"WARNING", WARNING}, {"ERROR", ERROR}, {"CRITICAL", CRITICAL},
+      {"unset", unset_level}};
+  for (auto &n : names) {
+    if (s == n.first) {
+      level = n.second;
+      return true;
+    }
+  }
+  char *end;
+  long l = std::strtol(s.c_str(), &end, 10);
+  if (s.empty() || *end != '\0')
+    return false;
+  level = int(l);
+  return true;
+}
+
+/**
+ * @brief Applies one threshold setting: "<logger name> <level>", where the
+ * name "*" stands for every logger, or "file:<file name suffix> <level>".
+ *
+ * @return Whether the setting was understood.
+ */
+inline bool apply_level(const std::string &target, const std::string &value) {
+  int level;
+  if (target.empty() || !parse_level(value, level))
+    return false;
+  if (target.compare(0, 5, "file:") == 0)
+    level_registry().set_file(target.substr(5), level);
+  else if (level != unset_level)
+    level_registry().set_logger(target, level);
+  else
+    return false;
+  return true;
+}
+
+/**
+ * @brief Applies a config of one setting per line (see apply_level), with
+ * blank lines and lines starting with # ignored.
+ *
+ * @usage
+ *   # the default logger
+ *   LOG WARNING
+ *   file:db/query.cpp DEBUG
+ *
+ * @return The number of settings that weren't understood.
+ */
+inline int apply_levels(std::istream &config) {
+  int errors = 0;
+  for (std::string line; std::getline(config, line);) {
+    std::istringstream fields(line);
+    std::string target, value;
+    if (!(fields >> target) || target[0] == '#')
+      continue;
+    fields >> value;
+    if (!apply_level(target, value))
+      ++errors;
+  }
+  return errors;
+}
+
+/**
+ * @brief The layout of the shared memory block: a list of settings guarded by
+ * a sequence number that is odd while a writer is editing them.
+ */
+struct ControlBlock {
+  static constexpr std::size_t max_entries = 64;
+
+  struct Entry {
+    char target[120];
+    std::int32_t level;
+  };
+
+  std::atomic<std::uint32_t> sequence;
+  std::uint32_t count;
+  Entry entries[max_entries];
+
+  static_assert(std::atomic<std::uint32_t>::is_always_lock_free,
+                "the sequence number is shared between processes");
+};
+
+/**
+ * @brief The default name of the shared memory block.
+ */
+constexpr const char control_block_name[] = "/clayer-levels";
+
+/**
+ * @brief Maps the shared memory block with the given name, creating it if
+ * needed.
+ *
+ * @param mode The permissions of a block created here; by default only its
+ * owner can change the thresholds of the processes that follow it.
+ * @return The block, or nullptr on failure.
+ */
+inline ControlBlock *map_control_block(const char *name, mode_t mode = 0600) {
+  int fd = ::shm_open(name, O_RDWR | O_CREAT, mode);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      (std::size_t(st.st_size) < sizeof(ControlBlock) &&
+       ::ftruncate(fd, sizeof(ControlBlock)) != 0)) {
+    ::close(fd);
+    return nullptr;
+  }
+  void *p = ::mmap(nullptr, sizeof(ControlBlock), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  ::close(fd);
+  return p == MAP_FAILED ? nullptr : static_cast<ControlBlock *>(p);
+}
+
+/**
+ * @brief Edits a mapped shared memory block while its sequence number is odd,
+ * so that readers retry rather than see a half-written list.
+ *
+ * @detailed Writers take turns with flock on the block, which the kernel
+ * releases if a writer dies; the sequence number it left odd then stays odd
+ * until the next edit is done.
+ *
+ * @param name The name the block was mapped with.
+ * @param f Edits the block.
+ * @return Whether the block could be locked, and so edited.
+ */
+template <typename F>
+bool edit_control_block(const char *name, ControlBlock &block, F f) {
+  int fd = ::shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return false;
+  int r;
+  while ((r = ::flock(fd, LOCK_EX)) != 0 && errno == EINTR)
+    ;
+  if (r != 0) {
+    ::close(fd);
+    return false;
+  }
+  std::uint32_t odd = block.sequence.load(std::memory_order_relaxed) | 1;
+  block.sequence.store(odd, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  f();
+  block.sequence.store(odd + 1, std::memory_order_release);
+  // closing the descriptor releases the lock
+  ::close(fd);
+  return true;
+}
+
+/**
+ * @brief Keeps the runtime thresholds in step with a config file and a shared
+ * memory block, from a background thread that checks them periodically.
+ *
+ * @detailed The config file is applied when its modification time changes,
+ * and whenever the process receives the signal given to reload_on(). The
+ * shared memory block is applied whenever its sequence number changes.
+ *
+ * @usage LevelWatcher w; w.watch_file("levels.conf").reload_on(SIGHUP);
+ */
+class LevelWatcher {
+  std::mutex lock;
+  std::condition_variable wake;
+  bool running;
+
+  std::string path;
+  struct timespec applied_mtime;
+
+  ControlBlock *block;
+  std::uint32_t applied_sequence;
+
+  std::chrono::milliseconds interval;
+  std::thread watcher;
+
+  static std::atomic<bool> &signalled() {
+    static std::atomic<bool> flag(false);
+    return flag;
+  }
+
+  static void on_signal(int) {
+    signalled().store(true, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Applies the config file if it changed or a signal asked for it.
+   */
+  void check_file() {
+    bool forced = signalled().exchange(false, std::memory_order_relaxed);
+    struct stat st;
+    if (path.empty() || ::stat(path.c_str(), &st) != 0)
+      return;
+    if (!forced && st.st_mtim.tv_sec == applied_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == applied_mtime.tv_nsec)
+      return;
+    applied_mtime = st.st_mtim;
+    std::ifstream config(path);
+    apply_levels(config);
+  }
+
+  /**
+   * @brief Applies the shared memory block if it changed, reading it again if
+   * a writer edited it meanwhile.
+   */
+  void check_block() {
+    if (block == nullptr)
+      return;
+    std::uint32_t seq = block->sequence.load(std::memory_order_acquire);
+    if (seq == applied_sequence || seq % 2 == 1)
+      return;
+    std::vector<ControlBlock::Entry> entries(
+        block->entries,
+        block->entries + std::min<std::size_t>(block->count,
+                                               ControlBlock::max_entries));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (block->sequence.load(std::memory_order_relaxed) != seq)
+      return;
+    applied_sequence = seq;
+    for (auto &e : entries) {
+      e.target[sizeof(e.target) - 1] = '\0';
+      std::string target = e.target;
+      // as in apply_level, only files can be unset: the gate of a logger
+      // would then admit every severity
+      if (target.compare(0, 5, "file:") == 0)
+        level_registry().set_file(target.substr(5), e.level);
+      else if (e.level != unset_level)
+        level_registry().set_logger(target, e.level);
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (running) {
+      check_file();
+      check_block();
+      wake.wait_for(guard, interval);
+    }
+  }
+
+public:
+  /**
+   * @param interval How often to look for changes.
+   */
+  explicit LevelWatcher(
+      std::chrono::milliseconds interval = std::chrono::seconds(1))
+      : running(true), applied_mtime{0, 0}, block(nullptr),
+        applied_sequence(0), interval(interval),
+        watcher(&LevelWatcher::run, this) {}
+
+  ~LevelWatcher() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      running = false;
+    }
+    wake.notify_one();
+    watcher.join();
+    if (block != nullptr)
+      ::munmap(block, sizeof(ControlBlock));
+  }
+
+  /**
+   * @brief Applies a config file now and whenever it changes.
+   */
+  LevelWatcher &watch_file(std::string config) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      path = std::move(config);
+      applied_mtime = {0, 0};
+    }
+    wake.notify_one();
+    return *this;
+  }
+
+  /**
+   * @brief Re-reads the config file whenever the process receives a signal.
+   */
+  LevelWatcher &reload_on(int signal) {
+    std::signal(signal, &LevelWatcher::on_signal);
+    return *this;
+  }
+
+  /**
+   * @brief Follows the shared memory block with the given name, which
+   * bin/clayerctl edits.
+   */
+  LevelWatcher &watch_shared(const char *name = control_block_name) {
+    ControlBlock *b = map_control_block(name);
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (block != nullptr)
+        ::munmap(block, sizeof(ControlBlock));
+      block = b;
+      applied_sequence = 0;
+    }
+    wake.notify_one();
+    return *this;
+  }
+
+  /**
+   * @brief Checks for changes now rather than at the next interval.
+   */
+  void poll() { wake.notify_one(); }
+};
+}
+
+#endif /*__CONTROL_H__*/
@@ -0,0 +1,382 @@
+/**
+ * Crash-safe flushing: an opt-in handler for fatal signals and std::terminate
+ * that writes out the records still buffered in sinks and queued in
+ * asynchronous loggers, adds a final CRITICAL marker, and lets the process die
+ * as it would have.
+ */
+#ifndef __CRASH_H__
+#define __CRASH_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <iostream>
+
+#include <unistd.h>
+
+#include "line.h"
+
+namespace logger {
+
+/**
+ * @brief The crash handler and the registry of what it drains.
+ *
+ * @detailed Sinks and asynchronous loggers register a drain function for
+ * their lifetime with a Watch. When a fatal signal arrives, or std::terminate
+ * is called, after install(), the handler stops the writer threads of the
+ * asynchronous loggers, calls the drain functions of the sinks, then those of
+ * the loggers, so that records come out in order, and writes a CRITICAL marker
+ * to every descriptor drained. The drain functions only use async-signal-safe
+ * calls, mostly write.
+ *
+ * @remark This is a last resort: a thread that was in the middle of a record
+ * when the process crashed may leave it incomplete, and records queued in a
+ * MergingLogger come out thread by thread rather than merged.
+ */
+namespace crash {
+
+/**
+ * @brief The order in which drain functions are called: the sinks' buffers
+ * hold older records than the loggers' queues.
+ */
+enum Stage { BUFFERS, QUEUES };
+
+/**
+ * @brief A drain function: writes out what an object holds, followed by the
+ * marker if it can't be written to a plain descriptor.
+ *
+ * @return The descriptor to write the marker to, or -1 if it was taken care
+ * of.
+ */
+using Drain = int (*)(void *object, const char *marker, std::size_t n);
+
+constexpr std::size_t max_watched = 64;
+
+struct Slot {
+  std::atomic<void *> object{nullptr};
+  std::atomic<Drain> drain{nullptr};
+  Stage stage = BUFFERS;
+};
+
+inline Slot *slots() {
+  static Slot s[max_watched];
+  return s;
+}
+
+/**
+ * @brief Set by the handler to stop the writer threads of the asynchronous
+ * loggers, which then park, see park_if_halted.
+ */
+inline std::atomic<bool> &halted() {
+  static std::atomic<bool> h(false);
+  return h;
+}
+
+/**
+ * @brief Called by writer threads between records: never returns once the
+ * handler runs, so that it can drain their queues alone.
+ */
+inline void park_if_halted() {
+  while (halted().load(std::memory_order_relaxed))
+    ::pause();
+}
+
+/**
+ * @brief Registers a drain function for the lifetime of the Watch, unless the
+ * object is null, e.g. for a sink that isn't open. An object is simply not
+ * drained if all the slots are taken.
+ *
+ * @remark Declare the Watch after the members it drains, so that it is
+ * destroyed before them.
+ */
+class Watch {
+  Slot *slot = nullptr;
+
+public:
+  Watch(void *object, Drain drain, Stage stage) {
+    for (std::size_t i = 0; object != nullptr && i < max_watched; ++i) {
+      Slot &s = slots()[i];
+      void *empty = nullptr;
+      if (s.object.load(std::memory_order_relaxed) == nullptr &&
+          s.object.compare_exchange_strong(empty, object)) {
+        s.stage = stage;
+        s.drain.store(drain, std::memory_order_release);
+        slot = &s;
+        return;
+      }
+    }
+  }
+
+  Watch(const Watch &) = delete;
+  Watch &operator=(const Watch &) = delete;
+
+  ~Watch() {
+    if (slot == nullptr)
+      return;
+    slot->drain.store(nullptr, std::memory_order_release);
+    slot->object.store(nullptr, std::memory_order_release);
+  }
+};
+
+/**
+ * @brief Writes a whole buffer to a descriptor with bare write calls.
+ */
+inline bool write_all(int fd, const char *data, std::size_t n) {
+  while (n > 0) {
+    ssize_t w = ::write(fd, data, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return false;
+    data += w;
+    n -= w;
+  }
+  return true;
+}
+
+/**
+ * @brief Appends text to a buffer, as far as it fits.
+ *
+ * @return The new length.
+ */
+inline std::size_t append(char *out, std::size_t at, std::size_t size,
+                          const char *s, std::size_t n) {
+  n = std::min(n, size - at);
+  std::memcpy(out + at, s, n);
+  return at + n;
+}
+
+inline std::size_t append(char *out, std::size_t at, std::size_t size,
+                          const char *s) {
+  return append(out, at, size, s, std::strlen(s));
+}
+
+/**
+ * @brief Appends a number in decimal, padded with zeros to a width.
+ */
+inline std::size_t append(char *out, std::size_t at, std::size_t size,
+                          std::uint64_t v, int width = 1) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = char('0' + v % 10);
+    v /= 10;
+  } while (v > 0 || n < width);
+  while (n > 0 && at < size)
+    out[at++] = digits[--n];
+  return at;
+}
+
+inline const char *level_name(int level) {
+  switch (level) {
+    case 0: return "NOTSET";
+    case 10: return "DEBUG";
+    case 20: return "INFO";
+    case 30: return "WARNING";
+    case 40: return "ERROR";
+    case 50: return "CRITICAL";
+    default: return "LEVEL";
+  }
+}
+
+/**
+ * @brief Renders the head of a record without any of the Props, which aren't
+ * safe in a signal handler: the time as seconds since the epoch, the level
+ * and the place, `1500000000.123456 ERROR [file(func:line)]: `.
+ *
+ * @return The length of the head.
+ */
+inline std::size_t render_head(char *out, std::size_t size,
+                               std::chrono::system_clock::time_point t,
+                               int level, const char *file, const char *fn,
+                               int line) {
+  std::int64_t seconds, ns;
+  split_time(t, seconds, ns);
+  std::size_t n = append(out, 0, size, std::uint64_t(seconds));
+  n = append(out, n, size, ".");
+  n = append(out, n, size, std::uint64_t(ns / 1000), 6);
+  n = append(out, n, size, " ");
+  n = append(out, n, size, level_name(level));
+  n = append(out, n, size, " [");
+  n = append(out, n, size, file != nullptr ? file : "?");
+  n = append(out, n, size, "(");
+  n = append(out, n, size, fn != nullptr ? fn : "?");
+  n = append(out, n, size, ":");
+  n = append(out, n, size, std::uint64_t(line < 0 ? 0 : line));
+  return append(out, n, size, ")]: ");
+}
+
+/**
+ * @brief Writes a Line as render_head and its message, without its fields.
+ */
+inline void write_line(int fd, const Line &line) {
+  char head[512];
+  std::size_t n = render_head(head, sizeof(head), line.time, line.info.level,
+                              line.info.file, line.info.fn, line.info.line);
+  write_all(fd, head, n);
+  write_all(fd, line.message.data(), line.message.size());
+  write_all(fd, "\n", 1);
+}
+
+/**
+ * @brief Something is Described if it tells which descriptor it writes to.
+ */
+template <typename T> concept bool Described = requires(T o) {
+  { o.descriptor() } -> int;
+};
+
+/**
+ * @return The descriptor a stream writes to: its own if it has one, or that
+ * of the standard stream it is, or else stderr.
+ */
+template <typename Stream> int descriptor(Stream &s) {
+  if constexpr (Described<Stream>)
+    return s.descriptor();
+  else if (static_cast<void *>(&s) == static_cast<void *>(&std::cout))
+    return STDOUT_FILENO;
+  else
+    return STDERR_FILENO;
+}
+
+/**
+ * @return The current time, read with clock_gettime, which is safe in a
+ * signal handler.
+ */
+inline std::chrono::system_clock::time_point now() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_REALTIME, &ts);
+  return std::chrono::system_clock::time_point(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::seconds(ts.tv_sec) +
+          std::chrono::nanoseconds(ts.tv_nsec)));
+}
+
+inline const char *signal_name(int sig) {
+  switch (sig) {
+    case SIGSEGV: return "SIGSEGV";
+    case SIGABRT: return "SIGABRT";
+    case SIGBUS: return "SIGBUS";
+    case SIGFPE: return "SIGFPE";
+    case SIGILL: return "SIGILL";
+    default: return "signal";
+  }
+}
+
+/**
+ * @brief Drains everything watched, once per process, and writes the marker,
+ * a CRITICAL record giving the reason, after what was drained to each
+ * descriptor, or to stderr if nothing was.
+ */
+inline void drain_all(const char *reason) {
+  static std::atomic<bool> done(false);
+  if (done.exchange(true))
+    return;
+
+  // give the writer threads time to finish the record they are writing
+  halted().store(true);
+  bool queues = false;
+  for (std::size_t i = 0; i < max_watched; ++i)
+    queues |= slots()[i].drain.load() != nullptr && slots()[i].stage == QUEUES;
+  if (queues) {
+    timespec wait{0, 20 * 1000 * 1000};
+    ::nanosleep(&wait, nullptr);
+  }
+
+  char marker[256];
+  std::size_t n = render_head(marker, sizeof(marker) - 1, now(), 50, __FILE__,
+                              "drain_all", __LINE__);
+  n = append(marker, n, sizeof(marker) - 1, "crashed: ");
+  n = append(marker, n, sizeof(marker) - 1, reason);
+  marker[n++] = '\n';
+
+  int fds[max_watched];
+  std::size_t count = 0;
+  bool drained = false;
+  for (Stage stage : {BUFFERS, QUEUES}) {
+    for (std::size_t i = 0; i < max_watched; ++i) {
+      Slot &s = slots()[i];
+      void *object = s.object.load(std::memory_order_acquire);
+      Drain drain = s.drain.load(std::memory_order_acquire);
+      if (object == nullptr || drain == nullptr || s.stage != stage)
+        continue;
+      int fd = drain(object, marker, n);
+      drained = true;
+      bool seen = fd < 0;
+      for (std::size_t k = 0; k < count && !seen; ++k)
+        seen = fds[k] == fd;
+      if (!seen)
+        fds[count++] = fd;
+    }
+  }
+  if (!drained)
+    fds[count++] = STDERR_FILENO;
+  for (std::size_t k = 0; k < count; ++k)
+    write_all(fds[k], marker, n);
+}
+
+/**
+ * @brief The fatal signals handled by install().
+ */
+constexpr int signals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE};
+
+/**
+ * @brief The signal handler: drains, then raises the signal again with its
+ * default action, which the handler restored on entry.
+ */
+inline void on_signal(int sig) {
+  drain_all(signal_name(sig));
+  ::raise(sig);
+}
+
+inline std::terminate_handler &previous_terminate() {
+  static std::terminate_handler previous = nullptr;
+  return previous;
+}
+
+/**
+ * @brief The terminate handler: drains, then lets the previous handler, or
+ * std::abort, end the process.
+ */
+inline void on_terminate() {
+  drain_all("std::terminate");
+  if (std::terminate_handler previous = previous_terminate())
+    previous();
+  std::abort();
+}
+
+/**
+ * @brief Installs the handler for SIGSEGV, SIGABRT, SIGBUS, SIGFPE and
+ * std::terminate, replacing any handlers already installed for them. The
+ * calling thread also gets an alternate signal stack, so that the handler can
+ * run when it overflows its stack; call it from the thread most likely to.
+ *
+ * @usage int main() { logger::crash::install(); ... }
+ */
+inline void install() {
+  static char stack[1 << 16];
+  stack_t ss{};
+  ss.ss_sp = stack;
+  ss.ss_size = sizeof(stack);
+  ::sigaltstack(&ss, nullptr);
+
+  struct sigaction action {};
+  action.sa_handler = on_signal;
+  action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  for (int sig : signals)
+    ::sigaction(sig, &action, nullptr);
+
+  std::terminate_handler previous = std::set_terminate(on_terminate);
+  if (previous != on_terminate)
+    previous_terminate() = previous;
+}
+}
+}
+
+#endif /*__CRASH_H__*/
@@ -0,0 +1,312 @@
+/**
+ * Collapsing of repeated messages, as syslog does: copies of a message that
+ * follow it within a window are dropped before they are formatted, and
+ * replaced by a single "last message repeated N times" line.
+ */
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "line.h"
+#include "threads.h"
+
+namespace logger {
+
+/**
+ * @brief A small table of the messages written recently, by call site, hash
+ * and text, and how many copies of each have been dropped since.
+ *
+ * @detailed Each message maps to one slot. A message that finds its own copy
+ * in its slot, written less than the window ago, is dropped and counted.
+ * Otherwise it takes the slot, and the count of the message it replaces, if
+ * any, is reported first. Counts are also reported once the window of their
+ * message has passed, on the next call, and by drain(). With a single slot,
+ * only consecutive copies are collapsed.
+ *
+ * @remark Not thread-safe; loggers call it under a lock or from their writer
+ * thread.
+ */
+class Dedup {
+  struct Slot {
+    std::uint64_t key = 0;
+    std::uint64_t repeats = 0;
+    // When the message was last written.
+    std::chrono::system_clock::time_point since;
+    // The context of the last copy dropped, for the report.
+    ContextInfo info;
+    std::uint64_t hash;
+    std::thread::id thread;
+    std::uint32_t ordinal;
+    std::chrono::system_clock::time_point time;
+  };
+
+  std::vector<Slot> slots;
+  std::chrono::system_clock::duration window;
+
+  // The earliest moment a count may be due, to skip scanning until then.
+  std::chrono::system_clock::time_point next_due;
+
+  /**
+   * @return The key of a message: its site, its hash, its text and its
+   * fields.
+   */
+  static std::uint64_t key(const Line &line) {
+    std::uint64_t h = line.info.site ^ (line.hash * 1099511628211ull);
+    for (char c : line.message.view())
+      h = (h ^ std::uint8_t(c)) * 1099511628211ull;
+    for (char c : line.fields.view())
+      h = (h ^ std::uint8_t(c)) * 1099511628211ull;
+    return h == 0 ? 1 : h;
+  }
+
+  /**
+   * @brief Reports and resets the count of a slot.
+   */
+  template <typename Write> static void report(Slot &s, Write &write) {
+    if (s.repeats == 0)
+      return;
+    Line notice(s.info);
+    notice.hash = s.hash;
+    notice.thread = s.thread;
+    notice.ordinal = s.ordinal;
+    notice.time = s.time;
+    notice.message.append("last message repeated ");
+    notice.message.append(std::to_string(s.repeats));
+    notice.message.append(" times");
+    s.repeats = 0;
+    write(notice);
+  }
+
+  /**
+   * @brief Reports the counts whose window has passed.
+   */
+  template <typename Write>
+  void expire(std::chrono::system_clock::time_point now, Write &write) {
+    next_due = std::chrono::system_clock::time_point::max();
+    for (Slot &s : slots) {
+      if (s.repeats == 0)
+        continue;
+      if (now - s.since >= window)
+        report(s, write);
+      else if (s.since + window < next_due)
+        next_due = s.since + window;
+    }
+  }
+
+public:
+  /**
+   * @param window How long after a message its copies are dropped.
+   * @param size The number of slots.
+   */
+  explicit Dedup(std::chrono::system_clock::duration window,
+                 std::size_t size = 16)
+      : slots(size == 0 ? 1 : size), window(window),
+        next_due(std::chrono::system_clock::time_point::max()) {}
+
+  /**
+   * @brief Decides whether a line is written, reporting counts as needed.
+   *
+   * @param line The line, which must have its message complete.
+   * @param write Called with any "last message repeated" lines due, which
+   * are written before the line.
+   * @return false if the line is a copy to drop.
+   */
+  template <typename Write> bool admit(const Line &line, Write &&write) {
+    if (line.time >= next_due)
+      expire(line.time, write);
+    std::uint64_t k = key(line);
+    Slot &s = slots[k % slots.size()];
+    if (s.key == k && line.time - s.since < window) {
+      if (s.repeats++ == 0 && s.since + window < next_due)
+        next_due = s.since + window;
+      s.info = line.info;
+      s.hash = line.hash;
+      s.thread = line.thread;
+      s.ordinal = line.ordinal;
+      s.time = line.time;
+      return false;
+    }
+    report(s, write);
+    s.key = k;
+    s.since = line.time;
+    return true;
+  }
+
+  /**
+   * @brief Reports all pending counts.
+   */
+  template <typename Write> void drain(Write &&write) {
+    for (Slot &s : slots)
+      report(s, write);
+    next_due = std::chrono::system_clock::time_point::max();
+  }
+
+  /**
+   * @brief Reports the counts whose window has passed by now; for loggers
+   * that have a moment to spare.
+   */
+  template <typename Write> void expire(Write &&write) {
+    if (std::chrono::system_clock::now() >= next_due)
+      expire(std::chrono::system_clock::now(), write);
+  }
+};
+
+/**
+ * @brief A Dedup of one thread for one logger, and the lock that lets the
+ * logger drain it from another thread.
+ */
+struct LocalDedup {
+  std::mutex lock;
+  Dedup table;
+
+  // Set by the logger when it's destroyed: the thread can drop the table.
+  std::atomic<bool> retired;
+
+  LocalDedup(std::chrono::system_clock::duration window, std::size_t size)
+      : table(window, size), retired(false) {}
+};
+
+/**
+ * @brief The tables of the current thread, keyed by logger id.
+ */
+inline std::vector<std::pair<std::size_t, std::shared_ptr<LocalDedup>>> &
+local_dedups() {
+  static thread_local std::vector<
+      std::pair<std::size_t, std::shared_ptr<LocalDedup>>>
+      local;
+  return local;
+}
+
+/**
+ * @brief Collapsing for a logger that writes on its logging threads: every
+ * thread collapses the copies it logs in a Dedup of its own, created on its
+ * first record, so that threads never wait on each other for it. A table's
+ * lock is only ever contended by drain(), which reports the counts of every
+ * thread, including those that have exited.
+ *
+ * @remark Copies logged by different threads are not collapsed together.
+ */
+class ThreadDedups {
+  const std::size_t id;
+  const std::chrono::system_clock::duration window;
+  const std::size_t size;
+
+  std::mutex registry_lock;
+  std::vector<std::shared_ptr<LocalDedup>> registry;
+
+  LocalDedup &add_local() {
+    auto &local = local_dedups();
+    for (auto it = local.begin(); it != local.end();)
+      it = it->second->retired.load(std::memory_order_acquire)
+               ? local.erase(it)
+               : it + 1;
+    auto d = std::make_shared<LocalDedup>(window, size);
+    {
+      std::lock_guard<std::mutex> lock(registry_lock);
+      registry.push_back(d);
+    }
+    local.emplace_back(id, d);
+    return *d;
+  }
+
+  /**
+   * @return The current thread's table, registering it on first use.
+   */
+  LocalDedup &local() {
+    for (auto &d : local_dedups())
+      if (d.first == id)
+        return *d.second;
+    return add_local();
+  }
+
+public:
+  ThreadDedups(std::chrono::system_clock::duration window,
+               std::size_t size = 16)
+      : id(next_logger_id()), window(window), size(size) {}
+
+  ~ThreadDedups() {
+    for (auto &d : registry)
+      d->retired.store(true, std::memory_order_release);
+  }
+
+  /**
+   * @brief Decides whether a line is written, as Dedup::admit does, in the
+   * current thread's table.
+   */
+  template <typename Write> bool admit(const Line &line, Write &&write) {
+    LocalDedup &d = local();
+    std::lock_guard<std::mutex> lock(d.lock);
+    return d.table.admit(line, write);
+  }
+
+  /**
+   * @brief Reports the pending counts of every thread, and forgets the tables
+   * of the threads that have exited.
+   */
+  template <typename Write> void drain(Write &&write) {
+    std::vector<std::shared_ptr<LocalDedup>> tables;
+    {
+      std::lock_guard<std::mutex> lock(registry_lock);
+      tables = registry;
+      // a table only the registry holds belongs to an exited thread
+      registry.erase(std::remove_if(registry.begin(), registry.end(),
+                                    [](const std::shared_ptr<LocalDedup> &d) {
+                                      return d.use_count() == 2;
+                                    }),
+                     registry.end());
+    }
+    for (auto &d : tables) {
+      std::lock_guard<std::mutex> lock(d->lock);
+      d->table.drain(write);
+    }
+  }
+};
+
+/**
+ * @brief The optional Dedup, or ThreadDedups, of a logger, which can be
+ * switched on once while the logger is in use.
+ */
+template <typename Table = Dedup> class DedupStage {
+  std::unique_ptr<Table> owned;
+  std::atomic<Table *> active;
+
+public:
+  DedupStage() : active(nullptr) {}
+
+  /**
+   * @brief Switches collapsing on, unless it already is; safe to call from
+   * several threads at once.
+   *
+   * @return Whether this call switched it on.
+   */
+  bool enable(std::chrono::system_clock::duration window,
+              std::size_t size = 16) {
+    if (active.load(std::memory_order_acquire) != nullptr)
+      return false;
+    // only the call that publishes its table keeps it: another one may be in
+    // use already
+    std::unique_ptr<Table> made(new Table(window, size));
+    Table *none = nullptr;
+    if (!active.compare_exchange_strong(none, made.get(),
+                                        std::memory_order_acq_rel))
+      return false;
+    owned = std::move(made);
+    return true;
+  }
+
+  /**
+   * @return The table, or nullptr while collapsing is off.
+   */
+  Table *get() const { return active.load(std::memory_order_acquire); }
+};
+}
+
+#endif /*__DEDUP_H__*/
@@ -0,0 +1,349 @@
+/**
+ * Structured logging: typed key-value fields kept alongside the message text
+ * of a record, and the encoders that render them.
+ */
+#ifndef __FIELDS_H__
+#define __FIELDS_H__
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include "buffer.h"
+
+namespace logger {
+
+/**
+ * @brief A key and a value streamed to a record, to be kept as a typed field
+ * instead of as part of the message text. Made by kv().
+ *
+ * @remark Holds a reference to the value, which only has to live until the end
+ * of the log statement.
+ */
+template <typename T> struct KeyValue {
+  std::string_view key;
+  const T &value;
+};
+
+/**
+ * @brief Makes a field to stream to a record.
+ *
+ * @usage LOG(INFO) << "served" << kv("user", id) << kv("latency_us", t);
+ */
+template <typename T> KeyValue<T> kv(std::string_view key, const T &value) {
+  return {key, value};
+}
+
+/**
+ * @brief Prints a field as key=value, for streams other than records.
+ */
+template <typename T>
+std::ostream &operator<<(std::ostream &o, const KeyValue<T> &f) {
+  return o << f.key << '=' << f.value;
+}
+
+/**
+ * @brief One decoded field of a record; only the member matching the type is
+ * meaningful.
+ */
+struct Field {
+  enum Type : char {
+    BOOL = 'b',
+    INT = 'i',
+    UINT = 'u',
+    DOUBLE = 'd',
+    STR = 's'
+  };
+
+  std::string_view key;
+  Type type;
+  bool b;
+  std::int64_t i;
+  std::uint64_t u;
+  double d;
+  std::string_view s;
+};
+
+/**
+ * @brief The fields of a record, encoded back to back in a small inline
+ * buffer: a type tag, the key as u8 length and bytes, then the value's raw
+ * bytes, strings as u32 length and bytes.
+ */
+class Fields {
+  InlineBuffer<64> data;
+
+  template <typename T> void put(const T &v) {
+    data.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+
+  template <typename T> static T get(const char *&p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return v;
+  }
+
+  void put_key(Field::Type type, std::string_view key) {
+    key = key.substr(0, 255);
+    data.push_back(type);
+    data.push_back(char(std::uint8_t(key.size())));
+    data.append(key);
+  }
+
+public:
+  /**
+   * @brief Adds a field. Booleans, characters, numbers and strings keep their
+   * type; anything else must be formatted first and added as a string.
+   */
+  template <typename T> void add(std::string_view key, const T &v) {
+    if constexpr (std::is_same<T, bool>::value) {
+      put_key(Field::BOOL, key);
+      put(v);
+    } else if constexpr (std::is_same<T, char>::value ||
+                         std::is_same<T, signed char>::value ||
+                         std::is_same<T, unsigned char>::value) {
+      char c = char(v);
+      add(key, std::string_view(&c, 1));
+    } else if constexpr (std::is_integral<T>::value &&
+                         std::is_signed<T>::value) {
+      put_key(Field::INT, key);
+      put(std::int64_t(v));
+    } else if constexpr (std::is_integral<T>::value) {
+      put_key(Field::UINT, key);
+      put(std::uint64_t(v));
+    } else if constexpr (std::is_floating_point<T>::value) {
+      put_key(Field::DOUBLE, key);
+      put(double(v));
+    } else if constexpr (std::is_same<T, const char *>::value ||
+                         std::is_same<T, char *>::value) {
+      add(key, v ? std::string_view(v) : std::string_view());
+    } else {
+      std::string_view s(v);
+      put_key(Field::STR, key);
+      put(std::uint32_t(s.size()));
+      data.append(s);
+    }
+  }
+
+  /**
+   * @brief Whether a value of the type can be added as it is, see add.
+   */
+  template <typename T>
+  static constexpr bool storable =
+      std::is_arithmetic<T>::value ||
+      std::is_convertible<const T &, std::string_view>::value ||
+      std::is_same<T, char *>::value;
+
+  /**
+   * @brief Calls a function with each field, in the order they were added.
+   */
+  template <typename F> void for_each(F &&f) const {
+    const char *p = data.data(), *end = p + data.size();
+    while (p < end) {
+      Field x{};
+      x.type = Field::Type(*p++);
+      std::size_t n = std::uint8_t(*p++);
+      x.key = {p, n};
+      p += n;
+      switch (x.type) {
+        case Field::BOOL: x.b = get<bool>(p); break;
+        case Field::INT: x.i = get<std::int64_t>(p); break;
+        case Field::UINT: x.u = get<std::uint64_t>(p); break;
+        case Field::DOUBLE: x.d = get<double>(p); break;
+        case Field::STR:
+          n = get<std::uint32_t>(p);
+          x.s = {p, n};
+          p += n;
+          break;
+      }
+      f(x);
+    }
+  }
+
+  bool empty() const { return data.empty(); }
+  void clear() { data.clear(); }
+
+  /**
+   * @return The encoded fields, e.g. to compare the fields of two records.
+   */
+  std::string_view view() const { return data.view(); }
+};
+
+/**
+ * @brief Encoders that render fields straight to a stream: each writes the
+ * separator and key in front of a field (key) and quotes strings (string).
+ * Numbers and booleans are written the same way by all of them, see
+ * write_fields.
+ */
+namespace encode {
+
+/**
+ * @brief Human-readable fields as ` key=value`, strings as they are.
+ */
+struct Text {
+  template <typename Stream>
+  static void key(Stream &o, std::string_view k) {
+    write_run(o, " ", 1);
+    write_run(o, k.data(), k.size());
+    write_run(o, "=", 1);
+  }
+
+  template <typename Stream>
+  static void string(Stream &o, std::string_view s) {
+    write_run(o, s.data(), s.size());
+  }
+};
+
+/**
+ * @brief Fields as logfmt pairs, ` key=value`; strings are quoted when empty
+ * or holding spaces, quotes, `=` or control characters. Keys can't be quoted:
+ * their spaces, quotes, `=` and control characters are written as `_`.
+ */
+struct Logfmt {
+  template <typename Stream>
+  static void key(Stream &o, std::string_view k) {
+    write_run(o, " ", 1);
+    if (k.empty())
+      write_run(o, "_", 1);
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < k.size(); ++i) {
+      char c = k[i];
+      if (c != ' ' && c != '"' && c != '=' && std::uint8_t(c) >= 0x20)
+        continue;
+      write_run(o, k.data() + run, i - run);
+      write_run(o, "_", 1);
+      run = i + 1;
+    }
+    write_run(o, k.data() + run, k.size() - run);
+    write_run(o, "=", 1);
+  }
+
+  template <typename Stream>
+  static void string(Stream &o, std::string_view s) {
+    bool quote = s.empty();
+    for (char c : s)
+      quote |= c == ' ' || c == '"' || c == '=' || c == '\\' ||
+               std::uint8_t(c) < 0x20;
+    if (!quote)
+      return write_run(o, s.data(), s.size());
+    write_run(o, "\"", 1);
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+      unsigned char c = s[i];
+      const char *escape = c == '"'    ? "\\\""
+                           : c == '\\' ? "\\\\"
+                           : c == '\n' ? "\\n"
+                           : c == '\t' ? "\\t"
+                           : c == '\r' ? "\\r"
+                                        : nullptr;
+      if (escape == nullptr && c >= 0x20)
+        continue;
+      write_run(o, s.data() + run, i - run);
+      if (escape != nullptr) {
+        write_run(o, escape, 2);
+      } else {
+        // other control characters as JSON writes them
+        const char *hex = "0123456789abcdef";
+        char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        write_run(o, u, 6);
+      }
+      run = i + 1;
+    }
+    write_run(o, s.data() + run, s.size() - run);
+    write_run(o, "\"", 1);
+  }
+};
+
+/**
+ * @brief Fields as members of a JSON object, `,"key":value`.
+ */
+struct Json {
+  template <typename Stream>
+  static void key(Stream &o, std::string_view k) {
+    write_run(o, ",", 1);
+    string(o, k);
+    write_run(o, ":", 1);
+  }
+
+  template <typename Stream>
+  static void string(Stream &o, std::string_view s) {
+    write_run(o, "\"", 1);
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+      unsigned char c = s[i];
+      if (c >= 0x20 && c != '"' && c != '\\')
+        continue;
+      write_run(o, s.data() + run, i - run);
+      char escape[6] = {'\\', char(c), 0, 0, 0, 0};
+      std::size_t n = 2;
+      if (c == '\n')
+        escape[1] = 'n';
+      else if (c == '\t')
+        escape[1] = 't';
+      else if (c == '\r')
+        escape[1] = 'r';
+      else if (c < 0x20) {
+        const char *hex = "0123456789abcdef";
+        std::memcpy(escape + 1, "u00", 3);
+        escape[4] = hex[c >> 4];
+        escape[5] = hex[c & 0xf];
+        n = 6;
+      }
+      write_run(o, escape, n);
+      run = i + 1;
+    }
+    write_run(o, s.data() + run, s.size() - run);
+    write_run(o, "\"", 1);
+  }
+};
+}
+
+/**
+ * @brief Writes a number as an ostream with default formatting would, but
+ * without one: floating point numbers like printf's %g.
+ */
+template <typename Stream, typename T> void write_number(Stream &o, T v) {
+  char out[32];
+  std::to_chars_result r;
+  if constexpr (std::is_floating_point<T>::value)
+    r = std::to_chars(out, out + sizeof(out), v, std::chars_format::general, 6);
+  else
+    r = std::to_chars(out, out + sizeof(out), v);
+  write_run(o, out, r.ptr - out);
+}
+
+/**
+ * @brief Renders the value of a field with an encoder, see encode.
+ */
+template <typename Encoder, typename Stream>
+void write_value(Stream &o, const Field &f) {
+  switch (f.type) {
+    case Field::BOOL:
+      return f.b ? write_run(o, "true", 4) : write_run(o, "false", 5);
+    case Field::INT: return write_number(o, f.i);
+    case Field::UINT: return write_number(o, f.u);
+    case Field::DOUBLE:
+      // JSON has no infinities nor NaN
+      if (std::is_same<Encoder, encode::Json>::value && !std::isfinite(f.d))
+        return write_run(o, "null", 4);
+      return write_number(o, f.d);
+    case Field::STR: return Encoder::string(o, f.s);
+  }
+}
+
+/**
+ * @brief Renders fields with an encoder, see encode.
+ */
+template <typename Encoder, typename Stream>
+void write_fields(Stream &o, const Fields &fields) {
+  fields.for_each([&o](const Field &f) {
+    Encoder::key(o, f.key);
+    write_value<Encoder>(o, f);
+  });
+}
+}
+
+#endif /*__FIELDS_H__*/
@@ -0,0 +1,398 @@
+/**
+ * The checks a log statement passes before it builds a record: runtime
+ * severity thresholds, one per logger and one per source file, on top of the
+ * compile-time threshold of each logger, which stays the floor; and an
+ * optional filter on the statement's context.
+ */
+#ifndef __LEVELS_H__
+#define __LEVELS_H__
+
+#include <atomic>
+#include <climits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "line.h"
+#include "metrics.h"
+
+namespace logger {
+
+/**
+ * @brief The level of a source file with no threshold of its own, and the gate
+ * of loggers while some file has one.
+ */
+constexpr int unset_level = INT_MIN;
+
+/**
+ * @brief The runtime threshold of a logger.
+ *
+ * @detailed A record is let through with a single relaxed load of the gate:
+ * the logger's threshold while no source file has a threshold of its own. Once
+ * one does, the gate is unset_level and the threshold of the record's file, if
+ * any, takes the logger's place.
+ */
+class LevelControl {
+  friend class LevelRegistry;
+
+  std::atomic<int> gate, level;
+  std::string name;
+
+public:
+  explicit LevelControl(int level);
+  ~LevelControl();
+
+  LevelControl(const LevelControl &) = delete;
+  LevelControl &operator=(const LevelControl &) = delete;
+
+  /**
+   * @return Whether a record of the given severity passes the threshold.
+   *
+   * @param file A callable returning the threshold of the record's source
+   * file, only called if some file has one.
+   */
+  template <typename File> bool allows(int severity, File &&file) const {
+    int t = gate.load(std::memory_order_relaxed);
+    if (t != unset_level)
+      return severity >= t;
+    int f = file().load(std::memory_order_relaxed);
+    return severity >=
+           (f != unset_level ? f : level.load(std::memory_order_relaxed));
+  }
+
+  int get() const { return level.load(std::memory_order_relaxed); }
+  void set(int l);
+
+  /**
+   * @brief Names the logger, so that its threshold can be set by name.
+   */
+  void set_name(std::string n);
+};
+
+/**
+ * @brief The process-wide table of logger and file thresholds.
+ *
+ * @detailed File thresholds can be set for a file name or a suffix of it, e.g.
+ * "db/query.cpp", and apply to every file whose __FILE__ ends with it, the
+ * longest match winning. A logger name set before any logger has it applies
+ * to loggers named later.
+ */
+class LevelRegistry {
+  std::mutex lock;
+  std::vector<LevelControl *> controls;
+  std::map<std::string, int> logger_levels;
+  std::map<std::string, int> file_patterns;
+  std::map<std::string, std::unique_ptr<std::atomic<int>>> files;
+
+  static bool ends_with(const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+
+  /**
+   * @return The threshold the patterns give a file.
+   */
+  int match(const std::string &file) const {
+    int level = unset_level;
+    std::size_t longest = 0;
+    for (auto &p : file_patterns) {
+      if (p.first.size() >= longest && ends_with(file, p.first)) {
+        longest = p.first.size();
+        level = p.second;
+      }
+    }
+    return level;
+  }
+
+  /**
+   * @brief Opens or closes the gates of all loggers, as file thresholds come
+   * and go.
+   */
+  void update_gates() {
+    bool deferred = !file_patterns.empty();
+    for (LevelControl *c : controls)
+      c->gate.store(deferred ? unset_level
+                             : c->level.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+  }
+
+public:
+  void attach(LevelControl *c) {
+    std::lock_guard<std::mutex> guard(lock);
+    controls.push_back(c);
+    if (!file_patterns.empty())
+      c->gate.store(unset_level, std::memory_order_relaxed);
+  }
+
+  void detach(LevelControl *c) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto it = controls.begin(); it != controls.end(); ++it) {
+      if (*it == c) {
+        controls.erase(it);
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief Changes the threshold of a logger, keeping its gate in step.
+   */
+  void set(LevelControl *c, int level) {
+    std::lock_guard<std::mutex> guard(lock);
+    c->level.store(level, std::memory_order_relaxed);
+    if (file_patterns.empty())
+      c->gate.store(level, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Names a logger, applying the threshold set for the name, if any.
+   */
+  void name(LevelControl *c, std::string n) {
+    std::unique_lock<std::mutex> guard(lock);
+    c->name = std::move(n);
+    auto it = logger_levels.find(c->name);
+    if (it == logger_levels.end())
+      return;
+    int level = it->second;
+    guard.unlock();
+    set(c, level);
+  }
+
+  /**
+   * @brief Sets the threshold of every logger with the given name, or of every
+   * logger for the name "*".
+   */
+  void set_logger(const std::string &name, int level) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (name != "*")
+      logger_levels[name] = level;
+    for (LevelControl *c : controls) {
+      if (name == "*" || c->name == name) {
+        c->level.store(level, std::memory_order_relaxed);
+        if (file_patterns.empty())
+          c->gate.store(level, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Sets the threshold of the files ending with a pattern, or removes
+   * it for unset_level.
+   */
+  void set_file(const std::string &pattern, int level) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (level == unset_level)
+      file_patterns.erase(pattern);
+    else
+      file_patterns[pattern] = level;
+    for (auto &f : files)
+      f.second->store(match(f.first), std::memory_order_relaxed);
+    update_gates();
+  }
+
+  /**
+   * @brief Removes all file thresholds.
+   */
+  void clear_files() {
+    std::lock_guard<std::mutex> guard(lock);
+    file_patterns.clear();
+    for (auto &f : files)
+      f.second->store(unset_level, std::memory_order_relaxed);
+    update_gates();
+  }
+
+  /**
+   * @return The threshold of a source file, which stays valid for the life of
+   * the process. Each log statement looks it up once.
+   */
+  const std::atomic<int> &file(const char *name) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto &slot = files[name];
+    if (!slot)
+      slot.reset(new std::atomic<int>(match(name)));
+    return *slot;
+  }
+};
+
+inline LevelRegistry &level_registry() {
+  static LevelRegistry registry;
+  return registry;
+}
+
+inline LevelControl::LevelControl(int l) : gate(l), level(l) {
+  level_registry().attach(this);
+}
+
+inline LevelControl::~LevelControl() { level_registry().detach(this); }
+
+inline void LevelControl::set(int l) { level_registry().set(this, l); }
+
+inline void LevelControl::set_name(std::string n) {
+  level_registry().name(this, std::move(n));
+}
+
+/**
+ * @return The threshold of a source file, see LevelRegistry::file.
+ */
+inline const std::atomic<int> &file_level(const char *file) {
+  return level_registry().file(file);
+}
+
+/**
+ * @brief ContextFilter represents a test of a log statement's context, made
+ * before the record is built. It must depend on nothing but the context, as
+ * its verdict is cached per statement.
+ */
+using ContextFilter = bool (*)(const ContextInfo &);
+
+/**
+ * @return A number never returned before, to tell context filters apart.
+ */
+inline std::uint64_t next_filter_epoch() {
+  static std::atomic<std::uint64_t> epoch(0);
+  return epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+/**
+ * @brief What a log statement keeps about itself, in a static created the
+ * first time it's needed: the threshold of its file, and the verdict of the
+ * last context filter it went through.
+ */
+struct SiteState {
+  const std::atomic<int> &file;
+
+  // The epoch of the filter shifted left by one, and the verdict.
+  std::atomic<std::uint64_t> verdict;
+
+  explicit SiteState(const char *file_name)
+      : file(file_level(file_name)), verdict(0) {}
+};
+
+/**
+ * @brief The runtime checks shared by all loggers, on top of their
+ * compile-time threshold: the runtime threshold and the context filter.
+ *
+ * @usage my_logger.set_level(WARNING); my_logger.set_name("db");
+ */
+template <int threshold> class Leveled {
+  LevelControl control;
+
+  /**
+   * @brief A context filter and its epoch, published together: a gate is
+   * never changed once set, and lives as long as the logger, so that a
+   * statement that loaded it can still use it after it is replaced.
+   */
+  struct ContextGate {
+    ContextFilter filter;
+    std::uint64_t epoch;
+  };
+
+  /**
+   * @brief The current gate, or nullptr when there is no filter, and every
+   * gate set so far, guarded by gates_lock.
+   */
+  std::atomic<const ContextGate *> gate;
+  std::mutex gates_lock;
+  std::vector<std::unique_ptr<ContextGate>> gates;
+
+  /**
+   * @brief The Metrics that count the statements rejected by enabled(), once
+   * the logger's metrics are switched on.
+   */
+  std::atomic<Metrics *> rejections;
+
+  /**
+   * @return The verdict of the context filter on a statement, from the
+   * statement's cache if the filter has seen it before.
+   */
+  template <typename Site>
+  bool admits(Site &site, const ContextInfo &info) const {
+    const ContextGate *g = gate.load(std::memory_order_acquire);
+    if (g == nullptr)
+      return true;
+    SiteState &s = site();
+    std::uint64_t cached = s.verdict.load(std::memory_order_relaxed);
+    if (cached >> 1 == g->epoch)
+      return cached & 1;
+    bool verdict = (*g->filter)(info);
+    s.verdict.store(g->epoch << 1 | verdict, std::memory_order_relaxed);
+    return verdict;
+  }
+
+public:
+  Leveled() : control(threshold), gate(nullptr), rejections(nullptr) {}
+
+  /**
+   * @brief Whether a log statement of severity N should build a record at
+   * all; called by the logging macros before anything else.
+   *
+   * @param site A callable returning the statement's SiteState.
+   * @param info The context of the statement.
+   */
+  template <int N, typename Site>
+  bool enabled(Site &&site, const ContextInfo &info) const {
+    if constexpr (N < threshold) {
+      return false;
+    } else {
+      if (control.allows(N, [&]() -> auto & { return site().file; }) &&
+          admits(site, info))
+        return true;
+      if (Metrics *m = rejections.load(std::memory_order_acquire))
+        m->filtered(N);
+      return false;
+    }
+  }
+
+  /**
+   * @brief Sets a filter on the context of log statements, run before their
+   * record is built, or removes it for nullptr. Unlike the Filter, which sees
+   * the finished Line, rejected statements cost nothing but the check, and
+   * once a statement has been through the filter, the check is a lookup of
+   * the cached verdict. Safe while other threads log; each call keeps a few
+   * bytes until the logger is destroyed.
+   */
+  void set_context_filter(ContextFilter f) {
+    if (f == nullptr) {
+      gate.store(nullptr, std::memory_order_release);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(gates_lock);
+    gates.emplace_back(new ContextGate{f, next_filter_epoch()});
+    gate.store(gates.back().get(), std::memory_order_release);
+  }
+
+protected:
+  /**
+   * @brief Counts the statements rejected by enabled() from now on, as
+   * filtered records; called by loggers as they switch their metrics on.
+   */
+  void count_rejections(Metrics *m) {
+    rejections.store(m, std::memory_order_release);
+  }
+
+public:
+  /**
+   * @brief Sets the runtime threshold. Thresholds below the compile-time one
+   * have the effect of the compile-time one.
+   */
+  void set_level(int level) { control.set(level); }
+  int level() const { return control.get(); }
+
+  /**
+   * @brief Names the logger, so that its threshold can be set by name.
+   */
+  void set_name(std::string name) { control.set_name(std::move(name)); }
+};
+
+/**
+ * @brief Turns a streamed record into void, so that the logging macros can be
+ * written as a conditional expression.
+ */
+struct Voidify {
+  template <typename R> void operator&(R &&) const {}
+};
+}
+
+#endif /*__LEVELS_H__*/
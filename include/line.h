@@ -0,0 +1,183 @@
+/**
+ * The log line: the context of a log statement and everything a record
+ * captures, which the loggers format and write.
+ */
+#ifndef __LINE_H__
+#define __LINE_H__
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+
+#include "buffer.h"
+#include "clock.h"
+#include "fields.h"
+#include "threads.h"
+
+namespace logger {
+
+/**
+ * @brief 64-bit FNV-1a hash of a null-terminated string, usable at compile
+ * time.
+ *
+ * @param s The string to hash.
+ * @param h The hash to continue from, to hash several strings in sequence.
+ */
+constexpr std::uint64_t fnv1a(const char *s,
+                              std::uint64_t h = 14695981039346656037ull) {
+  for (; *s != '\0'; ++s)
+    h = (h ^ std::uint8_t(*s)) * 1099511628211ull;
+  return h;
+}
+
+/**
+ * @brief 64-bit FNV-1a hash of a run of characters.
+ */
+constexpr std::uint64_t fnv1a(std::string_view s,
+                              std::uint64_t h = 14695981039346656037ull) {
+  for (char c : s)
+    h = (h ^ std::uint8_t(c)) * 1099511628211ull;
+  return h;
+}
+
+/**
+ * @brief Computes the identifier of a log statement from its location, level
+ * and __COUNTER__ value, which tells apart statements sharing a line. Used by
+ * the logging macros at compile time.
+ */
+constexpr std::uint64_t site_id(const char *file, int line, int level,
+                                int counter) {
+  std::uint64_t h = fnv1a(file);
+  h = (h ^ std::uint32_t(line)) * 1099511628211ull;
+  h = (h ^ std::uint32_t(level)) * 1099511628211ull;
+  return (h ^ std::uint32_t(counter)) * 1099511628211ull;
+}
+
+/**
+ * @brief Mixes a 64-bit value into a running hash; the result depends on the
+ * order in which values are mixed in.
+ */
+constexpr std::uint64_t mix(std::uint64_t h, std::uint64_t v) {
+  h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 29);
+}
+
+/**
+ * @brief An identifier of a type derived from its name, so that it is the same
+ * in every run and on every machine for a given compiler.
+ */
+template <typename T> constexpr std::uint64_t type_id() {
+  return fnv1a(__PRETTY_FUNCTION__);
+}
+
+/**
+ * @brief Mixes an object streamed to a record into the hash identifier of its
+ * message: constant character arrays, which string literals are, by their
+ * text, and anything else by its type, computed at compile time. The
+ * identifier thus stays the same whatever values a log statement prints and
+ * wherever they live in memory.
+ *
+ * @remark Records stream their objects as constants; they pass character
+ * arrays that can be written to, whose text changes from call to call, to the
+ * overload below.
+ *
+ * @param h The hash so far.
+ * @param s The streamed object.
+ */
+template <typename T>
+constexpr std::uint64_t hash_piece(std::uint64_t h, const T &s) {
+  if constexpr (std::is_array<T>::value &&
+                std::is_same<typename std::remove_extent<T>::type,
+                             char>::value) {
+    std::uint64_t text = 14695981039346656037ull;
+    for (std::size_t i = 0; i < std::extent<T>::value && s[i] != '\0'; ++i)
+      text = (text ^ std::uint8_t(s[i])) * 1099511628211ull;
+    return mix(h, text);
+  } else {
+    return mix(h, std::integral_constant<std::uint64_t, type_id<T>()>::value);
+  }
+}
+
+/**
+ * @brief Mixes a character array that can be written to, such as a buffer
+ * filled at runtime, into the hash identifier by its type, as any other value.
+ */
+template <std::size_t N>
+constexpr std::uint64_t hash_piece(std::uint64_t h, char (&)[N]) {
+  return mix(h,
+             std::integral_constant<std::uint64_t, type_id<char[N]>()>::value);
+}
+
+/**
+ * @brief A plain-old-data container for the fixed code context of a log record.
+ * Necessary to propagate context information from the predefined macros.
+ * Auxiliary, short-lived class with life-time the duration of the log command.
+ */
+struct ContextInfo {
+  // A pointer to the filename containing the log command.
+  const char *file;
+
+  // A pointer to the function name containing the log command.
+  const char *fn;
+
+  // Values representing the line of the log command and the severity level at
+  // which it was invoked.
+  int line, level;
+
+  // An identifier of the log command, see site_id.
+  std::uint64_t site = 0;
+};
+
+/**
+ * @brief A structure representing all the information about a particular
+ * logging line. Includes contextual and message information.
+ */
+struct Line {
+  // Information about the context of the recorded line: file, function,
+  // severity, line number.
+  ContextInfo info;
+
+  // A local buffer for the message corresponding to this log command.
+  LineBuffer message;
+
+  // The typed fields streamed with kv(), kept apart from the message text.
+  Fields fields;
+
+  // A hash that serves as an identifier for the message. It starts from the
+  // site of the log statement and depends on the literal text and the types of
+  // the components of the message, see hash_piece, so it is deterministic
+  // across runs and machines.
+  std::uint64_t hash;
+
+  // The thread that created the record and the moment it was created. Both are
+  // captured up front so that the line can be formatted later, possibly on a
+  // different thread.
+  std::thread::id thread;
+  std::chrono::system_clock::time_point time;
+
+  // The ordinal of the thread that created the record (see thread_ordinal), or
+  // 0 for lines that come from elsewhere, e.g. a decoded binary log.
+  std::uint32_t ordinal;
+
+  /**
+   * @brief Constructs an empty Line, used as a placeholder in queues before a
+   * real Line is moved in.
+   */
+  Line() : info(), message(), hash(0), ordinal(0) {}
+
+  /**
+   * @brief Constructs a Line from a ContextInfo with initial empty message and
+   * hash values. A ContextInfo is necessary to provide the initial state of the
+   * Line.
+   *
+   * @param i The filename, function name, line number, and severity level
+   * information.
+   */
+  Line(const ContextInfo &i)
+      : info(i), message(), hash(0), thread(std::this_thread::get_id()),
+        time(clock_now()), ordinal(thread_ordinal()) {}
+};
+}
+
+#endif /*__LINE_H__*/
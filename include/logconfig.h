@@ -11,7 +11,9 @@
 #include <iostream>
 #include <thread>
 
+#include "async.h"
 #include "logger.h"
+#include "sampling.h"
 
 namespace logger {
 /**
@@ -45,34 +47,158 @@ void prop_level(Stream &o, const Line &l) {
 
 // Can avoid the Line parameter in GCC 7 with template <auto> elsewhere
 /**
- * @brief A Prop that prints the current time to the log stream.
+ * @brief A Prop that prints the time at which the Line was created to the log
+ * stream, as HH:MM:SS.
  */
 template <typename Stream>
 void prop_time(Stream &o, const Line &l) {
-  using std::chrono::system_clock;
-  auto now = system_clock::to_time_t(system_clock::now());
-  o << std::put_time(std::localtime(&now), "%T");
+  TimeCache &cache = time_cache();
+  cache.at(l.time);
+  write_run(o, cache.time(), cache.time_length());
 }
 
 /**
- * @brief A Prop that prints the current date to the log stream.
+ * @brief A Prop that prints the time at which the Line was created to the log
+ * stream, with microseconds: HH:MM:SS.uuuuuu.
+ */
+template <typename Stream>
+void prop_time_us(Stream &o, const Line &l) {
+  TimeCache &cache = time_cache();
+  char out[32];
+  write_run(o, out, cache.fraction(out, cache.at(l.time), 6));
+}
+
+/**
+ * @brief A Prop that prints the time at which the Line was created to the log
+ * stream, with nanoseconds: HH:MM:SS.nnnnnnnnn.
+ */
+template <typename Stream>
+void prop_time_ns(Stream &o, const Line &l) {
+  TimeCache &cache = time_cache();
+  char out[32];
+  write_run(o, out, cache.fraction(out, cache.at(l.time), 9));
+}
+
+/**
+ * @brief A Prop that prints the date on which the Line was created to the log
+ * stream, as YYYY-MM-DD.
  */
 template <typename Stream>
 void prop_date(Stream &o, const Line &l) {
-  using std::chrono::system_clock;
-  auto now = system_clock::to_time_t(system_clock::now());
-  o << std::put_time(std::localtime(&now), "%F");
+  TimeCache &cache = time_cache();
+  cache.at(l.time);
+  write_run(o, cache.date(), cache.date_length());
 }
 
 /**
- * @brief A Prop that prints an identifier for the current thread to the log
- * stream.
+ * @brief A Prop that prints an identifier for the thread that created the Line
+ * to the log stream: the name given with set_thread_name, or else the thread
+ * id in hexadecimal.
  */
 template <typename Stream>
 void prop_thread(Stream &o, const Line &l) {
-  auto f = o.flags();
-  o << std::hex << std::showbase << std::this_thread::get_id();
-  o.flags(f);
+  if (l.ordinal != 0) {
+    const std::string &name = thread_name_cache().name(l.ordinal);
+    write_run(o, name.data(), name.size());
+  } else {
+    auto f = o.flags();
+    o << std::hex << std::showbase << l.thread;
+    o.flags(f);
+  }
+}
+
+/**
+ * @brief A Prop that prints the ordinal of the thread that created the Line,
+ * a small integer that is cheaper to print and to group by than the id.
+ */
+template <typename Stream>
+void prop_thread_ordinal(Stream &o, const Line &l) {
+  char out[16];
+  write_run(o, out, std::to_chars(out, out + sizeof(out), l.ordinal).ptr - out);
+}
+
+/**
+ * @brief Writes the identifier of the thread that created a Line, as
+ * prop_thread does, as a string of an encoder, see encode.
+ */
+template <typename Encoder, typename Stream>
+void write_thread(Stream &o, const Line &l) {
+  if (l.ordinal != 0)
+    Encoder::string(o, thread_name_cache().name(l.ordinal));
+  else
+    Encoder::string(o, render_thread_id(l.thread));
+}
+
+/**
+ * @brief Props that print the thread, file and function of a Line as quoted
+ * JSON strings.
+ */
+template <typename Stream>
+void prop_json_thread(Stream &o, const Line &l) {
+  write_thread<encode::Json>(o, l);
+}
+
+template <typename Stream>
+void prop_json_file(Stream &o, const Line &l) {
+  encode::Json::string(o, l.info.file != nullptr ? l.info.file : "");
+}
+
+template <typename Stream>
+void prop_json_func(Stream &o, const Line &l) {
+  encode::Json::string(o, l.info.fn != nullptr ? l.info.fn : "");
+}
+
+/**
+ * @brief A Prop that prints the message as a quoted JSON string.
+ */
+template <typename Stream>
+void prop_json_msg(Stream &o, const Line &l) {
+  encode::Json::string(o, l.message.view());
+}
+
+/**
+ * @brief A Prop that prints the fields of the Line as members of a JSON
+ * object, each preceded by a comma.
+ */
+template <typename Stream>
+void prop_json_fields(Stream &o, const Line &l) {
+  write_fields<encode::Json>(o, l.fields);
+}
+
+/**
+ * @brief Props that print the thread, file and function of a Line as logfmt
+ * values, quoted if needed.
+ */
+template <typename Stream>
+void prop_logfmt_thread(Stream &o, const Line &l) {
+  write_thread<encode::Logfmt>(o, l);
+}
+
+template <typename Stream>
+void prop_logfmt_file(Stream &o, const Line &l) {
+  encode::Logfmt::string(o, l.info.file != nullptr ? l.info.file : "");
+}
+
+template <typename Stream>
+void prop_logfmt_func(Stream &o, const Line &l) {
+  encode::Logfmt::string(o, l.info.fn != nullptr ? l.info.fn : "");
+}
+
+/**
+ * @brief A Prop that prints the message as a logfmt value, quoted if needed.
+ */
+template <typename Stream>
+void prop_logfmt_msg(Stream &o, const Line &l) {
+  encode::Logfmt::string(o, l.message.view());
+}
+
+/**
+ * @brief A Prop that prints the fields of the Line as logfmt pairs, each
+ * preceded by a space.
+ */
+template <typename Stream>
+void prop_logfmt_fields(Stream &o, const Line &l) {
+  write_fields<encode::Logfmt>(o, l.fields);
 }
 
 /**
@@ -84,6 +210,18 @@ constexpr const char full_fmt[] =
 
 constexpr const char basic_fmt[] = "%";
 
+/**
+ * @brief Format strings for structured logs: one JSON object per line, or one
+ * line of logfmt pairs, with the fields of the Line after the message. See
+ * JsonLogger and LogfmtLogger for the Props that go with them.
+ */
+constexpr const char json_fmt[] =
+    "{\"date\":\"%\",\"time\":\"%\",\"level\":\"%\",\"thread\":%,"
+    "\"file\":%,\"func\":%,\"line\":%,\"hash\":\"%\",\"msg\":%%}";
+
+constexpr const char logfmt_fmt[] =
+    "date=% time=% level=% thread=% file=% func=% line=% hash=% msg=%%";
+
 /**
  * @brief A sample logger that prints full contextual information along with
  * each message.
@@ -95,6 +233,55 @@ using FullLogger =
     Logger<Stream, threshold, full_fmt, prop_date, prop_time, prop_level,
            prop_thread, prop_file, prop_func, prop_line, prop_msg, prop_hash>;
 
+/**
+ * @brief The asynchronous counterpart of FullLogger: log statements only pay
+ * for a queue push, a background thread does the formatting and writing.
+ *
+ * @usage AsyncFullLogger<std::ostream, DEBUG> my_logger(std::clog);
+ */
+template <typename Stream, int threshold = INFO>
+using AsyncFullLogger =
+    AsyncLogger<Stream, threshold, full_fmt, prop_date, prop_time, prop_level,
+                prop_thread, prop_file, prop_func, prop_line, prop_msg,
+                prop_hash>;
+
+/**
+ * @brief Like AsyncFullLogger, but every thread logs into its own ring and the
+ * output is merged in time order.
+ *
+ * @usage MergingFullLogger<std::ostream, DEBUG> my_logger(std::clog);
+ */
+template <typename Stream, int threshold = INFO>
+using MergingFullLogger =
+    MergingLogger<Stream, threshold, full_fmt, prop_date, prop_time,
+                  prop_level, prop_thread, prop_file, prop_func, prop_line,
+                  prop_msg, prop_hash>;
+
+/**
+ * @brief A logger that writes JSON lines, which the analyser reads back with
+ * Parser::read_json_file.
+ *
+ * @usage JsonLogger<std::ostream, DEBUG> my_logger(std::clog);
+ * CLOG(my_logger, INFO) << "served" << kv("user", id);
+ */
+template <typename Stream, int threshold = INFO>
+using JsonLogger =
+    Logger<Stream, threshold, json_fmt, prop_date, prop_time_us, prop_level,
+           prop_json_thread, prop_json_file, prop_json_func, prop_line,
+           prop_hash, prop_json_msg, prop_json_fields>;
+
+/**
+ * @brief A logger that writes logfmt lines, which the analyser reads back with
+ * Parser::read_logfmt_file.
+ *
+ * @usage LogfmtLogger<std::ostream, DEBUG> my_logger(std::clog);
+ */
+template <typename Stream, int threshold = INFO>
+using LogfmtLogger =
+    Logger<Stream, threshold, logfmt_fmt, prop_date, prop_time_us, prop_level,
+           prop_logfmt_thread, prop_logfmt_file, prop_logfmt_func, prop_line,
+           prop_hash, prop_logfmt_msg, prop_logfmt_fields>;
+
 /**
  * @brief A sample logger that prints just the log message.
  *
@@ -111,11 +298,75 @@ using FmtLogger = Logger<std::ostream, INFO, fmt, props...>;
  * @brief A default logger LOG, along with macros to call loggers with
  * pre-populated contexts. Macros are necessary since there's no other way to
  * hook into the filename/function name/line number of the calling site.
+ *
+ * Statements below the logger's compile-time or runtime threshold, or the
+ * runtime threshold of their file, stop at the check and build no record.
  */
 logger::FullLogger<std::ostream> LOG(std::clog);
 #define LOG(severity) CLOG(LOG, severity)
 #define CLOG(instance, severity) CLOGL(instance, logger::severity)
-#define CLOGL(instance, severity)                                              \
-  instance.log<severity>({__FILE__, __func__, __LINE__, severity})
+#define CLOGL(instance, severity) CLAYER_LOG(instance, severity, __COUNTER__)
+#define CLAYER_LOG(instance, severity, n)                                      \
+  !(instance).template enabled<severity>(CLAYER_SITE,                          \
+                                         CLAYER_CONTEXT(severity, n))          \
+      ? (void)0                                                                \
+      : logger::Voidify() & CLAYER_RECORD(instance, severity, n)
+
+/**
+ * @brief Sampled and rate limited log statements. Each statement has its own
+ * sampler; calls it suppresses build no record, and the next record it lets
+ * through starts with "[suppressed N] ".
+ *
+ * @usage LOG_EVERY_N(WARNING, 1000) << "queue full"; (1st, 1001st, ... call)
+ *        LOG_FIRST_N(INFO, 10) << "starting up"; (first 10 calls only)
+ *        LOG_EVERY_T(ERROR, 2.5) << "retrying"; (at most one per 2.5 s)
+ *        LOG_RATE(WARNING, 100) << "slow"; (100 per second, bursts of 100)
+ */
+#define LOG_EVERY_N(severity, n) CLOG_EVERY_N(LOG, severity, n)
+#define LOG_FIRST_N(severity, n) CLOG_FIRST_N(LOG, severity, n)
+#define LOG_EVERY_T(severity, seconds) CLOG_EVERY_T(LOG, severity, seconds)
+#define LOG_RATE(severity, per_sec) CLOG_RATE(LOG, severity, per_sec)
+#define CLOG_EVERY_N(instance, severity, n)                                    \
+  CLOGL_SAMPLED(instance, logger::severity, logger::sampling::EveryN, n)
+#define CLOG_FIRST_N(instance, severity, n)                                    \
+  CLOGL_SAMPLED(instance, logger::severity, logger::sampling::FirstN, n)
+#define CLOG_EVERY_T(instance, severity, seconds)                              \
+  CLOGL_SAMPLED(instance, logger::severity, logger::sampling::EveryT, seconds)
+#define CLOG_RATE(instance, severity, per_sec)                                 \
+  CLOGL_SAMPLED(instance, logger::severity, logger::sampling::Rate, per_sec)
+#define CLOGL_SAMPLED(instance, severity, Sampler, ...)                        \
+  CLAYER_SAMPLED(instance, severity, __COUNTER__, Sampler, __VA_ARGS__)
+#define CLAYER_SAMPLED(instance, severity, n, Sampler, ...)                    \
+  !((instance).template enabled<severity>(CLAYER_SITE,                         \
+                                          CLAYER_CONTEXT(severity, n)) &&      \
+    [&]() {                                                                    \
+      static Sampler sampler;                                                  \
+      return sampler.admit(__VA_ARGS__);                                       \
+    }())                                                                       \
+      ? (void)0                                                                \
+      : logger::Voidify() & CLAYER_RECORD(instance, severity, n)               \
+                                << logger::hash::off << logger::suppressed()   \
+                                << logger::hash::on
+
+/**
+ * @brief The pieces of the logging macros: the statement's SiteState, created
+ * the first time it's needed, its context, and its record. n is the value of
+ * __COUNTER__ taken once per statement, so that its context and its record
+ * agree on the site however many statements share the line.
+ */
+#define CLAYER_SITE                                                            \
+  []() -> logger::SiteState & {                                                \
+    static logger::SiteState site(__FILE__);                                   \
+    return site;                                                               \
+  }
+#define CLAYER_CONTEXT(severity, n)                                            \
+  logger::ContextInfo {                                                        \
+    __FILE__, __func__, __LINE__, severity,                                    \
+        std::integral_constant<std::uint64_t, logger::site_id(                 \
+                                                  __FILE__, __LINE__,          \
+                                                  severity, n)>::value         \
+  }
+#define CLAYER_RECORD(instance, severity, n)                                   \
+  instance.template log<severity>(CLAYER_CONTEXT(severity, n))
 
 #endif /* __LOGCONFIG_H__ */
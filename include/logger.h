@@ -4,11 +4,24 @@
 #ifndef __LOGGER_H__
 #define __LOGGER_H__
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <thread>
 #include <type_traits>
+#include <utility>
+
+#include "buffer.h"
+#include "dedup.h"
+#include "levels.h"
+#include "line.h"
+#include "metrics.h"
 
 namespace logger {
 
@@ -31,50 +44,36 @@ template <typename T> concept bool Streamable = requires(T o, std::ostream &s) {
 };
 
 /**
- * @brief A plain-old-data container for the fixed code context of a log record.
- * Necessary to propagate context information from the predefined macros.
- * Auxiliary, short-lived class with life-time the duration of the log command.
+ * @brief Something is a RecordSink if it wants to know where records end, to
+ * decide for itself when to flush, like FdSink in sink.h. Loggers flush other
+ * streams after every record (or batch of records).
  */
-struct ContextInfo {
-  // A pointer to the filename containing the log command.
-  const char *file;
-
-  // A pointer to the function name containing the log command.
-  const char *fn;
-
-  // Values representing the line of the log command and the severity level at
-  // which it was invoked.
-  int line, level;
+template <typename T> concept bool RecordSink = requires(T o, int level) {
+  o.end_record(level);
 };
 
 /**
- * @brief A structure representing all the information about a particular
- * logging line. Includes contextual and message information.
+ * @brief Something is a TimedRecordSink if it also wants the time at which each
+ * record was logged, like CompressedSink in compressed.h, which indexes its
+ * frames by it.
  */
-struct Line {
-  // Information about the context of the recorded line: file, function,
-  // severity, line number.
-  ContextInfo info;
-
-  // A local buffer for the message corresponding to this log command.
-  std::ostringstream message;
-
-  // A hash that serves as an identifier for the message. It depends on the
-  // identifiers (for now, addresses) of the components of the message (the
-  // variables and strings output)
-  intptr_t hash;
-
-  /**
-   * @brief Constructs a Line from a ContextInfo with initial empty message and
-   * hash values. A ContextInfo is necessary to provide the initial state of the
-   * Line.
-   *
-   * @param i The filename, function name, line number, and severity level
-   * information.
-   */
-  Line(const ContextInfo &i) : info(i), message(), hash(0) {}
+template <typename T>
+concept bool TimedRecordSink =
+    requires(T o, int level, std::chrono::system_clock::time_point t) {
+  o.end_record(level, t);
 };
 
+/**
+ * @brief Lets a RecordSink know the record of a Line ended, with the time the
+ * Line was logged at if it wants it.
+ */
+template <typename Stream> void record_ended(Stream &s, const Line &line) {
+  if constexpr (TimedRecordSink<Stream>)
+    s.end_record(line.info.level, line.time);
+  else
+    s.end_record(line.info.level);
+}
+
 // Type aliases for functions used to manipulate logging output.
 
 /**
@@ -101,10 +100,13 @@ template <typename Stream> using Prop = void (*)(Stream &, const Line &);
 using Filter = bool (*)(Line &);
 
 /**
- * @brief A Prop that prints the message component to a log stream.
+ * @brief A Prop that prints the message component to a log stream, followed by
+ * the fields of the Line as ` key=value`, see encode::Text.
  */
 template <typename Stream> void prop_msg(Stream &o, const Line &l) {
-  o << l.message.str();
+  write_run(o, l.message.data(), l.message.size());
+  if (!l.fields.empty())
+    write_fields<encode::Text>(o, l.fields);
 }
 
 /**
@@ -168,32 +170,207 @@ const Flag<false> &off = Flag<false>::inst;
 }
 
 /**
- * @brief A catch-all class for storing a log line record and printing it
- * according to a format.
+ * @brief Compile-time helpers that split a format string into literal runs
+ * around its `%` wildcards. Run i spans from after wildcard i - 1 up to
+ * wildcard i; the last run ends at the end of the format.
+ */
+constexpr std::size_t wildcards(const char *f) {
+  std::size_t n = 0;
+  for (; *f != '\0'; ++f)
+    n += (*f == '%');
+  return n;
+}
+
+constexpr std::size_t wildcard_pos(const char *f, std::size_t i) {
+  std::size_t p = 0;
+  for (; f[p] != '\0'; ++p)
+    if (f[p] == '%' && i-- == 0)
+      return p;
+  return p;
+}
+
+constexpr std::size_t run_begin(const char *f, std::size_t i) {
+  return i == 0 ? 0 : wildcard_pos(f, i - 1) + 1;
+}
+
+constexpr std::size_t run_end(const char *f, std::size_t i) {
+  return wildcard_pos(f, i);
+}
+
+/**
+ * @brief Prints a Line to a stream according to a format string and a list of
+ * Props. Each `%` in the format is replaced by the output of the corresponding
+ * Prop, in order.
  *
- * @detailed The cornerstone of the logging library. This class takes contextual
- * information about a log call, along with auxiliary structures like a mutex
- * and a filter, and provides a way to stream message data to the log. When its
- * time comes (at the end of the logging command, if used properly), it'll flush
- * its local buffer into the stream passed to it.
+ * @detailed The format is split into literal runs at compile time, so printing
+ * a Line is a fixed sequence of one write per non-empty run and one call per
+ * Prop, with no scanning of the format. The format must have exactly one `%`
+ * per Prop.
  *
  * @remark This hints at why Prop must be a type alias instead of a concept.
- * Record takes in instances of Prop as template parameters, and there's no way
- * to take in instances of variable types as template parameters (no template
- * for template parameters) as of yet (If Prop were a concept, props would have
- * to be a list of types). A similar problem necessitates puting Stream as an
- * explicit template parameter. This would be resolved by a proposal approved
- * for C++17 to be implemented in GCC 7 [1].
+ * Formatter takes in instances of Prop as template parameters, and there's no
+ * way to take in instances of variable types as template parameters (no
+ * template for template parameters) as of yet (If Prop were a concept, props
+ * would have to be a list of types). A similar problem necessitates puting
+ * Stream as an explicit template parameter. This would be resolved by a
+ * proposal approved for C++17 to be implemented in GCC 7 [1].
  *
  * [1] www.open-std.org/jtc1/sc22/wg21/docs/papers/2016/p0127r1.html
  */
 template <const char *fmt, typename Stream, Prop<Stream>... props>
-class Record {
+struct Formatter {
+  static_assert(wildcards(fmt) == sizeof...(props),
+                "the format must have exactly one % per Prop");
+
   /**
-   * @brief A reference to the stream to dump to from the local buffer once the
-   * record is completed.
+   * @brief Prints the line according to the format, without a line ending.
+   *
+   * @param stream The destination stream.
+   * @param line The line to print.
    */
-  Stream &stream;
+  static void print(Stream &stream, const Line &line) {
+    print(stream, line, std::make_index_sequence<sizeof...(props)>());
+  }
+
+private:
+  /**
+   * @brief Prints the I-th literal run of the format, if it isn't empty.
+   */
+  template <std::size_t I> static inline void print_run(Stream &stream) {
+    constexpr std::size_t begin = run_begin(fmt, I), end = run_end(fmt, I);
+    if constexpr (end > begin)
+      write_run(stream, fmt + begin, end - begin);
+  }
+
+  /**
+   * @brief Interleaves the literal runs with the Props: run 0, Prop 0, run 1,
+   * Prop 1, ..., and the final run.
+   */
+  template <std::size_t... I>
+  static inline void print(Stream &stream, const Line &line,
+                           std::index_sequence<I...>) {
+    ((print_run<I>(stream), props(stream, line)), ...);
+    print_run<sizeof...(props)>(stream);
+  }
+};
+
+/**
+ * @brief Whether lines for a Stream can be formatted before taking the lock of
+ * the logger: the Stream must be an ostream that can be created on its own,
+ * so that each thread can have one pointed at a buffer of its own.
+ */
+template <typename Stream>
+constexpr bool stageable =
+    std::is_base_of<std::ostream, Stream>::value &&
+    (std::is_constructible<Stream, std::streambuf *>::value ||
+     std::is_default_constructible<Stream>::value);
+
+/**
+ * @brief A Stream of the logger's type whose output goes to a LineBuffer,
+ * where a thread formats a whole line before writing it out in one piece.
+ * There is one per thread and Stream type, see staging().
+ */
+template <typename Stream> class Staging {
+  LineBuffer text;
+  LineStreambuf buf;
+  std::optional<Stream> stream;
+
+public:
+  Staging() {
+    buf.target = &text;
+    if constexpr (std::is_constructible<Stream, std::streambuf *>::value) {
+      stream.emplace(&buf);
+    } else {
+      stream.emplace();
+      static_cast<std::ios &>(*stream).rdbuf(&buf);
+    }
+  }
+
+  /**
+   * @brief Empties the buffer for a new line.
+   *
+   * @return The stream to format the line to.
+   */
+  Stream &begin() {
+    text.clear();
+    stream->clear();
+    return *stream;
+  }
+
+  const char *data() const { return text.data(); }
+  std::size_t size() const { return text.size(); }
+};
+
+/**
+ * @return The current thread's Staging for a Stream type.
+ */
+template <typename Stream> inline Staging<Stream> &staging() {
+  static thread_local Staging<Stream> s;
+  return s;
+}
+
+/**
+ * @brief The types an ostream prints as characters.
+ */
+template <typename T>
+struct is_plain_char
+    : std::integral_constant<bool, std::is_same<T, char>::value ||
+                                       std::is_same<T, signed char>::value ||
+                                       std::is_same<T, unsigned char>::value> {
+};
+
+/**
+ * @brief The types an ostream prints as numbers with no conversion, and that
+ * std::to_chars can format the same way: integers other than bool and the
+ * character types, double and long double.
+ */
+template <typename T>
+struct is_plain_number
+    : std::integral_constant<
+          bool, std::is_same<T, short>::value ||
+                    std::is_same<T, unsigned short>::value ||
+                    std::is_same<T, int>::value ||
+                    std::is_same<T, unsigned int>::value ||
+                    std::is_same<T, long>::value ||
+                    std::is_same<T, unsigned long>::value ||
+                    std::is_same<T, long long>::value ||
+                    std::is_same<T, unsigned long long>::value ||
+                    std::is_same<T, double>::value ||
+                    std::is_same<T, long double>::value> {};
+
+/**
+ * @brief The pointer types an ostream prints as addresses: pointers to objects
+ * other than characters, which are printed as strings.
+ */
+template <typename T>
+struct is_plain_pointer
+    : std::integral_constant<
+          bool, std::is_pointer<T>::value &&
+                    !std::is_function<
+                        typename std::remove_pointer<T>::type>::value &&
+                    !is_plain_char<typename std::remove_cv<
+                        typename std::remove_pointer<T>::type>::type>::value> {
+};
+
+/**
+ * @brief A catch-all class for storing a log line record and handing it over
+ * to its sink once complete.
+ *
+ * @detailed The cornerstone of the logging library. This class takes contextual
+ * information about a log call along with the sink (usually a Logger) that
+ * created it, and provides a way to stream message data to the log. When its
+ * time comes (at the end of the logging command, if used properly), it'll
+ * commit its Line to the sink, which decides how and when to print it.
+ *
+ * @remark A Sink is anything with a `void commit(Line &)` member. It may
+ * consume (move out of) the Line.
+ */
+template <typename Sink> class Record {
+  /**
+   * @brief A reference to the sink to commit the Line to once the record is
+   * completed.
+   */
+  Sink &sink;
 
   /**
    * @brief The Line containing all the information about the log line: context,
@@ -208,92 +385,190 @@ class Record {
   bool hash_enabled;
 
   /**
-   * @brief The Filter to be applied to the Record before printing out.
-   *
-   * @remark Because it's dynamically configurable the type must be fixed (so
-   * it's a fixed type alias instead of a concept template argument, but
-   * generally filters won't need the full capture capability of lambdas.
+   * @brief The thread's MessageStream once this record has used it, so that
+   * its formatting state is only reset once per record.
    */
-  Filter filter;
+  MessageStream *adapter;
 
   /**
-   * @brief A reference to the mutex for the logger for synchronization.
+   * @brief The record's own MessageStream, when the thread's was lent to
+   * another record as this one needed it: logging from the operator<< of a
+   * type streamed into a record mustn't touch that record's stream.
    */
-  std::mutex &logging_mutex;
+  std::unique_ptr<MessageStream> nested;
 
   /**
-   * @brief A **pointer** to the format string for traversal when printing.
+   * @return The MessageStream writing into this record's message.
    */
-  const char *format = fmt;
+  std::ostream &stream() {
+    if (adapter == nullptr) {
+      bool &lent = message_stream_lent();
+      if (!lent) {
+        lent = true;
+        adapter = &message_stream();
+        adapter->reset();
+      } else {
+        nested.reset(new MessageStream());
+        adapter = nested.get();
+      }
+    }
+    return adapter->into(line.message);
+  }
 
-  // adapted from cppreference parameter_pack page
   /**
-   * @brief Prints the properties in the format list according to the format
-   * string.
-   *
-   * @remark The real workhorse of this class. Using variadic templates and
-   * clever matching, print_fmt prints all of the format string up until a `%`
-   * symbol, at which it looks at the first Prop argument and executes it on the
-   * local buffer and the Line info. It does a recursive call with the remaining
-   * arguments to format the rest of the string. The first definition is
-   * analogous to the base case and the second the inductive case.
-   *
-   * @param head The next Prop argument to print.
-   * @param tail The remaining Prop arguments.
+   * @return Whether characters can be appended to the message directly,
+   * i.e. no field width is pending from a manipulator like std::setw.
    */
-  inline void print_fmt() { stream << format; }
+  bool plain() const { return adapter == nullptr || adapter->width() == 0; }
 
-  template <typename T, typename... Targs>
-  inline void print_fmt(T head, Targs... tail) {
-    while (*format != '\0') {
-      if (*(format++) == '%') {
-        head(stream, line);
-        print_fmt(tail...);
-        return;
-      }
-      stream << *(format - 1);
+  /**
+   * @return Whether numbers can be formatted without the MessageStream, i.e.
+   * no manipulator has changed how it would format them.
+   */
+  bool plain_numbers() const {
+    return adapter == nullptr ||
+           (adapter->flags() == (std::ios_base::dec | std::ios_base::skipws) &&
+            adapter->precision() == 6 && adapter->width() == 0);
+  }
+
+  /**
+   * @brief Formats a number straight into the message with std::to_chars;
+   * floating point numbers like printf's %g, as ostreams do.
+   */
+  template <typename T> void append_number(T v) {
+    constexpr std::size_t room = 32;
+    char *p = line.message.reserve(room);
+    std::to_chars_result r;
+    if constexpr (std::is_floating_point<T>::value)
+      r = std::to_chars(p, p + room, v, std::chars_format::general, 6);
+    else
+      r = std::to_chars(p, p + room, v);
+    line.message.commit(r.ptr - p);
+  }
+
+  /**
+   * @brief Formats a pointer as ostreams do: in hexadecimal with a 0x prefix,
+   * except for the null pointer which is just 0.
+   */
+  void append_pointer(std::uintptr_t v) {
+    if (v == 0)
+      return line.message.push_back('0');
+    constexpr std::size_t room = 2 + 2 * sizeof(v);
+    char *p = line.message.reserve(room);
+    p[0] = '0';
+    p[1] = 'x';
+    line.message.commit(std::to_chars(p + 2, p + room, v, 16).ptr - p);
+  }
+
+  /**
+   * @brief Appends an object to the message: strings, characters and numbers
+   * directly, anything else through the MessageStream. Numbers come out as an
+   * ostream with default formatting would print them, so manipulators that
+   * change that send them through the MessageStream too.
+   */
+  template <typename T> void append(const T &s) {
+    if constexpr (is_plain_number<T>::value) {
+      if (plain_numbers())
+        return append_number(s);
+    } else if constexpr (std::is_same<T, float>::value) {
+      if (plain_numbers())
+        return append_number(double(s));
+    } else if constexpr (std::is_same<T, bool>::value) {
+      if (plain_numbers())
+        return line.message.push_back(s ? '1' : '0');
+    } else if constexpr (is_plain_pointer<T>::value) {
+      if (plain_numbers())
+        return append_pointer(reinterpret_cast<std::uintptr_t>(s));
+    } else if constexpr (is_plain_char<T>::value) {
+      if (plain())
+        return line.message.push_back(char(s));
+    } else if constexpr (std::is_same<T, std::string>::value ||
+                         std::is_same<T, std::string_view>::value ||
+                         (std::is_array<T>::value &&
+                          std::is_same<typename std::remove_extent<T>::type,
+                                       char>::value)) {
+      if (plain())
+        return line.message.append(std::string_view(s));
+    } else if constexpr (std::is_same<T, const char *>::value ||
+                         std::is_same<T, char *>::value) {
+      if (plain() && s != nullptr)
+        return line.message.append(std::string_view(s));
     }
+    stream() << s;
   }
 
 public:
   /**
    * @brief Constructs a Record from relevant information.
    *
-   * @param s the destination to which to stream the record output.
+   * @param s the sink to which to commit the record.
    * @param input_info the contextual information about the log command.
-   * @param mutex the lock to control synchronization to the output stream.
-   * @param filter the post-processing filter for the log message.
    */
-  Record(Stream &s, ContextInfo input_info, std::mutex &mutex, Filter filter)
-      : stream(s), line(input_info), hash_enabled(true), filter(filter),
-        logging_mutex(mutex) {}
+  Record(Sink &s, ContextInfo input_info)
+      : sink(s), line(input_info), hash_enabled(true), adapter(nullptr) {
+    line.hash = input_info.site;
+  }
 
   /**
-   * @brief Locks the stream mutex and dumps the local buffer to the stream,
-   * after applying the final filter. In the class's standard usage, Records
-   * live only as rvalues without any names, so that they're destroyed at the
-   * end of the log statement.
+   * @brief Commits the Line to the sink. In the class's standard usage,
+   * Records live only as rvalues without any names, so that they're destroyed
+   * at the end of the log statement.
    */
   ~Record() {
-    std::lock_guard<std::mutex> lock(logging_mutex);
-    if ((*filter)(line)) {
-      print_fmt(props...);
-      stream << std::endl;
-    }
+    if (adapter != nullptr && nested == nullptr)
+      message_stream_lent() = false;
+    sink.commit(line);
   }
 
   /**
-   * @brief Stream an object to the local buffer. Accepts anything a
-   * stringstream would accept. Also modifies the hash identifier if the option
-   * is enabled.
+   * @brief Stream an object to the local buffer. Accepts anything an ostream
+   * would accept, manipulators included. Also modifies the hash identifier if
+   * the option is enabled.
    *
    * @param s The object to be streamed.
    * @return The same record, for stringing stream commands.
    */
   template <Streamable S> Record &operator<<(const S &s) {
     if (hash_enabled)
-      line.hash ^= intptr_t(&s);
-    line.message << s;
+      line.hash = hash_piece(line.hash, s);
+    append(s);
+    return *this;
+  }
+
+  /**
+   * @brief Stream a character array that can be written to, as any object,
+   * but hashed by its type rather than its text, see hash_piece.
+   */
+  template <std::size_t N> Record &operator<<(char (&s)[N]) {
+    if (hash_enabled)
+      line.hash = hash_piece(line.hash, s);
+    append(s);
+    return *this;
+  }
+
+  /**
+   * @brief Adds a typed field to the record instead of to its message text.
+   * Values that aren't numbers or strings are formatted as the message would
+   * format them and kept as strings. The key and the type of the value
+   * influence the hash if the option is enabled.
+   *
+   * @param f The field, see kv().
+   * @return The same record, for stringing stream commands.
+   */
+  template <typename T> Record &operator<<(const KeyValue<T> &f) {
+    if (hash_enabled)
+      line.hash = mix(
+          mix(line.hash, fnv1a(f.key)),
+          std::integral_constant<std::uint64_t, type_id<T>()>::value);
+    if constexpr (Fields::storable<T>) {
+      line.fields.add(f.key, f.value);
+    } else {
+      // stream() sets up the MessageStream, which is then pointed elsewhere
+      LineBuffer text;
+      stream();
+      adapter->into(text) << f.value;
+      line.fields.add(f.key, text.view());
+    }
     return *this;
   }
 
@@ -314,8 +589,10 @@ public:
 };
 
 /**
- * @brief A record that eats and throws away objects streamed to it. Used for
- * compile-time filtering. Can also be used as a no-op streamer.
+ * @brief A record that eats and throws away objects streamed to it. Returned
+ * by log() for levels below the compile-time threshold, though the logging
+ * macros stop before calling log() for those, so that the streamed arguments
+ * are not even evaluated. Can also be used as a no-op streamer.
  */
 class NoRecord {
 public:
@@ -327,7 +604,7 @@ public:
  * Template-parameterized by format and logging threshold for compile-time
  * configuration.
  *
- * @remark As with the Record definition, Prop is a fixed type alias as auto
+ * @remark As with the Formatter definition, Prop is a fixed type alias as auto
  * template parameters aren't possible in GCC yet.
  *
  * @remark We tried to pinpoint a concept for Stream but failed because the only
@@ -338,11 +615,11 @@ public:
  */
 template <typename Stream, int threshold, const char *fmt,
           Prop<Stream>... props>
-class Logger {
+class Logger : public Leveled<threshold> {
 private:
   /**
    * @brief The lock associated with the logger, to prevent concurrent access to
-   * the stream. In the future, we hope to use a lock-free queue.
+   * the stream. See AsyncLogger in async.h for a lock-free alternative.
    */
   std::mutex logging_lock;
 
@@ -357,6 +634,89 @@ private:
    */
   Filter filter;
 
+  /**
+   * @brief The optional collapsing of repeated messages, in a table per
+   * logging thread.
+   */
+  DedupStage<ThreadDedups> dedup;
+
+  /**
+   * @brief The optional counters of what logging costs, see enable_metrics.
+   */
+  MetricsStage metering;
+
+  using steady = std::chrono::steady_clock;
+
+  /**
+   * @brief Takes the logging lock, timing the wait when counting.
+   */
+  std::unique_lock<std::mutex> lock_stream(Metrics *m) {
+    if (m == nullptr)
+      return std::unique_lock<std::mutex>(logging_lock);
+    m->enter();
+    steady::time_point start = steady::now();
+    std::unique_lock<std::mutex> lock(logging_lock);
+    m->waited(steady::now() - start);
+    return lock;
+  }
+
+  /**
+   * @brief Lets a RecordSink know a record ended, or flushes any other stream.
+   */
+  void end_record(const Line &line) {
+    if constexpr (RecordSink<Stream>)
+      record_ended(stream, line);
+    else
+      stream.flush();
+  }
+
+  /**
+   * @brief Applies the filter to a Line and writes it out.
+   *
+   * @details When the Stream is stageable, the filter and the Props run
+   * without the lock, formatting the line into the thread's Staging; the lock
+   * then covers a single write of the finished line. Other Streams are
+   * formatted to directly, under the lock, which then counts as I/O time.
+   */
+  void write(Line &line) {
+    Metrics *m = metering.get();
+    if constexpr (stageable<Stream>) {
+      if (!(*filter)(line)) {
+        if (m != nullptr)
+          m->filtered(line.info.level);
+        return;
+      }
+      Staging<Stream> &staged = staging<Stream>();
+      Stream &s = staged.begin();
+      Formatter<fmt, Stream, props...>::print(s, line);
+      s.put('\n');
+      auto lock = lock_stream(m);
+      steady::time_point start = m ? steady::now() : steady::time_point();
+      stream.write(staged.data(), staged.size());
+      end_record(line);
+      if (m != nullptr) {
+        m->wrote(line.info.level, staged.size(), steady::now() - start);
+        m->leave();
+      }
+    } else {
+      auto lock = lock_stream(m);
+      if ((*filter)(line)) {
+        steady::time_point start = m ? steady::now() : steady::time_point();
+        std::uint64_t bytes = print_counted(stream, m != nullptr, [&] {
+          Formatter<fmt, Stream, props...>::print(stream, line);
+          stream << '\n';
+        });
+        end_record(line);
+        if (m != nullptr)
+          m->wrote(line.info.level, bytes, steady::now() - start);
+      } else if (m != nullptr) {
+        m->filtered(line.info.level);
+      }
+      if (m != nullptr)
+        m->leave();
+    }
+  }
+
 public:
   /**
    * @brief Constructs a logger from a stream.
@@ -365,6 +725,14 @@ public:
    */
   Logger(Stream &s) : stream(s), filter([](Line &l) { return true; }){};
 
+  /**
+   * @brief Writes out the counts of collapsed messages still pending.
+   */
+  ~Logger() {
+    if (ThreadDedups *d = dedup.get())
+      d->drain([this](Line &l) { write(l); });
+  }
+
   /**
    * @brief Set the filter for the log.
    *
@@ -373,6 +741,92 @@ public:
    */
   void set_filter(Filter f) { filter = f; }
 
+  /**
+   * @brief Collapses copies of a message that follow it within a window into
+   * a "last message repeated N times" line, see Dedup. Each thread collapses
+   * the copies it logs, without waiting on the others, see ThreadDedups. Can
+   * be switched on once, also while logging.
+   *
+   * @param window How long after a message its copies are collapsed.
+   * @param slots The number of messages tracked at once; 1 collapses only
+   * consecutive copies.
+   */
+  void set_dedup(std::chrono::system_clock::duration window,
+                 std::size_t slots = 16) {
+    dedup.enable(window, slots);
+  }
+
+  /**
+   * @brief Counts what logging costs: the records written and filtered out by
+   * severity, the bytes written, the time spent waiting for the lock and
+   * writing under it, and the number of records doing either, see Metrics.
+   * Can be switched on once, also while logging; until then, the logger only
+   * pays for checking whether it is.
+   *
+   * @param every How often the logger writes a snapshot through itself, as a
+   * "logger metrics" record with the counts as fields, from the first log
+   * statement after each period; zero never to.
+   * @param level The severity of those records; INFO by default.
+   */
+  void enable_metrics(steady::duration every = steady::duration::zero(),
+                      int level = 20) {
+    if (metering.enable(every, level))
+      this->count_rejections(metering.get());
+  }
+
+  /**
+   * @return The counts so far, all zero while counting is off. Cheap enough
+   * to poll from any thread.
+   */
+  MetricsSnapshot metrics() const {
+    Metrics *m = metering.get();
+    return m != nullptr ? m->snapshot() : MetricsSnapshot();
+  }
+
+  /**
+   * @brief Writes a snapshot of the counts through the logger now, as
+   * enable_metrics does periodically. Does nothing while counting is off.
+   */
+  void report_metrics() {
+    Metrics *m = metering.get();
+    if (m == nullptr)
+      return;
+    Line line = metrics_record(m->snapshot(), m->level);
+    write(line);
+  }
+
+  /**
+   * @brief Writes out the counts of collapsed messages still pending, and
+   * flushes the stream.
+   */
+  void flush() {
+    if (ThreadDedups *d = dedup.get())
+      d->drain([this](Line &l) { write(l); });
+    std::lock_guard<std::mutex> lock(logging_lock);
+    stream.flush();
+  }
+
+  /**
+   * @brief Dumps a completed Line to the stream, after collapsing repeats and
+   * applying the final filter. Called by Record at the end of the log
+   * statement.
+   *
+   * @param line The completed line.
+   */
+  void commit(Line &line) {
+    if (ThreadDedups *d = dedup.get()) {
+      if (!d->admit(line, [this](Line &l) { write(l); })) {
+        if (Metrics *m = metering.get())
+          m->filtered(line.info.level);
+        return;
+      }
+    }
+    write(line);
+    Metrics *m = metering.get();
+    if (m != nullptr && m->due(steady::now()))
+      report_metrics();
+  }
+
   /**
    * @brief Constructs a logging record from contextual information when the
    * logging level exceeds the threshold of the logger.
@@ -386,8 +840,8 @@ public:
    */
   template <unsigned int N,
             typename std::enable_if<N >= threshold>::type * = nullptr>
-  Record<fmt, Stream, props...> log(ContextInfo info) {
-    return {stream, info, logging_lock, filter};
+  Record<Logger> log(ContextInfo info) {
+    return {*this, info};
   }
 
   /**
@@ -0,0 +1,345 @@
+/**
+ * Self-instrumentation of the loggers: what logging costs, counted with
+ * relaxed atomics sharded by thread, and read as a snapshot.
+ */
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <type_traits>
+
+#include "line.h"
+#include "threads.h"
+
+namespace logger {
+
+/**
+ * @brief The counts of a Metrics at one moment, summed over its shards.
+ */
+struct MetricsSnapshot {
+  // Records written and records filtered out, by severity: NOTSET, DEBUG,
+  // INFO, WARNING, ERROR and CRITICAL; levels between the named ones count
+  // with the one below. Records are filtered out by the runtime thresholds,
+  // the context filter, the filter and collapsing; statements below the
+  // compile-time threshold are compiled out and never counted.
+  std::array<std::uint64_t, 6> emitted{}, filtered{};
+
+  // The bytes of the records written.
+  std::uint64_t bytes = 0;
+
+  // The time spent waiting for the logger's lock, and writing records.
+  std::chrono::nanoseconds lock_wait{0}, io{0};
+
+  // The number of records queued for the writer thread of an AsyncLogger or
+  // MergingLogger, now and at most so far; 0 for the other loggers.
+  std::uint64_t depth = 0, peak_depth = 0;
+
+  // The number of records waiting for the lock of a Logger or being written
+  // under it, now and at most so far; 0 for the queued loggers.
+  std::uint64_t waiting = 0, peak_waiting = 0;
+
+  static std::size_t slot(int level) {
+    return std::min(std::max(level, 0) / 10, 5);
+  }
+
+  std::uint64_t records() const {
+    std::uint64_t n = 0;
+    for (auto c : emitted)
+      n += c;
+    return n;
+  }
+
+  std::uint64_t dropped() const {
+    std::uint64_t n = 0;
+    for (auto c : filtered)
+      n += c;
+    return n;
+  }
+
+  /**
+   * @brief Adds the snapshot to the fields of a record: the totals, then the
+   * records written by severity, for the severities logged at.
+   */
+  void add_to(Fields &f) const {
+    static const char *names[] = {"notset", "debug",   "info",
+                                  "warning", "error", "critical"};
+    f.add("records", records());
+    f.add("filtered", dropped());
+    f.add("bytes", bytes);
+    f.add("lock_wait_us", std::uint64_t(lock_wait.count() / 1000));
+    f.add("io_us", std::uint64_t(io.count() / 1000));
+    f.add("depth", depth);
+    f.add("peak_depth", peak_depth);
+    f.add("waiting", waiting);
+    f.add("peak_waiting", peak_waiting);
+    for (std::size_t i = 0; i < emitted.size(); ++i)
+      if (emitted[i] != 0)
+        f.add(names[i], emitted[i]);
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &o, const MetricsSnapshot &s) {
+  return o << "records=" << s.records() << " filtered=" << s.dropped()
+           << " bytes=" << s.bytes
+           << " lock_wait_us=" << s.lock_wait.count() / 1000
+           << " io_us=" << s.io.count() / 1000 << " depth=" << s.depth
+           << " peak_depth=" << s.peak_depth << " waiting=" << s.waiting
+           << " peak_waiting=" << s.peak_waiting;
+}
+
+/**
+ * @brief The counters of a logger.
+ *
+ * @detailed Every thread counts into one of a few shards, picked by its
+ * ordinal, each on cache lines of its own, with relaxed atomics; threads only
+ * share a shard once there are more of them than shards. The gauges are the
+ * counts shared by all threads, since a maximum can't be summed: waiting is
+ * taken next to the Logger's lock, which they share anyway, and the peak depth
+ * next to the queue. A snapshot sums the shards without stopping anyone, so
+ * its counts may be a record apart from each other.
+ */
+class Metrics {
+  struct alignas(64) Shard {
+    std::array<std::atomic<std::uint64_t>, 6> emitted{}, filtered{};
+    std::atomic<std::uint64_t> bytes{0}, lock_wait{0}, io{0};
+  };
+
+  static constexpr std::size_t shards = 16;
+  std::unique_ptr<Shard[]> shard{new Shard[shards]};
+
+  alignas(64) std::atomic<std::uint64_t> waiting{0};
+  std::atomic<std::uint64_t> peak_waiting{0}, peak_depth{0};
+
+  // How often the logger writes a snapshot through itself, and the steady
+  // time it is next due, in nanoseconds.
+  std::chrono::steady_clock::duration interval;
+  std::atomic<std::int64_t> next_due;
+
+  Shard &local() { return shard[thread_ordinal() % shards]; }
+
+  static void add(std::atomic<std::uint64_t> &c, std::uint64_t n) {
+    c.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static void raise(std::atomic<std::uint64_t> &peak, std::uint64_t v) {
+    for (std::uint64_t p = peak.load(std::memory_order_relaxed);
+         v > p && !peak.compare_exchange_weak(p, v, std::memory_order_relaxed);)
+      ;
+  }
+
+public:
+  // The severity at which the snapshots are written.
+  const int level;
+
+  /**
+   * @param every How often to write a snapshot through the logger, or zero
+   * never to.
+   * @param level The severity to write them at.
+   */
+  explicit Metrics(std::chrono::steady_clock::duration every =
+                       std::chrono::steady_clock::duration::zero(),
+                   int level = 20)
+      : interval(every),
+        next_due((std::chrono::steady_clock::now() + every)
+                     .time_since_epoch()
+                     .count()),
+        level(level) {}
+
+  /**
+   * @brief Counts a record entering the lock: waiting for it, then writing.
+   */
+  void enter() {
+    raise(peak_waiting, waiting.fetch_add(1, std::memory_order_relaxed) + 1);
+  }
+
+  /**
+   * @brief Counts a record leaving the lock.
+   */
+  void leave() { waiting.fetch_sub(1, std::memory_order_relaxed); }
+
+  /**
+   * @brief Records the depth of a queue just pushed to, for its peak.
+   */
+  void queued(std::uint64_t depth) { raise(peak_depth, depth); }
+
+  void waited(std::chrono::steady_clock::duration d) {
+    add(local().lock_wait, std::chrono::nanoseconds(d).count());
+  }
+
+  void wrote(int level, std::size_t bytes,
+             std::chrono::steady_clock::duration d) {
+    Shard &s = local();
+    add(s.emitted[MetricsSnapshot::slot(level)], 1);
+    add(s.bytes, bytes);
+    add(s.io, std::chrono::nanoseconds(d).count());
+  }
+
+  void filtered(int level) {
+    add(local().filtered[MetricsSnapshot::slot(level)], 1);
+  }
+
+  /**
+   * @return Whether a snapshot is due, true for a single caller per period.
+   */
+  bool due(std::chrono::steady_clock::time_point now) {
+    if (interval == std::chrono::steady_clock::duration::zero())
+      return false;
+    std::int64_t t = now.time_since_epoch().count();
+    std::int64_t due = next_due.load(std::memory_order_relaxed);
+    return t >= due &&
+           next_due.compare_exchange_strong(due, t + interval.count(),
+                                            std::memory_order_relaxed);
+  }
+
+  /**
+   * @return The counts so far, with the current depth of the logger's queue,
+   * if any; cheap enough to poll.
+   */
+  MetricsSnapshot snapshot(std::uint64_t depth = 0) const {
+    MetricsSnapshot s;
+    std::uint64_t wait = 0, io = 0;
+    for (std::size_t i = 0; i < shards; ++i) {
+      const Shard &x = shard[i];
+      for (std::size_t l = 0; l < s.emitted.size(); ++l) {
+        s.emitted[l] += x.emitted[l].load(std::memory_order_relaxed);
+        s.filtered[l] += x.filtered[l].load(std::memory_order_relaxed);
+      }
+      s.bytes += x.bytes.load(std::memory_order_relaxed);
+      wait += x.lock_wait.load(std::memory_order_relaxed);
+      io += x.io.load(std::memory_order_relaxed);
+    }
+    s.lock_wait = std::chrono::nanoseconds(wait);
+    s.io = std::chrono::nanoseconds(io);
+    s.depth = depth;
+    s.peak_depth = std::max(depth, peak_depth.load(std::memory_order_relaxed));
+    s.waiting = waiting.load(std::memory_order_relaxed);
+    s.peak_waiting = peak_waiting.load(std::memory_order_relaxed);
+    return s;
+  }
+};
+
+/**
+ * @return A "logger metrics" record with the counts of a snapshot as fields.
+ */
+inline Line metrics_record(const MetricsSnapshot &s, int level) {
+  Line line({__FILE__, __func__, __LINE__, level});
+  line.message.append("logger metrics");
+  s.add_to(line.fields);
+  return line;
+}
+
+/**
+ * @brief A streambuf that passes everything on to another one, counting the
+ * characters it took.
+ */
+class CountingStreambuf : public std::streambuf {
+  std::streambuf *to;
+
+protected:
+  int_type overflow(int_type c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+      return sync() == 0 ? traits_type::not_eof(c) : traits_type::eof();
+    int_type r = to->sputc(traits_type::to_char_type(c));
+    if (!traits_type::eq_int_type(r, traits_type::eof()))
+      ++count;
+    return r;
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    std::streamsize w = to->sputn(s, n);
+    count += w;
+    return w;
+  }
+
+  int sync() override { return to->pubsync(); }
+
+public:
+  std::uint64_t count = 0;
+
+  explicit CountingStreambuf(std::streambuf *to) : to(to) {}
+
+  std::streambuf *target() const { return to; }
+};
+
+/**
+ * @brief Formats a record straight to a stream, counting the characters it
+ * took when asked to: those of an ostream, whatever its buffer, on their way
+ * to it; the Stream's own position is of no use, since most sinks don't keep
+ * one.
+ *
+ * @param print Writes the record to the stream.
+ * @return The number of characters, 0 if not counting or the Stream isn't an
+ * ostream.
+ */
+template <typename Stream, typename Print>
+std::uint64_t print_counted(Stream &s, bool counting, Print &&print) {
+  if constexpr (std::is_base_of<std::ostream, Stream>::value) {
+    if (counting) {
+      struct Restore {
+        std::ostream &s;
+        CountingStreambuf counter;
+        // rdbuf() clears the state, which the stream keeps across the swap
+        explicit Restore(std::ostream &s) : s(s), counter(s.rdbuf()) {
+          std::ios_base::iostate state = s.rdstate();
+          s.rdbuf(&counter);
+          s.clear(state);
+        }
+        ~Restore() {
+          std::ios_base::iostate state = s.rdstate();
+          s.rdbuf(counter.target());
+          s.clear(state);
+        }
+      } restore(s);
+      print();
+      return restore.counter.count;
+    }
+  }
+  print();
+  return 0;
+}
+
+/**
+ * @brief The optional Metrics of a logger, switched on at most once, also
+ * while logging, as DedupStage does.
+ */
+class MetricsStage {
+  std::unique_ptr<Metrics> owned;
+  std::atomic<Metrics *> active;
+
+public:
+  MetricsStage() : active(nullptr) {}
+
+  /**
+   * @brief Switches counting on, unless it already is; safe to call from
+   * several threads at once.
+   *
+   * @return Whether this call switched it on.
+   */
+  bool enable(std::chrono::steady_clock::duration every, int level) {
+    if (active.load(std::memory_order_acquire) != nullptr)
+      return false;
+    // only the call that publishes its Metrics keeps it: another one may be in
+    // use already
+    std::unique_ptr<Metrics> made(new Metrics(every, level));
+    Metrics *none = nullptr;
+    if (!active.compare_exchange_strong(none, made.get(),
+                                        std::memory_order_acq_rel))
+      return false;
+    owned = std::move(made);
+    return true;
+  }
+
+  /**
+   * @return The Metrics, or nullptr while counting is off.
+   */
+  Metrics *get() const { return active.load(std::memory_order_acquire); }
+};
+}
+
+#endif /*__METRICS_H__*/
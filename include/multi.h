@@ -0,0 +1,298 @@
+/**
+ * A logger that fans every record out to several outputs, each with its own
+ * threshold, format and Props, all fixed at compile time.
+ */
+#ifndef __MULTI_H__
+#define __MULTI_H__
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#include "logger.h"
+
+namespace logger {
+
+/**
+ * @brief One output of a MultiLogger: a stream, the lowest level it takes, and
+ * the format and Props its lines are printed with.
+ *
+ * @remark The Props print to any ostream, so that the ones shared with other
+ * outputs can be printed once for all of them; the Stream must therefore be an
+ * ostream. A RecordSink, such as FdSink, is told where records end, as by
+ * Logger.
+ *
+ * @usage Output<std::ostream, WARNING, full_fmt, prop_date, ...>
+ */
+template <typename Stream, int threshold, const char *fmt,
+          Prop<std::ostream>... props>
+class Output {
+  static_assert(std::is_base_of<std::ostream, Stream>::value,
+                "an Output's stream must be an ostream");
+  static_assert(wildcards(fmt) == sizeof...(props),
+                "the format must have exactly one % per Prop");
+
+  template <typename... Outputs> friend class MultiLogger;
+
+  Stream &stream;
+  std::mutex lock;
+
+  static constexpr int level = threshold;
+  static constexpr std::size_t count = sizeof...(props);
+  static constexpr std::array<Prop<std::ostream>, sizeof...(props)> list = {
+      {props...}};
+
+  /**
+   * @brief Prints the I-th literal run of the format, as Formatter does.
+   */
+  template <std::size_t I> static void print_run(std::ostream &s) {
+    constexpr std::size_t begin = run_begin(fmt, I), end = run_end(fmt, I);
+    if constexpr (end > begin)
+      write_run(s, fmt + begin, end - begin);
+  }
+
+  /**
+   * @brief Writes a formatted line out.
+   */
+  void write(const Line &line, const char *data, std::size_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+    stream.write(data, size);
+    if constexpr (RecordSink<Stream>)
+      record_ended(stream, line);
+    else
+      stream.flush();
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> guard(lock);
+    stream.flush();
+  }
+
+public:
+  using stream_type = Stream;
+
+  explicit Output(Stream &s) : stream(s) {}
+};
+
+/**
+ * @brief The output of Props printed for one record, so that a Prop several
+ * outputs use is only evaluated once per record. There is one per thread and
+ * MultiLogger type.
+ *
+ * @param N The number of Props that can be kept.
+ */
+template <std::size_t N> class PropCache {
+  LineBuffer text;
+  MessageStream stream;
+  std::array<bool, N> ready;
+  std::array<std::uint32_t, N> begin, end;
+
+public:
+  /**
+   * @brief Forgets the output of the previous record.
+   */
+  void clear() {
+    ready.fill(false);
+    text.clear();
+  }
+
+  /**
+   * @brief Writes the output of a Prop to a stream, printing it first if this
+   * is the first time for this record.
+   *
+   * @param I The slot of the Prop.
+   */
+  template <std::size_t I>
+  void write(std::ostream &s, Prop<std::ostream> p, const Line &line) {
+    if (!ready[I]) {
+      stream.reset();
+      begin[I] = text.size();
+      p(stream.into(text), line);
+      end[I] = text.size();
+      ready[I] = true;
+    }
+    write_run(s, text.data() + begin[I], end[I] - begin[I]);
+  }
+};
+
+/**
+ * @brief A logger with the same interface as Logger that writes every record
+ * to several Outputs, each taking the records at or above its own threshold
+ * and printing them with its own format and Props.
+ *
+ * @detailed The threshold of the logger is the lowest of its outputs, so a log
+ * statement below every output's level compiles to nothing, as with Logger.
+ * Each output formats a line into the thread's Staging and writes it under its
+ * own lock. Props that appear more than once across the outputs, like the time
+ * or the thread, are printed once per record and copied into each line; the
+ * others are called directly.
+ *
+ * @remark The streams must outlive the logger.
+ *
+ * @usage MultiLogger<Output<std::ostream, WARNING, full_fmt, ...>,
+ *                    Output<FdSink, DEBUG, basic_fmt, prop_msg>>
+ *            my_logger(std::clog, file_sink);
+ */
+template <typename... Outputs>
+class MultiLogger : public Leveled<std::min({Outputs::level...})> {
+  static constexpr int threshold = std::min({Outputs::level...});
+  static constexpr std::size_t total = (Outputs::count + ...);
+
+  std::tuple<Outputs...> outputs;
+
+  /**
+   * @return The Props of all the outputs, one after the other.
+   */
+  static constexpr std::array<Prop<std::ostream>, total> all_props() {
+    std::array<Prop<std::ostream>, total> all{};
+    std::size_t n = 0;
+    auto append = [&all, &n](const auto &list) {
+      for (Prop<std::ostream> p : list)
+        all[n++] = p;
+    };
+    (append(Outputs::list), ...);
+    return all;
+  }
+
+  static constexpr std::array<Prop<std::ostream>, total> all = all_props();
+
+  /**
+   * @return The index of the first of the Props of the K-th output in all.
+   */
+  template <std::size_t K> static constexpr std::size_t offset() {
+    constexpr std::size_t counts[] = {Outputs::count...};
+    std::size_t n = 0;
+    for (std::size_t k = 0; k < K; ++k)
+      n += counts[k];
+    return n;
+  }
+
+  /**
+   * @return The index of the first occurrence of all[j].
+   */
+  static constexpr std::size_t first(std::size_t j) {
+    std::size_t i = 0;
+    while (all[i] != all[j])
+      ++i;
+    return i;
+  }
+
+  /**
+   * @return The number of occurrences of all[j].
+   */
+  static constexpr std::size_t uses(std::size_t j) {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < total; ++i)
+      n += all[i] == all[j];
+    return n;
+  }
+
+  /**
+   * @return The current thread's PropCache.
+   */
+  static PropCache<total> &cache() {
+    static thread_local PropCache<total> c;
+    return c;
+  }
+
+  /**
+   * @brief Prints the J-th Prop in all, from the cache if it is shared.
+   */
+  template <std::size_t J>
+  static void prop(std::ostream &s, const Line &line) {
+    if constexpr (uses(J) > 1)
+      cache().template write<first(J)>(s, all[J], line);
+    else
+      all[J](s, line);
+  }
+
+  /**
+   * @brief Interleaves the literal runs of the K-th output's format with its
+   * Props, as Formatter does.
+   */
+  template <std::size_t K, std::size_t... I>
+  static void print(std::ostream &s, const Line &line,
+                    std::index_sequence<I...>) {
+    using O = typename std::tuple_element<K, std::tuple<Outputs...>>::type;
+    ((O::template print_run<I>(s), prop<offset<K>() + I>(s, line)), ...);
+    O::template print_run<sizeof...(I)>(s);
+  }
+
+  /**
+   * @brief Formats a Line for the K-th output and writes it, if the output
+   * takes the Line's level.
+   */
+  template <std::size_t K> void write(const Line &line) {
+    auto &o = std::get<K>(outputs);
+    using O = typename std::remove_reference<decltype(o)>::type;
+    if (line.info.level < O::level)
+      return;
+    Staging<std::ostream> &staged = staging<std::ostream>();
+    std::ostream &s = staged.begin();
+    print<K>(s, line, std::make_index_sequence<O::count>());
+    s.put('\n');
+    o.write(line, staged.data(), staged.size());
+  }
+
+  template <std::size_t... K>
+  void write(const Line &line, std::index_sequence<K...>) {
+    cache().clear();
+    (write<K>(line), ...);
+  }
+
+public:
+  /**
+   * @brief Constructs a logger from the streams of its outputs, in order.
+   */
+  explicit MultiLogger(typename Outputs::stream_type &... streams)
+      : outputs(streams...) {}
+
+  /**
+   * @brief Flushes the streams of all the outputs.
+   */
+  void flush() {
+    std::apply([](auto &... o) { (o.flush(), ...); }, outputs);
+  }
+
+  /**
+   * @brief Writes a completed Line to every output that takes its level.
+   * Called by Record at the end of the log statement.
+   *
+   * @param line The completed line.
+   */
+  void commit(Line &line) {
+    write(line, std::index_sequence_for<Outputs...>());
+  }
+
+  /**
+   * @brief Constructs a logging record from contextual information when the
+   * logging level is at least the threshold of some output.
+   *
+   * @param N the level at which to log.
+   * @param info Contextual information about the log statement.
+   *
+   * @return A Record that can be streamed to.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N >= threshold>::type * = nullptr>
+  Record<MultiLogger> log(ContextInfo info) {
+    return {*this, info};
+  }
+
+  /**
+   * @brief For logging levels below the threshold of every output, this
+   * overload is called and does nothing.
+   *
+   * @return A NoRecord that does nothing when you stream to it.
+   */
+  template <unsigned int N,
+            typename std::enable_if<N<threshold>::type * = nullptr> NoRecord
+                log(ContextInfo info) {
+    return {};
+  }
+};
+}
+
+#endif /*__MULTI_H__*/
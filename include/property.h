@@ -4,6 +4,7 @@
 #ifndef __PROPERTY_H__
 #define __PROPERTY_H__
 
+#include <cstdint>
 #include <iostream>
 #include <regex>
 #include <set>
@@ -50,7 +51,7 @@ struct CodeContext {
   std::string func;
   std::string level;
   int line;
-  std::string hash;
+  std::uint64_t hash = 0;
 
   /**
    * @brief default constructs all the members
@@ -64,11 +65,10 @@ struct CodeContext {
    * @param b function name
    * @param c severity level
    * @param d line number
-   * @param e hash value of the log, typically xor of memory locations of
-   * records
+   * @param e hash identifier of the log statement, see logger::hash_piece
    */
   CodeContext(const std::string &a, const std::string &b, const std::string &c,
-              const int &d, const std::string &e)
+              const int &d, std::uint64_t e)
       : file(a), func(b), level(c), line(d), hash(e) {}
 
   /**
@@ -185,6 +185,20 @@ public:
   RunContext run;             /// Run Context of the log record
   std::string message;        /// message of the log record
   std::vector<float> numbers; /// numbers in the message of the log record
+  std::vector<std::pair<std::string, std::string>>
+      fields; /// structured fields of the log record, as key and value text
+
+  /**
+   * @brief Looks up a structured field of the record by name
+   * @param name key of the field
+   * @return the value of the field, or nullptr if the record has no such field
+   */
+  const std::string *field(const std::string &name) const {
+    for (auto &f : fields)
+      if (f.first == name)
+        return &f.second;
+    return nullptr;
+  }
 
   /**
    * @brief State of a log record is something that which you can use to 'Group
@@ -233,7 +247,7 @@ template <> void read_prop<LINE>(LogRecord &p, const std::string &s) {
 }
 
 template <> void read_prop<HASH>(LogRecord &p, const std::string &s) {
-  std::istringstream(s) >> p.code.hash;
+  std::istringstream(s) >> std::hex >> p.code.hash;
 }
 
 template <> void read_prop<DATE>(LogRecord &p, const std::string &s) {
@@ -262,6 +276,28 @@ void read_props(LogRecord &p, PS ps) {
   read_props<PS, I...>(p, ps);
 }
 
+/**
+ * @brief reads a property given by its name in a structured log, as written
+ * by logger::JsonLogger or logger::LogfmtLogger, into a log record p; names
+ * that aren't properties are kept as fields of the record
+ *
+ * @param p log record to read into
+ * @param key name of the property or field
+ * @param value text of the value
+ */
+void read_named(LogRecord &p, const std::string &key, std::string value) {
+  if (key == "file") read_prop<FILE>(p, value);
+  else if (key == "func") read_prop<FUNC>(p, value);
+  else if (key == "level") read_prop<LEVEL>(p, value);
+  else if (key == "line") read_prop<LINE>(p, value);
+  else if (key == "hash") read_prop<HASH>(p, value);
+  else if (key == "date") read_prop<DATE>(p, value);
+  else if (key == "time") read_prop<TIME>(p, value);
+  else if (key == "thread") read_prop<THREAD>(p, value);
+  else if (key == "msg") p.message = std::move(value);
+  else p.fields.emplace_back(key, std::move(value));
+}
+
 /**
  * @brief reads all the properties into a log record p from a string s
  * @details reads only the properties on which the function is templates
@@ -301,6 +337,9 @@ template <> decltype(auto) get_prop<LEVEL>(const LogRecord &rec) {
 template <> decltype(auto) get_prop<LINE>(const LogRecord &rec) {
   return rec.code.line;
 }
+template <> decltype(auto) get_prop<HASH>(const LogRecord &rec) {
+  return rec.code.hash;
+}
 template <> decltype(auto) get_prop<DATE>(const LogRecord &rec) {
   return rec.run.date;
 }
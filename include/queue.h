@@ -0,0 +1,280 @@
+/**
+ * Lock-free queues used to hand log records over to background writers.
+ */
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace logger {
+
+/**
+ * @brief The assumed size of a cache line, used to keep the producer and
+ * consumer sides of a queue from sharing one.
+ */
+constexpr std::size_t cache_line = 64;
+
+/**
+ * @brief Rounds a capacity up to the next power of two, so that positions can
+ * be wrapped with a mask.
+ */
+inline std::size_t round_up(std::size_t n) {
+  std::size_t p = 2;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+/**
+ * @brief A bounded, lock-free, multi-producer single-consumer queue.
+ *
+ * @detailed Based on Dmitry Vyukov's bounded queue: every cell carries a
+ * sequence number that tells producers and the consumer whose turn it is.
+ * Producers claim a slot with a single compare-and-swap on the enqueue
+ * position, move their value in, and publish it by bumping the cell's sequence
+ * number. The consumer side needs no atomic read-modify-write at all since
+ * there is only one consumer.
+ *
+ * @remark T must be default constructible and move assignable; cells are
+ * allocated once, up front.
+ */
+template <typename T> class MPSCQueue {
+  /**
+   * @brief A slot of the ring: the value and the sequence number guarding it.
+   */
+  struct alignas(cache_line) Cell {
+    std::atomic<std::size_t> seq;
+    T value;
+  };
+
+  /**
+   * @brief The ring of cells and the mask to wrap positions into it.
+   */
+  std::unique_ptr<Cell[]> cells;
+  const std::size_t mask;
+
+  /**
+   * @brief The next position to be claimed by a producer.
+   */
+  alignas(cache_line) std::atomic<std::size_t> head;
+
+  /**
+   * @brief The next position to be consumed. Only written by the consumer, but
+   * atomic so that other threads can ask how far it has come.
+   */
+  alignas(cache_line) std::atomic<std::size_t> tail;
+
+public:
+  /**
+   * @brief Constructs an empty queue.
+   *
+   * @param capacity The minimum number of elements the queue can hold; rounded
+   * up to a power of two.
+   */
+  explicit MPSCQueue(std::size_t capacity)
+      : cells(new Cell[round_up(capacity)]), mask(round_up(capacity) - 1),
+        head(0), tail(0) {
+    for (std::size_t i = 0; i <= mask; ++i)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Tries to push a value to the queue. Safe to call from any number of
+   * threads concurrently.
+   *
+   * @param v The value to move into the queue. Left untouched on failure.
+   * @return false if the queue is full.
+   */
+  bool try_push(T &&v) {
+    std::size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &c = cells[pos & mask];
+      std::size_t seq = c.seq.load(std::memory_order_acquire);
+      std::intptr_t dif = std::intptr_t(seq) - std::intptr_t(pos);
+      if (dif == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          c.value = std::move(v);
+          c.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Tries to pop the oldest value off the queue. Must only be called
+   * from the single consumer thread.
+   *
+   * @param v Where to move the value to.
+   * @return false if the queue is empty, or the oldest slot is claimed but not
+   * yet published.
+   */
+  bool try_pop(T &v) {
+    std::size_t pos = tail.load(std::memory_order_relaxed);
+    Cell &c = cells[pos & mask];
+    std::size_t seq = c.seq.load(std::memory_order_acquire);
+    if (std::intptr_t(seq) - std::intptr_t(pos + 1) < 0)
+      return false;
+    v = std::move(c.value);
+    c.seq.store(pos + mask + 1, std::memory_order_release);
+    tail.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Calls a function with each published value still in the queue,
+   * oldest first, without popping them: for the crash handler, once the
+   * consumer has stopped.
+   */
+  template <typename F> void for_each_pending(F &&f) const {
+    std::size_t end = head.load(std::memory_order_acquire);
+    for (std::size_t pos = tail.load(std::memory_order_acquire); pos != end;
+         ++pos) {
+      const Cell &c = cells[pos & mask];
+      if (c.seq.load(std::memory_order_acquire) == pos + 1)
+        f(c.value);
+    }
+  }
+
+  /**
+   * @return The number of pushes claimed so far, published or not.
+   */
+  std::size_t claimed() const { return head.load(std::memory_order_acquire); }
+
+  /**
+   * @return The number of pops so far.
+   */
+  std::size_t consumed() const { return tail.load(std::memory_order_acquire); }
+
+  /**
+   * @return The number of elements in the queue, approximately if producers or
+   * the consumer are active.
+   */
+  std::size_t size() const {
+    std::size_t t = consumed();
+    return claimed() - t;
+  }
+
+  /**
+   * @return The number of elements the queue can hold.
+   */
+  std::size_t capacity() const { return mask + 1; }
+};
+
+/**
+ * @brief A bounded, wait-free, single-producer single-consumer ring buffer.
+ *
+ * @detailed The producer and the consumer each own one position and keep a
+ * cached copy of the other's, on their own cache line, so that they only touch
+ * shared memory when the ring looks full (producer) or empty (consumer).
+ *
+ * @remark T must be default constructible and move assignable.
+ */
+template <typename T> class SPSCRing {
+  /**
+   * @brief The slots of the ring and the mask to wrap positions into it.
+   */
+  std::unique_ptr<T[]> slots;
+  const std::size_t mask;
+
+  /**
+   * @brief The next position to write, and the producer's last look at tail.
+   */
+  alignas(cache_line) std::atomic<std::size_t> head;
+  std::size_t tail_cache;
+
+  /**
+   * @brief The next position to read, and the consumer's last look at head.
+   */
+  alignas(cache_line) std::atomic<std::size_t> tail;
+  std::size_t head_cache;
+
+public:
+  /**
+   * @brief Constructs an empty ring.
+   *
+   * @param capacity The minimum number of elements the ring can hold; rounded
+   * up to a power of two.
+   */
+  explicit SPSCRing(std::size_t capacity)
+      : slots(new T[round_up(capacity)]), mask(round_up(capacity) - 1),
+        head(0), tail_cache(0), tail(0), head_cache(0) {}
+
+  /**
+   * @brief Tries to push a value. Must only be called by the producer.
+   *
+   * @param v The value to move into the ring. Left untouched on failure.
+   * @return false if the ring is full.
+   */
+  bool try_push(T &&v) {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail_cache > mask) {
+      tail_cache = tail.load(std::memory_order_acquire);
+      if (h - tail_cache > mask)
+        return false;
+    }
+    slots[h & mask] = std::move(v);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Peeks at the oldest value. Must only be called by the consumer.
+   *
+   * @return A pointer to the oldest value, or nullptr if the ring is empty.
+   */
+  T *front() {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head_cache) {
+      head_cache = head.load(std::memory_order_acquire);
+      if (t == head_cache)
+        return nullptr;
+    }
+    return &slots[t & mask];
+  }
+
+  /**
+   * @brief Releases the oldest value, which front() must have returned. Must
+   * only be called by the consumer.
+   */
+  void pop() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  /**
+   * @brief Calls a function with each value in the ring, oldest first,
+   * without popping them: for the crash handler, once the consumer has
+   * stopped.
+   */
+  template <typename F> void for_each_pending(F &&f) const {
+    std::size_t end = head.load(std::memory_order_acquire);
+    for (std::size_t t = tail.load(std::memory_order_acquire); t != end; ++t)
+      f(slots[t & mask]);
+  }
+
+  /**
+   * @return The number of elements in the ring, approximately if the producer
+   * or the consumer are active.
+   */
+  std::size_t size() const {
+    std::size_t t = tail.load(std::memory_order_acquire);
+    return head.load(std::memory_order_acquire) - t;
+  }
+
+  /**
+   * @return The number of elements the ring can hold.
+   */
+  std::size_t capacity() const { return mask + 1; }
+};
+}
+
+#endif /*__QUEUE_H__*/
@@ -0,0 +1,330 @@
+/**
+ * A file sink that rolls its file over by size or by time, keeps a bounded
+ * number of old files, and optionally compresses them in the background.
+ *
+ * Compression uses zlib: link with -lz.
+ */
+#ifndef __ROTATING_H__
+#define __ROTATING_H__
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "sink.h"
+
+namespace logger {
+
+/**
+ * @brief When a RotatingSink rolls its file over, and what it does with the
+ * files it rolled over.
+ */
+struct RotationPolicy {
+  // The size from which the file is rolled over, at the end of a record.
+  std::uint64_t max_size = 64 << 20;
+
+  // The wall-clock interval at which the file is rolled over, counted from the
+  // epoch, so a day rolls over at midnight UTC; max for never.
+  std::chrono::milliseconds interval = std::chrono::milliseconds::max();
+
+  // The number of rolled-over files kept; older ones are deleted.
+  std::size_t keep = 8;
+
+  // Whether to reserve max_size bytes on disk for each file up front.
+  bool preallocate = true;
+
+  // Whether to gzip the rolled-over files in the background.
+  bool compress = false;
+};
+
+/**
+ * @brief A buffered file sink, like FdSink, that rolls its file over. The file
+ * at the path is always the current one; rolled-over files are renamed to
+ * path.1, path.2 and so on, the highest number being the most recent, and
+ * gain a .gz suffix once compressed.
+ *
+ * @detailed Loggers call end_record() after each record, which flushes as in
+ * FdSink and then rolls the file over if it reached the policy's size or its
+ * interval ended; records are never split between files. The rollover only
+ * flushes the buffer, renames the current file and swaps in the next one,
+ * which a background thread has already created (as path.next) and
+ * preallocated. The same thread deletes the files beyond the policy's count and
+ * compresses the rest, so that a logger waits on none of that.
+ *
+ * @remark Only one sink should write to a path at a time. Preallocation uses
+ * fallocate with FALLOC_FL_KEEP_SIZE, so the reserved space doesn't show in the
+ * size of the file; it is skipped where the filesystem doesn't support it. A
+ * file is truncated to its size once the sink is done with it, which gives
+ * back whatever it didn't use of the reservation.
+ *
+ * @usage RotatingSink sink("app.log", {16 << 20}); FullLogger<RotatingSink>
+ * logger(sink);
+ */
+class RotatingSink : public FdSink {
+  const std::string path;
+  const RotationPolicy rotation;
+
+  // The size of the file when it was opened, the number of characters written
+  // to it up to the end of the last record, and the number of the last file
+  // rolled over.
+  std::uint64_t base;
+  std::uint64_t record_end = 0;
+  std::uint64_t sequence;
+
+  // When the current interval ends.
+  std::chrono::system_clock::time_point deadline;
+
+  // The state shared with the background thread, under lock: the next file,
+  // once it has been created, the files to compress, and whether there's
+  // anything to do.
+  std::mutex lock;
+  std::condition_variable wake;
+  int spare = -1;
+  bool want_spare = true, prune = false, stopping = false;
+  std::vector<std::string> closed;
+  std::thread housekeeper;
+
+  static constexpr int open_flags =
+      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+
+  /**
+   * @return The descriptor of a file opened for appending, preallocated if the
+   * policy says so.
+   */
+  static int open_file(const std::string &name, const RotationPolicy &r,
+                       int extra = 0) {
+    int fd = ::open(name.c_str(), open_flags | extra, 0644);
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (fd >= 0 && r.preallocate)
+      ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, r.max_size);
+#endif
+    return fd;
+  }
+
+  /**
+   * @return The number of a rolled-over file from its name, or 0 if the name
+   * isn't one of this sink's.
+   */
+  std::uint64_t number(const std::string &name) const {
+    std::string prefix = std::filesystem::path(path).filename().string() + ".";
+    if (name.compare(0, prefix.size(), prefix) != 0)
+      return 0;
+    std::uint64_t n = 0;
+    std::size_t i = prefix.size();
+    for (; i < name.size() && name[i] >= '0' && name[i] <= '9'; ++i)
+      n = n * 10 + (name[i] - '0');
+    bool rest =
+        i == name.size() || name.compare(i, std::string::npos, ".gz") == 0;
+    return i > prefix.size() && rest ? n : 0;
+  }
+
+  /**
+   * @return The rolled-over files, oldest first.
+   */
+  std::vector<std::pair<std::uint64_t, std::string>> segments() const {
+    std::vector<std::pair<std::uint64_t, std::string>> found;
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    std::error_code e;
+    for (auto &entry : std::filesystem::directory_iterator(
+             dir.empty() ? "." : dir, e)) {
+      std::string name = entry.path().filename().string();
+      if (std::uint64_t n = number(name))
+        found.emplace_back(n, entry.path().string());
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+  }
+
+  /**
+   * @brief Gzips a rolled-over file next to it and deletes the original.
+   */
+  static void compress(const std::string &name) {
+    int in = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+      return;
+    std::string out = name + ".gz", partial = out + ".tmp";
+    gzFile gz = gzopen(partial.c_str(), "wb");
+    bool ok = gz != nullptr;
+    char chunk[1 << 16];
+    for (ssize_t n; ok && (n = ::read(in, chunk, sizeof(chunk))) != 0;)
+      ok = n > 0 ? gzwrite(gz, chunk, unsigned(n)) == n : errno == EINTR;
+    ::close(in);
+    if (gz != nullptr)
+      ok = gzclose(gz) == Z_OK && ok;
+    if (ok && std::rename(partial.c_str(), out.c_str()) == 0)
+      std::remove(name.c_str());
+    else
+      std::remove(partial.c_str());
+  }
+
+  /**
+   * @brief The background thread: creates the next file, compresses the
+   * rolled-over files and deletes the oldest ones, whenever asked to.
+   */
+  void housekeep() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      wake.wait(guard, [this] {
+        return stopping || want_spare || prune || !closed.empty();
+      });
+      // a rollover may have fallen back on a file of its own while the last
+      // one was being created, which then remains the next one
+      if (want_spare && spare < 0 && !stopping) {
+        guard.unlock();
+        int fd = open_file(path + ".next", rotation, O_TRUNC);
+        guard.lock();
+        spare = fd;
+      }
+      want_spare = false;
+      std::vector<std::string> work;
+      work.swap(closed);
+      bool pruning = prune;
+      prune = false;
+      if (work.empty() && !pruning && stopping)
+        return;
+      guard.unlock();
+      for (auto &name : work)
+        compress(name);
+      if (pruning) {
+        auto found = segments();
+        for (std::size_t i = 0; i + rotation.keep < found.size(); ++i)
+          std::remove(found[i].second.c_str());
+      }
+      guard.lock();
+    }
+  }
+
+  /**
+   * @return When the interval containing a moment ends.
+   */
+  std::chrono::system_clock::time_point interval_end(
+      std::chrono::system_clock::time_point t) const {
+    if (rotation.interval == std::chrono::milliseconds::max())
+      return std::chrono::system_clock::time_point::max();
+    auto since = std::chrono::duration_cast<std::chrono::milliseconds>(
+        t.time_since_epoch());
+    return std::chrono::system_clock::time_point(
+        (since / rotation.interval + 1) * rotation.interval);
+  }
+
+  /**
+   * @brief Releases the space reserved past the end of a file the sink is done
+   * with; truncating to the same size frees it where punching a hole doesn't.
+   */
+  void release(int fd) const {
+    struct stat st;
+    if (rotation.preallocate && fd >= 0 && ::fstat(fd, &st) == 0)
+      while (::ftruncate(fd, st.st_size) < 0 && errno == EINTR) {
+      }
+  }
+
+  /**
+   * @brief Renames the current file and swaps in the next one.
+   */
+  void rotate() {
+    int next;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      next = spare;
+      spare = -1;
+    }
+    // the background thread may still be creating path.next
+    std::string next_name = path + (next < 0 ? ".new" : ".next");
+    if (next < 0)
+      next = open_file(next_name, rotation, O_TRUNC);
+    std::string done = path + "." + std::to_string(++sequence);
+    int old = buf.swap(-1);
+    std::rename(path.c_str(), done.c_str());
+    std::rename(next_name.c_str(), path.c_str());
+    buf.swap(next);
+    release(old);
+    ::close(old);
+    if (next < 0)
+      setstate(std::ios_base::badbit);
+    base = 0;
+    deadline = interval_end(std::chrono::system_clock::now());
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      want_spare = prune = true;
+      if (rotation.compress)
+        closed.push_back(done);
+    }
+    wake.notify_one();
+  }
+
+public:
+  /**
+   * @brief Constructs a sink appending to a file, created if needed. Numbers
+   * rolled-over files after those already next to it.
+   */
+  explicit RotatingSink(const std::string &p,
+                        RotationPolicy r = RotationPolicy(),
+                        FlushPolicy f = FlushPolicy())
+      : FdSink(open_file(p, r), f), path(p), rotation(r), base(0),
+        sequence(0), deadline(interval_end(std::chrono::system_clock::now())) {
+    owned = true;
+    struct stat st;
+    if (::fstat(descriptor(), &st) == 0)
+      base = st.st_size;
+    auto found = segments();
+    if (!found.empty())
+      sequence = found.back().first;
+    housekeeper = std::thread([this] { housekeep(); });
+  }
+
+  /**
+   * @brief Flushes, then waits for the background thread to finish the
+   * compressions it was given and removes the next file it prepared. The
+   * current file gives back the rest of its reservation.
+   */
+  ~RotatingSink() {
+    flush();
+    release(descriptor());
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_one();
+    housekeeper.join();
+    if (spare >= 0) {
+      ::close(spare);
+      std::remove((path + ".next").c_str());
+    }
+  }
+
+  /**
+   * @brief Called by the loggers after each record. If the interval ended, the
+   * file is rolled over first and the record moved to the next file, unless it
+   * no longer fits in the buffer. Then the record is flushed if the flush
+   * policy says so, and the file rolled over if it reached the policy's size.
+   *
+   * @param level The severity of the record.
+   */
+  void end_record(int level) {
+    if (deadline != std::chrono::system_clock::time_point::max() &&
+        std::chrono::system_clock::now() >= deadline) {
+      LineBuffer record;
+      buf.take_back(buf.written() - record_end, record);
+      rotate();
+      write(record.data(), record.size());
+    }
+    FdSink::end_record(level);
+    if (base + buf.written() >= rotation.max_size)
+      rotate();
+    record_end = buf.written();
+  }
+};
+}
+
+#endif /*__ROTATING_H__*/
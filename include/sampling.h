@@ -0,0 +1,167 @@
+/**
+ * Per-call-site sampling and rate limiting of log statements, used by the
+ * LOG_EVERY_N, LOG_FIRST_N, LOG_EVERY_T and LOG_RATE macros in logconfig.h.
+ * Each statement keeps its own sampler in a static; all of them are lock-free.
+ */
+#ifndef __SAMPLING_H__
+#define __SAMPLING_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+namespace logger {
+
+/**
+ * @return The number of calls the last sampler to let a call through on this
+ * thread suppressed before it.
+ */
+inline std::uint64_t &suppressed_count() {
+  static thread_local std::uint64_t count = 0;
+  return count;
+}
+
+/**
+ * @brief A note of how many calls of a statement were suppressed since its
+ * last record, printed as "[suppressed N] " when there were any.
+ */
+struct Suppressed {
+  std::uint64_t count;
+};
+
+inline std::ostream &operator<<(std::ostream &o, const Suppressed &s) {
+  if (s.count != 0)
+    o << "[suppressed " << s.count << "] ";
+  return o;
+}
+
+/**
+ * @return The note for the record a sampler just let through, taking it.
+ */
+inline Suppressed suppressed() {
+  Suppressed s{suppressed_count()};
+  suppressed_count() = 0;
+  return s;
+}
+
+namespace sampling {
+
+/**
+ * @return The monotonic time in nanoseconds.
+ */
+inline std::int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @return A duration in nanoseconds, saturated at about a century so that it
+ * can be added to a time without overflowing.
+ */
+inline std::int64_t to_ns(double seconds) {
+  constexpr double most = 3e18;
+  double ns = seconds * 1e9;
+  return std::int64_t(ns < most ? ns : most);
+}
+
+/**
+ * @brief Lets through the 1st, (n+1)th, (2n+1)th... call.
+ */
+class EveryN {
+  std::atomic<std::uint64_t> calls{0};
+
+public:
+  bool admit(std::uint64_t n) {
+    std::uint64_t c = calls.fetch_add(1, std::memory_order_relaxed);
+    if (n > 1 && c % n != 0)
+      return false;
+    suppressed_count() = c == 0 || n <= 1 ? 0 : n - 1;
+    return true;
+  }
+};
+
+/**
+ * @brief Lets through the first n calls only.
+ */
+class FirstN {
+  std::atomic<std::uint64_t> calls{0};
+
+public:
+  bool admit(std::uint64_t n) {
+    // stop counting once past n, so the counter stays unshared
+    if (calls.load(std::memory_order_relaxed) >= n)
+      return false;
+    if (calls.fetch_add(1, std::memory_order_relaxed) >= n)
+      return false;
+    suppressed_count() = 0;
+    return true;
+  }
+};
+
+/**
+ * @brief Lets through at most one call per period, the first one after the
+ * period has passed.
+ */
+class EveryT {
+  std::atomic<std::int64_t> next{0};
+  std::atomic<std::uint64_t> skipped{0};
+
+public:
+  bool admit(double seconds) {
+    std::int64_t now = now_ns(), due = next.load(std::memory_order_relaxed);
+    if (now < due ||
+        !next.compare_exchange_strong(due, now + to_ns(seconds),
+                                      std::memory_order_relaxed)) {
+      skipped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    suppressed_count() = skipped.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+};
+
+/**
+ * @brief A token bucket that lets through per_sec calls per second on average,
+ * in bursts of up to burst calls (one second's worth by default).
+ *
+ * @detailed Implemented as the equivalent generic cell rate algorithm, which
+ * keeps the whole bucket in one atomic: the time at which the bucket will be
+ * full again, moved forward by 1/per_sec for each call let through. A rate
+ * that isn't positive lets nothing through.
+ */
+class Rate {
+  std::atomic<std::int64_t> full_at{0};
+  std::atomic<std::uint64_t> skipped{0};
+
+public:
+  bool admit(double per_sec, double burst = 0) {
+    if (!(per_sec > 0)) {
+      skipped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (burst < 1)
+      burst = std::max(per_sec, 1.0);
+    std::int64_t interval = to_ns(1 / per_sec);
+    std::int64_t tolerance = to_ns((burst - 1) * double(interval) / 1e9);
+    std::int64_t now = now_ns(), t = full_at.load(std::memory_order_relaxed);
+    for (;;) {
+      std::int64_t start = std::max(t, now);
+      if (start - now > tolerance) {
+        skipped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (full_at.compare_exchange_weak(t, start + interval,
+                                        std::memory_order_relaxed))
+        break;
+    }
+    suppressed_count() = skipped.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+};
+}
+}
+
+#endif /*__SAMPLING_H__*/
@@ -0,0 +1,453 @@
+/**
+ * Sinks: streams made for loggers to write to, which know where records end
+ * and decide for themselves when to flush.
+ */
+#ifndef __SINK_H__
+#define __SINK_H__
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crash.h"
+#include "logconfig.h"
+
+namespace logger {
+
+/**
+ * @brief When a buffered sink writes its buffer out, besides when it is full
+ * and on an explicit flush().
+ */
+struct FlushPolicy {
+  // The size of the buffer.
+  std::size_t buffer_size = 1 << 18;
+
+  // The time after which a record flushes everything buffered before it.
+  std::chrono::milliseconds interval = std::chrono::seconds(1);
+
+  // The severity at and above which a record is flushed right away.
+  int severity = ERROR;
+
+  /**
+   * @return A policy that only flushes when the buffer is full or on request.
+   */
+  static FlushPolicy when_full(std::size_t buffer_size = 1 << 18) {
+    return {buffer_size, std::chrono::milliseconds::max(), INT_MAX};
+  }
+};
+
+/**
+ * @brief A streambuf that collects output in a buffer and writes it to a file
+ * descriptor with as few calls to write as possible. The buffer is only
+ * allocated once something is written.
+ */
+class FdStreambuf : public std::streambuf {
+  int fd;
+  std::size_t capacity;
+  std::unique_ptr<char[]> buffer;
+  std::chrono::steady_clock::time_point drained;
+  std::uint64_t total = 0;
+
+  /**
+   * @brief Writes a run of characters to the descriptor, retrying partial and
+   * interrupted writes.
+   */
+  bool write_all(const char *p, std::size_t n) {
+    while (n > 0) {
+      ssize_t w = ::write(fd, p, n);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        return false;
+      p += w;
+      n -= w;
+      total += w;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Writes out the buffer and empties it.
+   */
+  bool drain() {
+    if (!buffer) {
+      buffer.reset(new char[capacity]);
+      setp(buffer.get(), buffer.get() + capacity);
+    }
+    bool ok = write_all(pbase(), pptr() - pbase());
+    setp(buffer.get(), buffer.get() + capacity);
+    drained = std::chrono::steady_clock::now();
+    return ok;
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (!drain())
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    if (n >= epptr() - pptr()) {
+      if (!drain())
+        return 0;
+      if (std::size_t(n) >= capacity)
+        return write_all(s, n) ? n : 0;
+    }
+    std::memcpy(pptr(), s, n);
+    pbump(int(n));
+    return n;
+  }
+
+  int sync() override { return pptr() == pbase() || drain() ? 0 : -1; }
+
+public:
+  FdStreambuf(int fd, std::size_t capacity)
+      : fd(fd), capacity(std::max<std::size_t>(capacity, 1)),
+        drained(std::chrono::steady_clock::now()) {}
+
+  int descriptor() const { return fd; }
+
+  /**
+   * @brief Writes out the buffer with bare write calls and empties it, for
+   * the crash handler.
+   */
+  void write_pending() {
+    if (!buffer)
+      return;
+    write_all(pbase(), pptr() - pbase());
+    setp(buffer.get(), buffer.get() + capacity);
+  }
+
+  /**
+   * @return When the buffer was last written out.
+   */
+  std::chrono::steady_clock::time_point last_drain() const { return drained; }
+
+  /**
+   * @return The number of characters written to the descriptor so far and
+   * still in the buffer.
+   */
+  std::uint64_t written() const { return total + (pptr() - pbase()); }
+
+  /**
+   * @brief Takes back the last characters written, if they are all still in
+   * the buffer.
+   *
+   * @param n The number of characters.
+   * @param[out] into The buffer to move them to.
+   * @return Whether they were taken back.
+   */
+  bool take_back(std::size_t n, LineBuffer &into) {
+    if (std::size_t(pptr() - pbase()) < n)
+      return false;
+    into.append(pptr() - n, n);
+    pbump(-int(n));
+    return true;
+  }
+
+  /**
+   * @brief Writes out the buffer, then switches to another descriptor and
+   * starts counting the characters written afresh.
+   *
+   * @return The previous descriptor.
+   */
+  int swap(int other) {
+    sync();
+    std::swap(fd, other);
+    total = 0;
+    return other;
+  }
+};
+
+/**
+ * @brief A sink that writes to a file descriptor through a large buffer, and
+ * flushes according to a FlushPolicy rather than after every line.
+ *
+ * @detailed Loggers call end_record() after each record, which flushes if the
+ * record is severe enough or the buffer was last written out longer than the
+ * policy's interval ago. There is no timer: a quiet logger keeps its last
+ * records buffered until the next record, an explicit flush(), or the sink's
+ * destruction.
+ *
+ * @usage FdSink sink("app.log"); BasicLogger<FdSink> logger(sink);
+ */
+class FdSink : public std::ostream {
+protected:
+  FdStreambuf buf;
+  FlushPolicy policy;
+  bool owned;
+
+  static int crash_drain(void *self, const char *, std::size_t) {
+    FdStreambuf &b = static_cast<FdSink *>(self)->buf;
+    b.write_pending();
+    return b.descriptor();
+  }
+
+  // not for the sinks that aren't open, like those of Staging
+  crash::Watch watch{buf.descriptor() >= 0 ? this : nullptr, crash_drain,
+                     crash::BUFFERS};
+
+public:
+  /**
+   * @brief Constructs a sink that is not open, like a default std::ofstream.
+   */
+  FdSink() : FdSink(-1) {}
+
+  /**
+   * @brief Constructs a sink writing to a descriptor, which stays open after
+   * the sink is destroyed.
+   */
+  explicit FdSink(int fd, FlushPolicy p = FlushPolicy())
+      : std::ostream(nullptr), buf(fd, p.buffer_size), policy(p),
+        owned(false) {
+    rdbuf(&buf);
+    if (fd < 0)
+      setstate(std::ios_base::badbit);
+  }
+
+  /**
+   * @brief Constructs a sink appending to a file, created if needed.
+   */
+  explicit FdSink(const std::string &path, FlushPolicy p = FlushPolicy())
+      : FdSink(::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                      0644),
+               p) {
+    owned = true;
+  }
+
+  FdSink(const FdSink &) = delete;
+  FdSink &operator=(const FdSink &) = delete;
+
+  /**
+   * @brief Flushes, and closes the file if the sink opened it.
+   */
+  ~FdSink() {
+    flush();
+    if (owned && buf.descriptor() >= 0)
+      ::close(buf.descriptor());
+  }
+
+  /**
+   * @brief Called by the loggers after each record, flushing it if the policy
+   * says so.
+   *
+   * @param level The severity of the record.
+   */
+  void end_record(int level) {
+    if (level >= policy.severity ||
+        (policy.interval != std::chrono::milliseconds::max() &&
+         std::chrono::steady_clock::now() - buf.last_drain() >=
+             policy.interval))
+      flush();
+  }
+
+  int descriptor() const { return buf.descriptor(); }
+};
+
+/**
+ * @brief A streambuf whose buffer is a window of a file mapped into memory, so
+ * that writing is a plain memcpy into the page cache. When the window fills,
+ * the file is extended and the next window mapped.
+ */
+class MmapStreambuf : public std::streambuf {
+  int fd;
+  std::size_t window;
+  char *map = nullptr;
+
+  // The offset in the file of the window.
+  std::uint64_t offset = 0;
+
+  /**
+   * @brief Unmaps the current window, after starting the write back of its
+   * pages, and maps the one at a given offset, allocating its blocks first.
+   */
+  bool advance(std::uint64_t to) {
+    if (map != nullptr) {
+      ::msync(map, window, MS_ASYNC);
+      ::munmap(map, window);
+      map = nullptr;
+      setp(nullptr, nullptr);
+    }
+    if (fd < 0 || (::fallocate(fd, 0, to, window) != 0 &&
+                   ::ftruncate(fd, to + window) != 0))
+      return false;
+    void *m = ::mmap(nullptr, window, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     to);
+    if (m == MAP_FAILED)
+      return false;
+    ::madvise(m, window, MADV_SEQUENTIAL);
+    map = static_cast<char *>(m);
+    offset = to;
+    setp(map, map + window);
+    return true;
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (!advance(offset + window))
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    std::streamsize done = 0;
+    while (done < n) {
+      if (pptr() == epptr() && !advance(offset + window))
+        return done;
+      std::size_t room = epptr() - pptr();
+      std::size_t k = std::min<std::size_t>(room, n - done);
+      std::memcpy(pptr(), s + done, k);
+      pbump(int(k));
+      done += k;
+    }
+    return n;
+  }
+
+  /**
+   * @brief Starts the write back of the window's pages without waiting for it.
+   */
+  int sync() override {
+    return map == nullptr || ::msync(map, window, MS_ASYNC) == 0 ? 0 : -1;
+  }
+
+public:
+  /**
+   * @brief Maps the end of a file open for reading and writing, which the
+   * streambuf then owns.
+   *
+   * @param fd The descriptor, or -1 for a streambuf that fails every write.
+   * @param window The size of the windows, rounded up to whole pages.
+   */
+  MmapStreambuf(int fd, std::size_t window) : fd(fd) {
+    std::size_t page = ::sysconf(_SC_PAGESIZE);
+    this->window = std::max<std::size_t>((window + page - 1) / page, 1) * page;
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0)
+      return;
+    std::uint64_t size = st.st_size;
+    if (advance(size - size % this->window))
+      pbump(int(size % this->window));
+  }
+
+  MmapStreambuf(const MmapStreambuf &) = delete;
+  MmapStreambuf &operator=(const MmapStreambuf &) = delete;
+
+  /**
+   * @brief Unmaps the window, cuts the file back to what was written and
+   * closes it.
+   */
+  ~MmapStreambuf() {
+    if (map != nullptr) {
+      std::uint64_t end = length();
+      ::munmap(map, window);
+      ::ftruncate(fd, end);
+    }
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  /**
+   * @return The length of the file, counting only what was written.
+   */
+  std::uint64_t length() const { return offset + (pptr() - pbase()); }
+
+  int descriptor() const { return fd; }
+
+  /**
+   * @brief Cuts the file back to what was written and appends some text with
+   * bare system calls, for the crash handler; the window stays mapped.
+   */
+  void cut(const char *text, std::size_t n) {
+    if (map == nullptr)
+      return;
+    std::uint64_t end = length();
+    ::ftruncate(fd, end);
+    ::pwrite(fd, text, n, end);
+  }
+};
+
+/**
+ * @brief A sink that writes to a memory-mapped file: each record is copied
+ * into a window of the file mapped into memory, and the kernel writes the
+ * pages back. There are no system calls per record, only one mmap per window.
+ *
+ * @detailed Since the pages belong to the kernel as soon as they are written,
+ * records survive a crash of the process (though not of the machine, before
+ * they are written back). The file is extended a window at a time, so after a
+ * crash it ends with zeros up to the end of the last window; it is cut back to
+ * what was written when the sink is closed. Loggers don't flush it after each
+ * record; an explicit flush() starts the write back of the current window.
+ *
+ * @usage MmapSink sink("app.log"); BasicLogger<MmapSink> logger(sink);
+ */
+class MmapSink : public std::ostream {
+  MmapStreambuf buf;
+
+  // the records are in the page cache already: only the zeros after them
+  // need cutting off
+  static int crash_drain(void *self, const char *marker, std::size_t n) {
+    static_cast<MmapSink *>(self)->buf.cut(marker, n);
+    return -1;
+  }
+
+  crash::Watch watch{buf.descriptor() >= 0 ? this : nullptr, crash_drain,
+                     crash::BUFFERS};
+
+public:
+  /**
+   * @brief Constructs a sink that is not open, like a default std::ofstream.
+   */
+  MmapSink() : std::ostream(nullptr), buf(-1, 0) {
+    rdbuf(&buf);
+    setstate(std::ios_base::badbit);
+  }
+
+  /**
+   * @brief Constructs a sink appending to a file, created if needed.
+   *
+   * @param path The file.
+   * @param window The size of the part of the file mapped at a time.
+   */
+  explicit MmapSink(const std::string &path, std::size_t window = 16 << 20)
+      : std::ostream(nullptr),
+        buf(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644), window) {
+    rdbuf(&buf);
+    if (buf.descriptor() < 0)
+      setstate(std::ios_base::badbit);
+  }
+
+  MmapSink(const MmapSink &) = delete;
+  MmapSink &operator=(const MmapSink &) = delete;
+
+  /**
+   * @brief Called by the loggers after each record; there's nothing to do.
+   */
+  void end_record(int level) {}
+
+  /**
+   * @return The length of the file, counting only what was written.
+   */
+  std::uint64_t length() const { return buf.length(); }
+};
+}
+
+#endif /*__SINK_H__*/
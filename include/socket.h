@@ -0,0 +1,256 @@
+/**
+ * A sink that sends batches of records as datagrams over a Unix domain socket
+ * to a local collector (see src/collector.cpp), without ever blocking.
+ */
+#ifndef __SOCKET_H__
+#define __SOCKET_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "crash.h"
+#include "sink.h"
+
+namespace logger {
+
+/**
+ * @return The address of a Unix domain socket at a path, which is truncated to
+ * the size of sun_path.
+ */
+inline sockaddr_un socket_address(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+/**
+ * @brief A streambuf that collects whole records into a batch and sends it as
+ * one datagram once the next record wouldn't fit, or on sync. Sending never
+ * waits: a batch the socket can't take right away is dropped, and its records
+ * counted.
+ */
+class DatagramStreambuf : public std::streambuf {
+  int fd;
+  sockaddr_un address;
+  std::size_t capacity;
+  std::vector<char> buffer;
+  std::size_t record_end = 0, records = 0;
+  std::chrono::steady_clock::time_point drained;
+  std::atomic<std::uint64_t> sent{0}, lost{0};
+
+  /**
+   * @brief Sends the first n characters of the buffer, holding the given
+   * number of records, and moves the rest to the front.
+   */
+  bool send(std::size_t n, std::size_t count) {
+    bool ok = true;
+    if (n > 0) {
+      ssize_t r;
+      do
+        r = ::sendto(fd, buffer.data(), n, MSG_DONTWAIT | MSG_NOSIGNAL,
+                     reinterpret_cast<const sockaddr *>(&address),
+                     sizeof(address));
+      while (r < 0 && errno == EINTR);
+      // a full socket, a collector that isn't there, or a record larger
+      // than a datagram can be: in every case the batch is gone
+      ok = r == ssize_t(n);
+      (ok ? sent : lost).fetch_add(count, std::memory_order_relaxed);
+    }
+    std::size_t used = pptr() - pbase();
+    std::memmove(buffer.data(), buffer.data() + n, used - n);
+    setp(buffer.data(), buffer.data() + buffer.size());
+    pbump(int(used - n));
+    record_end -= std::min(record_end, n);
+    records -= count;
+    drained = std::chrono::steady_clock::now();
+    return ok;
+  }
+
+  /**
+   * @brief Makes room for at least n more characters: sends the records in
+   * the buffer, and grows it if a single record doesn't fit.
+   */
+  void reserve(std::size_t n) {
+    if (buffer.empty()) {
+      buffer.resize(std::max(capacity, n));
+      setp(buffer.data(), buffer.data() + buffer.size());
+    }
+    if (std::size_t(epptr() - pptr()) >= n)
+      return;
+    if (record_end > 0)
+      send(record_end, records);
+    std::size_t used = pptr() - pbase();
+    if (buffer.size() - used < n) {
+      buffer.resize(used + n);
+      setp(buffer.data(), buffer.data() + buffer.size());
+      pbump(int(used));
+    }
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+      return traits_type::not_eof(c);
+    reserve(1);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    reserve(n);
+    std::memcpy(pptr(), s, n);
+    pbump(int(n));
+    return n;
+  }
+
+  /**
+   * @brief Sends what is in the buffer, counted as one record if it doesn't
+   * end with one. Dropping it isn't an error: the stream stays good.
+   */
+  int sync() override {
+    std::size_t used = pptr() - pbase();
+    if (used > 0)
+      send(used, records + (record_end < used));
+    return 0;
+  }
+
+public:
+  /**
+   * @param fd A datagram socket of the AF_UNIX family.
+   * @param path The path the collector is bound to.
+   * @param capacity The size of the batches.
+   */
+  DatagramStreambuf(int fd, const std::string &path, std::size_t capacity)
+      : fd(fd), address(socket_address(path)),
+        capacity(std::max<std::size_t>(capacity, 1)),
+        drained(std::chrono::steady_clock::now()) {}
+
+  ~DatagramStreambuf() {
+    sync();
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  /**
+   * @brief Marks the end of a record, where a batch can be cut.
+   */
+  void end_record() {
+    record_end = pptr() - pbase();
+    ++records;
+  }
+
+  int descriptor() const { return fd; }
+
+  /**
+   * @brief Sends what is in the buffer, then some text as a datagram of its
+   * own; both calls are safe in the crash handler.
+   */
+  void send_with(const char *text, std::size_t n) {
+    sync();
+    ::sendto(fd, text, n, MSG_DONTWAIT | MSG_NOSIGNAL,
+             reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+  }
+
+  std::chrono::steady_clock::time_point last_drain() const { return drained; }
+
+  std::uint64_t delivered() const {
+    return sent.load(std::memory_order_relaxed);
+  }
+
+  std::uint64_t dropped() const {
+    return lost.load(std::memory_order_relaxed);
+  }
+};
+
+/**
+ * @brief A sink that sends records to a collector listening on a Unix domain
+ * socket, so that the processes of a host can log to one merged output.
+ *
+ * @detailed Records are batched into datagrams the size of the flush policy's
+ * buffer, and a batch is sent when the next record wouldn't fit, or when the
+ * policy would flush it. Every batch is a single non-blocking sendto, and
+ * records are never split between batches, so the collector can write
+ * datagrams out as they come. Nothing waits on the collector: when its socket
+ * is full, or it isn't running, the batch is dropped and its records counted
+ * in dropped(); the sink picks up again once it is back.
+ *
+ * @remark Keep the batches well below the socket's send buffer, net.core.
+ * wmem_default, which bounds the size of a datagram. A record larger than that
+ * is always dropped.
+ *
+ * @usage SocketSink sink("/run/app/log.sock"); FullLogger<SocketSink>
+ * logger(sink);
+ */
+class SocketSink : public std::ostream {
+  DatagramStreambuf buf;
+  FlushPolicy policy;
+
+  static int crash_drain(void *self, const char *marker, std::size_t n) {
+    static_cast<SocketSink *>(self)->buf.send_with(marker, n);
+    return -1;
+  }
+
+  crash::Watch watch{this, crash_drain, crash::BUFFERS};
+
+public:
+  /**
+   * @brief Constructs a sink sending to the collector bound to a path, which
+   * doesn't have to be running yet.
+   */
+  explicit SocketSink(const std::string &path,
+                      FlushPolicy p = FlushPolicy{1 << 16})
+      : std::ostream(nullptr),
+        buf(::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0), path,
+            p.buffer_size),
+        policy(p) {
+    rdbuf(&buf);
+    if (buf.descriptor() < 0)
+      setstate(std::ios_base::badbit);
+  }
+
+  SocketSink(const SocketSink &) = delete;
+  SocketSink &operator=(const SocketSink &) = delete;
+
+  ~SocketSink() { flush(); }
+
+  /**
+   * @brief Called by the loggers after each record, sending the batch if the
+   * policy says so.
+   *
+   * @param level The severity of the record.
+   */
+  void end_record(int level) {
+    buf.end_record();
+    if (level >= policy.severity ||
+        (policy.interval != std::chrono::milliseconds::max() &&
+         std::chrono::steady_clock::now() - buf.last_drain() >=
+             policy.interval))
+      flush();
+  }
+
+  /**
+   * @return The number of records the collector took so far. Can be read
+   * from any thread.
+   */
+  std::uint64_t delivered() const { return buf.delivered(); }
+
+  /**
+   * @return The number of records dropped so far because the collector
+   * couldn't take them. Can be read from any thread.
+   */
+  std::uint64_t dropped() const { return buf.dropped(); }
+};
+}
+
+#endif /*__SOCKET_H__*/
@@ -0,0 +1,139 @@
+/**
+ * Identities of logging threads: a compact ordinal per thread, and the text
+ * printed for it, which is its id in hexadecimal until it is given a name.
+ */
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace logger {
+
+/**
+ * @brief The process-wide table of thread names, indexed by ordinal. Ordinals
+ * are handed out from 1 as threads first log, and never reused.
+ */
+class ThreadRegistry {
+  std::mutex lock;
+  std::vector<std::string> names;
+  std::atomic<std::uint64_t> renames{0};
+
+public:
+  /**
+   * @brief Adds a thread under the given name.
+   *
+   * @return The ordinal of the thread.
+   */
+  std::uint32_t add(std::string name) {
+    std::lock_guard<std::mutex> guard(lock);
+    names.push_back(std::move(name));
+    return std::uint32_t(names.size());
+  }
+
+  /**
+   * @brief Changes the name of a thread.
+   */
+  void rename(std::uint32_t ordinal, std::string name) {
+    std::lock_guard<std::mutex> guard(lock);
+    names[ordinal - 1] = std::move(name);
+    renames.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * @return The name of a thread.
+   */
+  std::string name(std::uint32_t ordinal) {
+    std::lock_guard<std::mutex> guard(lock);
+    return names[ordinal - 1];
+  }
+
+  /**
+   * @return The number of renames so far, which tells caches when to drop the
+   * names they copied.
+   */
+  std::uint64_t version() const {
+    return renames.load(std::memory_order_acquire);
+  }
+};
+
+inline ThreadRegistry &thread_registry() {
+  static ThreadRegistry registry;
+  return registry;
+}
+
+/**
+ * @return The text printed for a thread id: hexadecimal with a 0x prefix.
+ */
+inline std::string render_thread_id(std::thread::id id) {
+  std::ostringstream s;
+  s << std::hex << std::showbase << id;
+  return s.str();
+}
+
+/**
+ * @return The ordinal of the current thread, registering it on first use.
+ */
+inline std::uint32_t thread_ordinal() {
+  static thread_local const std::uint32_t ordinal =
+      thread_registry().add(render_thread_id(std::this_thread::get_id()));
+  return ordinal;
+}
+
+/**
+ * @return A process-unique id, so that thread-local lookups never confuse a
+ * destroyed logger with a new one at the same address.
+ */
+inline std::size_t next_logger_id() {
+  static std::atomic<std::size_t> id(0);
+  return ++id;
+}
+
+/**
+ * @brief Names the current thread in the logs, e.g. "asio-worker-3" for the
+ * threads of a pool. Lines are printed with the name from then on, including
+ * lines still queued in asynchronous loggers.
+ */
+inline void set_thread_name(std::string name) {
+  thread_registry().rename(thread_ordinal(), std::move(name));
+}
+
+/**
+ * @brief A copy of the names of the threads whose lines the current thread has
+ * formatted, so that printing a thread copies the same bytes each time without
+ * locking the registry.
+ */
+class ThreadNameCache {
+  std::uint64_t version = 0;
+  std::vector<std::string> names;
+
+public:
+  const std::string &name(std::uint32_t ordinal) {
+    std::uint64_t current = thread_registry().version();
+    if (current != version) {
+      names.clear();
+      version = current;
+    }
+    if (ordinal >= names.size())
+      names.resize(ordinal + 1);
+    if (names[ordinal].empty())
+      names[ordinal] = thread_registry().name(ordinal);
+    return names[ordinal];
+  }
+};
+
+/**
+ * @return The current thread's ThreadNameCache.
+ */
+inline ThreadNameCache &thread_name_cache() {
+  static thread_local ThreadNameCache cache;
+  return cache;
+}
+}
+
+#endif /*__THREADS_H__*/
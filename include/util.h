@@ -2,9 +2,12 @@
 #define __UTIL_H__
 
 #include <iostream>
+#include <limits>
+#include <map>
 #include <string>
 #include <tuple>
 #include <type_traits>
+#include <vector>
 
 namespace clayer {
 namespace util {
@@ -0,0 +1,128 @@
+/**
+ * Changes the runtime thresholds of every process on the host that follows
+ * the shared memory control block (see LevelWatcher::watch_shared).
+ *
+ * usage: clayerctl [-b blockname] set <logger|*|file:suffix> <level>
+ *        clayerctl [-b blockname] unset <logger|file:suffix>
+ *        clayerctl [-b blockname] clear
+ *        clayerctl [-b blockname] show
+ */
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "control.h"
+
+using logger::ControlBlock;
+
+static int usage() {
+  std::cerr << "usage: clayerctl [-b blockname] set <logger|*|file:suffix> "
+               "<level>\n"
+               "       clayerctl [-b blockname] unset <logger|file:suffix>\n"
+               "       clayerctl [-b blockname] clear\n"
+               "       clayerctl [-b blockname] show\n";
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  const char *name = logger::control_block_name;
+  int arg = 1;
+  if (arg + 1 < argc && std::strcmp(argv[arg], "-b") == 0) {
+    name = argv[arg + 1];
+    arg += 2;
+  }
+  if (arg >= argc)
+    return usage();
+  std::string command = argv[arg++];
+
+  ControlBlock *block = logger::map_control_block(name);
+  if (block == nullptr) {
+    std::cerr << "clayerctl: cannot map " << name << ": "
+              << std::strerror(errno) << "\n";
+    return 1;
+  }
+
+  // settings are looked up while editing, since another clayerctl may be
+  // editing too
+  auto edit = [name, block](auto f) {
+    if (logger::edit_control_block(name, *block, f))
+      return true;
+    std::cerr << "clayerctl: cannot lock " << name << ": "
+              << std::strerror(errno) << "\n";
+    return false;
+  };
+  auto find = [block](const std::string &target) {
+    for (std::uint32_t i = 0; i < block->count; ++i)
+      if (target == block->entries[i].target)
+        return int(i);
+    return -1;
+  };
+
+  if (command == "show" && arg == argc) {
+    for (std::uint32_t i = 0; i < block->count; ++i) {
+      std::cout << block->entries[i].target << " ";
+      if (block->entries[i].level == logger::unset_level)
+        std::cout << "unset\n";
+      else
+        std::cout << block->entries[i].level << "\n";
+    }
+  } else if (command == "clear" && arg == argc) {
+    if (!edit([&] {
+      // unset files explicitly, so that processes drop their thresholds
+      std::uint32_t kept = 0;
+      for (std::uint32_t i = 0; i < block->count; ++i) {
+        if (std::strncmp(block->entries[i].target, "file:", 5) == 0) {
+          block->entries[kept] = block->entries[i];
+          block->entries[kept++].level = logger::unset_level;
+        }
+      }
+      block->count = kept;
+    }))
+      return 1;
+  } else if (command == "set" && arg + 2 == argc) {
+    std::string target = argv[arg];
+    int level;
+    if (!logger::parse_level(argv[arg + 1], level) ||
+        target.size() >= sizeof(ControlBlock::Entry::target)) {
+      std::cerr << "clayerctl: bad target or level\n";
+      return 2;
+    }
+    if (level == logger::unset_level && target.compare(0, 5, "file:") != 0) {
+      std::cerr << "clayerctl: a logger can't be unset, use a level\n";
+      return 2;
+    }
+    bool full = false;
+    if (!edit([&] {
+          int i = find(target);
+          if (i < 0 && block->count == ControlBlock::max_entries) {
+            full = true;
+            return;
+          }
+          if (i < 0) {
+            i = block->count++;
+            std::strcpy(block->entries[i].target, target.c_str());
+          }
+          block->entries[i].level = level;
+        }))
+      return 1;
+    if (full) {
+      std::cerr << "clayerctl: too many settings\n";
+      return 1;
+    }
+  } else if (command == "unset" && arg + 1 == argc) {
+    std::string target = argv[arg];
+    if (!edit([&] {
+          int i = find(target);
+          if (i < 0)
+            return;
+          if (std::strncmp(block->entries[i].target, "file:", 5) == 0)
+            block->entries[i].level = logger::unset_level;
+          else
+            block->entries[i] = block->entries[--block->count];
+        }))
+      return 1;
+  } else {
+    return usage();
+  }
+  return 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * Collects the records that the processes of a host send to a Unix domain
+ * socket through a SocketSink, and writes them to one merged output. With -a,
+ * also analyses the records received in every interval of that many seconds,
+ * printing statistics by file and function to stderr. An interval holds at
+ * most the newest 64 MiB of records: under a flood, the oldest are dropped from
+ * the analysis, though not from the output.
+ *
+ * The records are expected in full_fmt, as written by FullLogger.
+ *
+ * usage: collector [-o output] [-a seconds] <socket>
+ */
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "analyser.h"
+#include "sink.h"
+#include "socket.h"
+
+using namespace clayer;
+
+static volatile std::sig_atomic_t stopping = 0;
+
+static void stop(int) { stopping = 1; }
+
+static int usage() {
+  std::cerr << "usage: collector [-o output] [-a seconds] <socket>\n";
+  return 2;
+}
+
+// The most records of an interval the analysis holds, in bytes.
+static constexpr std::size_t window_limit = 64 << 20;
+
+/**
+ * Appends received records to those of an interval, dropping the oldest whole
+ * records once they pass window_limit, down to three quarters of it so that
+ * the rest isn't moved for every datagram.
+ *
+ * @return The number of records dropped.
+ */
+static std::size_t append_bounded(std::string &window, const char *data,
+                                  std::size_t n) {
+  window.append(data, n);
+  if (window.size() <= window_limit)
+    return 0;
+  std::size_t cut = window.find('\n', window.size() - window_limit * 3 / 4);
+  cut = cut == std::string::npos ? window.size() : cut + 1;
+  std::size_t dropped = std::count(window.begin(), window.begin() + cut, '\n');
+  window.erase(0, cut);
+  return dropped;
+}
+
+/**
+ * Prints statistics by file and function over the records of an interval.
+ */
+static void analyse(const std::string &window, std::size_t dropped,
+                    int seconds) {
+  // as in src/analyser_test.cpp
+  static const std::regex log_format(
+      ".*\\[(.*) (.*)\\].* (.*)\\[Thread (.*):(.*)\\((.*):(.*)\\)\\]: "
+      "\\[(.*)\\] \\[(.*)\\]");
+  analyser::Parser parser;
+  std::istringstream in(window);
+  auto recs = parser.read_stream<clayer::DATE, clayer::TIME, clayer::LEVEL,
+                                 clayer::THREAD, clayer::FILE, clayer::FUNC,
+                                 clayer::LINE, clayer::MESG, clayer::HASH>(
+      in, log_format);
+  auto stats = analyser::DomainStat<clayer::FILE, clayer::FUNC>(recs);
+  std::cerr << "--- " << recs.size() << " records in the last " << seconds
+            << " s";
+  if (dropped > 0)
+    std::cerr << ", " << dropped << " more dropped from the analysis";
+  std::cerr << "\n" << stats << std::endl;
+}
+
+int main(int argc, char **argv) {
+  const char *output = nullptr;
+  int seconds = 0;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    if (std::strcmp(argv[arg], "-o") == 0)
+      output = argv[arg + 1];
+    else if (std::strcmp(argv[arg], "-a") == 0)
+      seconds = std::atoi(argv[arg + 1]);
+    else
+      return usage();
+  }
+  if (arg + 1 != argc || seconds < 0)
+    return usage();
+  std::string path = argv[arg];
+
+  int fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address = logger::socket_address(path);
+  ::unlink(path.c_str());
+  if (fd < 0 || ::bind(fd, reinterpret_cast<const sockaddr *>(&address),
+                       sizeof(address)) != 0) {
+    std::cerr << "collector: cannot bind " << path << ": "
+              << std::strerror(errno) << "\n";
+    return 1;
+  }
+  // the more the socket holds, the fewer batches the senders drop while we
+  // write; the kernel caps this at net.core.rmem_max
+  int size = 8 << 20;
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  int written = output == nullptr
+                    ? STDOUT_FILENO
+                    : ::open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                             0644);
+  if (written < 0) {
+    std::cerr << "collector: cannot open " << output << ": "
+              << std::strerror(errno) << "\n";
+    return 1;
+  }
+  logger::FdSink out(written);
+
+  struct sigaction action {};
+  action.sa_handler = stop;
+  ::sigaction(SIGINT, &action, nullptr);
+  ::sigaction(SIGTERM, &action, nullptr);
+
+  std::vector<char> datagram(1 << 20);
+  std::string window;
+  std::size_t dropped = 0;
+  auto next = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+  while (!stopping) {
+    pollfd p{fd, POLLIN, 0};
+    if (::poll(&p, 1, 200) > 0) {
+      // drain what is queued before writing it out in one go, but not past
+      // the end of the interval, which a flood would otherwise delay forever
+      ssize_t n;
+      while ((n = ::recv(fd, datagram.data(), datagram.size(),
+                         MSG_DONTWAIT)) > 0) {
+        out.write(datagram.data(), n);
+        if (seconds == 0)
+          continue;
+        dropped += append_bounded(window, datagram.data(), n);
+        if (std::chrono::steady_clock::now() >= next)
+          break;
+      }
+    }
+    out.flush();
+    if (seconds > 0 && std::chrono::steady_clock::now() >= next) {
+      analyse(window, dropped, seconds);
+      window.clear();
+      dropped = 0;
+      next += std::chrono::seconds(seconds);
+    }
+  }
+  out.flush();
+  if (output != nullptr)
+    ::close(written);
+  ::close(fd);
+  ::unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,26 @@
+/**
+ * Decoder for binary logs written by a BinaryLogger: prints them as text, in
+ * the format of the logger that wrote them.
+ */
+#include <fstream>
+#include <iostream>
+
+#include "binary.h"
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cout << "usage:\n\t" << argv[0] << " <binarylogfilename>\n";
+    return 1;
+  }
+  std::ifstream f(argv[1], std::ios::binary);
+  logger::binary::Reader reader(f);
+  if (!reader) {
+    std::cerr << argv[1] << ": not a binary log\n";
+    return 1;
+  }
+  for (logger::Line line; reader.next(line);) {
+    reader.print(std::cout, line);
+    std::cout << '\n';
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * Formatting benchmark - the cost of building a message full of numbers
+ *
+ * usage: format_benchmark [iterations]
+ *
+ * Compares a fresh std::ostringstream per message, as Line used to hold, with
+ * the MessageStream writing into a LineBuffer, and with a Record, which formats
+ * numbers with std::to_chars. The logger writes into a stream with no buffer,
+ * so only the formatting is measured.
+ */
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "logger.h"
+#include "logconfig.h"
+
+template <typename S> void message(S &&s, int i) {
+  s << "request " << i << " took " << i * 0.37 << "ms, " << i * 1024L
+    << " bytes, retries " << (i & 7) << '/' << 8u;
+}
+
+template <typename F> double measure(int iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+    f(i);
+  std::chrono::duration<double, std::nano> took =
+      std::chrono::steady_clock::now() - start;
+  return took.count() / iterations;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? std::stoi(argv[1]) : 1000000;
+  std::size_t total = 0;
+
+  double ostringstream = measure(iterations, [&](int i) {
+    std::ostringstream s;
+    message(s, i);
+    total += s.str().size();
+  });
+
+  double message_stream = measure(iterations, [&](int i) {
+    logger::LineBuffer b;
+    logger::MessageStream &s = logger::message_stream();
+    s.reset();
+    message(s.into(b), i);
+    total += b.size();
+  });
+
+  std::ostream null(nullptr);
+  logger::BasicLogger<std::ostream, logger::INFO> record_logger(null);
+  double record = measure(iterations, [&](int i) {
+    message(record_logger.log<logger::ERROR>(
+                {__FILE__, __func__, __LINE__, logger::ERROR}),
+            i);
+  });
+
+  std::ostringstream expected, got;
+  logger::BasicLogger<std::ostringstream, logger::INFO> check_logger(got);
+  message(expected, 12345);
+  message(check_logger.log<logger::ERROR>(
+              {__FILE__, __func__, __LINE__, logger::ERROR}),
+          12345);
+  expected << '\n';
+
+  std::cout << "ns per message (" << iterations << " iterations)\n"
+            << "  std::ostringstream: " << ostringstream << "\n"
+            << "  MessageStream:      " << message_stream << "\n"
+            << "  Record (to_chars):  " << record << "\n"
+            << "outputs " << (expected.str() == got.str() ? "match" : "DIFFER")
+            << " (" << total / (2 * iterations) << " chars each)\n";
+  return expected.str() == got.str() ? 0 : 1;
+}
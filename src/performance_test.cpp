@@ -1,36 +1,101 @@
 /**
  * Performance test - multiple threads dumping log messages
+ *
+ * usage: performance_test [sync|async|merge|binary|ofstream|fd|mmap|files]
+ *
+ * The binary mode logs to performance_test.bin; decode it with bin/decoder.
+ * The ofstream, fd and mmap modes log to performance_test.log through a
+ * std::ofstream, a buffered FdSink and a memory-mapped MmapSink; the files mode
+ * runs all three in turn. Each mode prints how long it took.
  */
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
 #include <thread>
 #include <vector>
 #include <utility>
+#include <fstream>
 #include "stdlib.h"
+#include "binary.h"
 #include "logger.h"
 #include "logconfig.h"
+#include "sink.h"
 
 const int iterations = 1000;
 const int thread_count = 50;
-void worker() {
+
+template <typename L> void worker(L &logger) {
   for (int i = 0; i < iterations; i++) {
-    LOG(WARNING) << "ERROR message";
-    LOG(DEBUG) << "DEBUG message";
-    LOG(INFO) << "INFO message";
-    LOG(CRITICAL) << "CRITICAL message";
-    LOG(ERROR) << "ERROR message";
+    CLOG(logger, WARNING) << "ERROR message";
+    CLOG(logger, DEBUG) << "DEBUG message";
+    CLOG(logger, INFO) << "INFO message";
+    CLOG(logger, CRITICAL) << "CRITICAL message";
+    CLOG(logger, ERROR) << "ERROR message";
   }
 }
 
-int main() {
-
-  LOG(DEBUG) << "Begin the performance test";
+template <typename L> void run(L &logger) {
+  CLOG(logger, DEBUG) << "Begin the performance test";
   std::vector<std::thread> worker_threads;
   for (int i = 0; i < thread_count; i++) {
-    worker_threads.push_back(std::move(std::thread(worker)));
+    worker_threads.push_back(std::move(std::thread(worker<L>, std::ref(logger))));
   }
 
   for (auto &thread : worker_threads) {
     thread.join();
   }
+}
+
+/**
+ * Runs the test with a logger writing to a file through a Stream.
+ */
+template <typename Stream, typename... Args> void run_file(Args... args) {
+  std::remove("performance_test.log");
+  Stream file(args...);
+  logger::FullLogger<Stream> file_logger(file);
+  run(file_logger);
+}
+
+int main(int argc, char **argv) {
+  std::string mode = argc > 1 ? argv[1] : "sync";
+
+  auto timed = [](const std::string &name, auto test) {
+    auto start = std::chrono::steady_clock::now();
+    test();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    std::cout << name << ": " << ms.count() << " ms" << std::endl;
+  };
+
+  bool files = mode == "files";
+  if (mode == "async") {
+    timed(mode, [] {
+      logger::AsyncFullLogger<std::ostream> async_logger(std::clog);
+      run(async_logger);
+    });
+  } else if (mode == "merge") {
+    timed(mode, [] {
+      logger::MergingFullLogger<std::ostream> merging_logger(std::clog);
+      run(merging_logger);
+    });
+  } else if (mode == "binary") {
+    timed(mode, [] {
+      std::ofstream f("performance_test.bin", std::ios::binary);
+      logger::BinaryFullLogger<std::ostream> binary_logger(f);
+      run(binary_logger);
+    });
+  } else if (files || mode == "ofstream" || mode == "fd" || mode == "mmap") {
+    if (files || mode == "ofstream")
+      timed("ofstream",
+            [] { run_file<std::ofstream>("performance_test.log"); });
+    if (files || mode == "fd")
+      timed("fd", [] { run_file<logger::FdSink>("performance_test.log"); });
+    if (files || mode == "mmap")
+      timed("mmap", [] { run_file<logger::MmapSink>("performance_test.log"); });
+  } else {
+    timed("sync", [] { run(LOG); });
+  }
 
   return 0;
 }
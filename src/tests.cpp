@@ -7,16 +7,36 @@
 #include "tests.h"
 
 #include "analyser.h"
+#include "binary.h"
+#include "compressed.h"
+#include "control.h"
+#include "crash.h"
 #include "logconfig.h"
 #include "logger.h"
+#include "multi.h"
 #include "property.h"
+#include "rotating.h"
+#include "sink.h"
+#include "socket.h"
 #include "util.h"
 
+#include <algorithm>
+#include <bitset>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <map>
 #include <regex>
+#include <set>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include <sys/resource.h>
+#include <sys/wait.h>
+
 /**
  * Helper function for string tests.
  */
@@ -26,6 +46,8 @@ static bool contains(std::string str, std::string substr) {
 
 namespace logger {
 constexpr const char my_format[] = "[%] %[%:%(%:%)]: [%]";
+constexpr const char pair_format[] = "[%] %";
+constexpr const char context_format[] = "%(%:%)";
 using MyLogger =
     Logger<std::ostringstream, DEBUG, my_format, prop_time, prop_level,
            prop_thread, prop_file, prop_func, prop_line, prop_msg>;
@@ -76,6 +98,35 @@ void test_basic() {
     return (x.str().find("serious") != std::string::npos &&
             x.str().find("funny") == std::string::npos);
   })();
+
+  test::make("Skips the arguments of statements below threshold", []() {
+    std::ostringstream x;
+    logger::BasicLogger<std::ostringstream, logger::INFO> Logger(x);
+
+    int evaluated = 0;
+    auto expensive_dump = [&]() { return ++evaluated; };
+    CLOG(Logger, DEBUG) << "compiled out " << expensive_dump();
+    Logger.set_level(logger::ERROR);
+    CLOG(Logger, WARNING) << "rejected at runtime " << expensive_dump();
+    Logger.set_level(logger::INFO);
+    CLOG(Logger, INFO) << "logged " << expensive_dump();
+
+    return evaluated == 1 && x.str() == "logged 1\n";
+  })();
+
+  test::make("Statements nest in if/else and conditionals unchanged", []() {
+    std::ostringstream x;
+    logger::BasicLogger<std::ostringstream, logger::INFO> Logger(x);
+
+    for (int i = 0; i < 2; ++i)
+      if (i == 0)
+        CLOG(Logger, INFO) << "then";
+      else
+        CLOG(Logger, INFO) << "else " << i;
+    true ? CLOG(Logger, DEBUG) << "never" : CLOG(Logger, INFO) << "never";
+
+    return x.str() == "then\nelse 1\n";
+  })();
 }
 
 /**
@@ -106,7 +157,7 @@ void test_props() {
 
   test::make("Correctly prints thread while preserving number format", []() {
     std::ostringstream x;
-    logger::Logger<std::ostringstream, DEBUG, my_format, prop_thread, prop_msg> Logger(x);
+    logger::Logger<std::ostringstream, DEBUG, pair_format, prop_thread, prop_msg> Logger(x);
 
     CLOG(Logger, ERROR) << "broke down with error code " << 16;
 
@@ -114,54 +165,135 @@ void test_props() {
             x.str().find("16") != std::string::npos); // prints following in dec
   })();
 
-  test::make("Prints the same hash for identical object references", []() {
-    // Logger setup
-    std::ostringstream x, y;
-    logger::Logger<decltype(x), DEBUG, my_format, prop_hash> Logger(x),
-        Logger2(y);
+  test::make("Prints the local date and time the Line was created", []() {
+    std::ostringstream x, expected;
+    Line l;
+    // 2017-03-04 05:06:07.000891234 UTC, and the second after it
+    l.time = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds(1488603967000891234LL)));
+    for (int i = 0; i < 2; ++i) {
+      prop_date(x, l);
+      x << ' ';
+      prop_time(x, l);
+      x << ' ';
+      prop_time_us(x, l);
+      x << ' ';
+      prop_time_ns(x, l);
+      x << '\n';
+
+      std::time_t t = std::chrono::system_clock::to_time_t(l.time);
+      expected << std::put_time(std::localtime(&t),
+                                "%F %T %T.000891 %T.000891234\n");
+      l.time += std::chrono::seconds(1);
+    }
+    return x.str() == expected.str();
+  })();
+
+  test::make("Prints the name given to a thread instead of its id", []() {
+    std::ostringstream x;
+    Logger<std::ostringstream, DEBUG, pair_format, prop_thread, prop_msg>
+        Logger(x);
 
-    // print an instance twice, so that the hashes are the same
-    std::string msg = "test message with one address";
-    CLOG(Logger, ERROR) << msg;
-    CLOG(Logger2, ERROR) << msg;
+    std::thread([&] {
+      CLOG(Logger, ERROR) << "before";
+      set_thread_name("worker-3");
+      CLOG(Logger, ERROR) << "after";
+    }).join();
+    CLOG(Logger, ERROR) << "main";
 
-    return (x.str().find("0x") != std::string::npos && x.str() == y.str());
+    std::string s = x.str();
+    return contains(s, "[0x") && contains(s, "] before\n[worker-3] after\n") &&
+           !contains(s, "[worker-3] main");
   })();
 
-  test::make("Prints different hashes for different object refs", []() {
-    // Logger setup
-    std::ostringstream x, y;
-    logger::Logger<decltype(x), DEBUG, my_format, prop_hash> Logger(x),
-        Logger2(y);
+  test::make("Gives each thread its own compact ordinal", []() {
+    std::ostringstream x;
+    Logger<std::ostringstream, DEBUG, pair_format, prop_thread_ordinal,
+           prop_msg>
+        Logger(x);
 
-    // print the same message but from different objects; different hashes
-    std::string msg = "test message with one address";
-    x.clear(); y.clear();
-    std::string msg2 = msg;
-    CLOG(Logger, ERROR) << msg2;
-    CLOG(Logger2, ERROR) << msg;
+    std::uint32_t ordinal = thread_ordinal(), other = 0;
+    std::thread([&] { other = thread_ordinal(); }).join();
+    CLOG(Logger, ERROR) << "main";
+    return ordinal != 0 && other != 0 && ordinal != other &&
+           x.str() == "[" + std::to_string(ordinal) + "] main\n";
+  })();
 
-    return (x.str().find("0x") != std::string::npos && x.str() != y.str());
+  test::make("Hashes a statement the same whatever values it prints", []() {
+    std::ostringstream x;
+    logger::Logger<decltype(x), DEBUG, basic_fmt, prop_hash> Logger(x);
+
+    auto emit = [&Logger](const std::string &s) {
+      CLOG(Logger, ERROR) << "value " << s;
+    };
+    auto l = __LINE__ - 2;
+    // the statement took the last __COUNTER__ value before this one
+    auto n = __COUNTER__ - 1;
+    std::string a = "a", b = std::string(1000, 'b');
+    emit(a);
+    emit(b);
+
+    // the site, then the literal's text, then the argument's type
+    std::uint64_t text = logger::fnv1a("value ");
+    std::uint64_t expected = logger::mix(
+        logger::mix(logger::site_id(__FILE__, l, ERROR, n), text),
+        logger::type_id<std::string>());
+    std::ostringstream e;
+    e << std::hex << std::showbase << expected << "\n";
+    return x.str() == e.str() + e.str();
+  })();
+
+  test::make("Hashes differ between statements and argument types", []() {
+    std::ostringstream x, y, z;
+    logger::Logger<decltype(x), DEBUG, basic_fmt, prop_hash> Logger(x),
+        Logger2(y), Logger3(z);
+
+    auto emit = [](auto &l, auto v) { CLOG(l, ERROR) << "value " << v; };
+    CLOG(Logger, ERROR) << "value " << 1;
+    emit(Logger2, 1);
+    emit(Logger3, 1u);
+
+    return x.str() != y.str() && y.str() != z.str() && x.str() != z.str();
+  })();
+
+  test::make("Hashes don't depend on the text of character buffers", []() {
+    std::ostringstream x;
+    logger::Logger<decltype(x), DEBUG, pair_format, prop_hash, prop_msg>
+        Logger(x);
+
+    char buffer[16];
+    for (const char *text : {"one", "two"}) {
+      std::strcpy(buffer, text);
+      CLOG(Logger, ERROR) << "got " << buffer;
+    }
+    std::string s = x.str();
+    std::size_t one = s.find("] got one\n"), two = s.find("] got two\n");
+    return one != std::string::npos && two == 2 * one + 10 &&
+           s.substr(0, one) == s.substr(one + 10, one);
   })();
 
   test::make("Hashes should depend only on enabled msg. segments", []() {
-    // Logger setup
-    std::ostringstream x, y;
-    logger::Logger<decltype(x), DEBUG, my_format, prop_hash> Logger(x),
-        Logger2(y);
+    std::ostringstream x, y, z;
+    logger::Logger<decltype(x), DEBUG, basic_fmt, prop_hash> Logger(x),
+        Logger2(y), Logger3(z);
 
-    // output twice with differing hashes in ignored areas
-    std::string msg = "hello ", msg2 = msg;
-    CLOG(Logger, ERROR) << logger::hash::off << msg2 << logger::hash::on << msg;
-    CLOG(Logger2, ERROR) << logger::hash::off << msg << logger::hash::on << msg;
+    // output with differing types in ignored areas, then in hashed ones
+    auto emit = [](auto &l, const auto &a, const auto &b) {
+      CLOG(l, ERROR) << logger::hash::off << a << logger::hash::on << b;
+    };
+    emit(Logger, 1, "hello");
+    emit(Logger2, std::string("one"), "hello");
+    emit(Logger3, 1, "world");
 
-    return (x.str().find("0x") != std::string::npos && x.str() == y.str());
+    return (x.str().find("0x") != std::string::npos && x.str() == y.str() &&
+            x.str() != z.str());
   })();
 
   test::make("Prints the proper context of the log call", []() {
     // Logger setup
     std::ostringstream x;
-    logger::Logger<decltype(x), DEBUG, my_format, prop_line, prop_file,
+    logger::Logger<decltype(x), DEBUG, context_format, prop_line, prop_file,
                    prop_func>
         Logger(x);
 
@@ -188,24 +320,39 @@ void test_format() {
     return (x.str() == "broke down\n");
   })();
 
-  test::make("Doesn't print out properties after the last wildcard", []() {
+  test::make("Literal runs of the format are printed intact", []() {
     std::ostringstream x;
-    Logger<std::ostringstream, DEBUG, basic_fmt, prop_hash,
-                   prop_msg>
+    Logger<std::ostringstream, DEBUG, pair_format, prop_level, prop_msg>
         Logger(x);
 
-    CLOG(Logger, ERROR) << "broke down";
-    return (x.str().find("broke down") == std::string::npos);
+    CLOG(Logger, ERROR) << "broke up";
+    return (x.str() == "[ERROR] broke up\n");
   })();
 
-  test::make("Wildcards not associated with property printed raw", []() {
-    std::ostringstream x;
-    FmtLogger<basic_fmt> Logger(x);
+  test::make("Each line is written with a single write", []() {
+    // counts the calls to write on the logger's stream
+    struct CountingStream : std::ostringstream {
+      int writes = 0;
+      CountingStream &write(const char *s, std::streamsize n) {
+        ++writes;
+        std::ostringstream::write(s, n);
+        return *this;
+      }
+    } x;
+    Logger<CountingStream, DEBUG, my_format, prop_time, prop_level,
+           prop_thread, prop_file, prop_func, prop_line, prop_msg>
+        Logger(x);
 
     CLOG(Logger, ERROR) << "broke up";
-    return (x.str() == "%\n");
+    CLOG(Logger, ERROR) << "broke up " << 2 << " times";
+    return x.writes == 2 && contains(x.str(), "]: [broke up 2 times]\n");
   })();
 
+  static_assert(wildcards(full_fmt) == 9 && run_begin(my_format, 1) == 2 &&
+                    run_end(my_format, 1) == 4 &&
+                    run_begin(my_format, 7) == run_end(my_format, 7) - 1,
+                "formats are split into runs at compile time");
+
   test::make("Filters appropriate reject log messages", []() {
     std::ostringstream x;
     FmtLogger<basic_fmt, prop_msg> Logger(x);
@@ -221,6 +368,1686 @@ void test_format() {
   })();
 }
 
+/**
+ * @brief A user type with its own operator<<, for the message buffer tests.
+ */
+struct Point {
+  int x, y;
+};
+
+std::ostream &operator<<(std::ostream &o, const Point &p) {
+  return o << "(" << p.x << ", " << p.y << ")";
+}
+
+/**
+ * @brief A user type whose operator<< logs a formatted record of its own.
+ */
+struct Chatty {
+  logger::BasicLogger<std::ostringstream, logger::INFO> &log;
+};
+
+std::ostream &operator<<(std::ostream &o, const Chatty &c) {
+  CLOG(c.log, ERROR) << std::setw(4) << 7;
+  return o << "chatty";
+}
+
+/**
+ * @brief Tests for the message buffer that replaced std::ostringstream.
+ */
+void test_buffer() {
+  using namespace logger;
+  test::make("Long messages spill out of the inline buffer intact", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, INFO> Logger(x);
+
+    std::string a(300, 'a'), b(5000, 'b');
+    CLOG(Logger, ERROR) << a << b << "c";
+    return x.str() == a + b + "c\n";
+  })();
+
+  test::make("Moved buffers keep their contents", []() {
+    LineBuffer a, b;
+    a.append("short");
+    b.append(std::string(1000, 'x'));
+    LineBuffer c(std::move(a));
+    a = std::move(b);
+    return c.view() == "short" && a.size() == 1000 && b.empty();
+  })();
+
+  test::make("User types are streamed with their own operator<<", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, INFO> Logger(x);
+
+    CLOG(Logger, ERROR) << "at " << Point{1, -2};
+    return x.str() == "at (1, -2)\n";
+  })();
+
+  test::make("Manipulators apply within a record only", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, INFO> Logger(x);
+
+    CLOG(Logger, ERROR) << std::hex << 255 << std::setw(4) << "ab" << 'c';
+    CLOG(Logger, ERROR) << 255 << std::setprecision(2) << 1.234;
+    CLOG(Logger, ERROR) << 1.234;
+    return x.str() == "ff  abc\n2551.2\n1.234\n";
+  })();
+
+  test::make("Records logged while streaming into a record are apart", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, INFO> Logger(x);
+
+    CLOG(Logger, ERROR) << std::hex << Chatty{Logger} << " " << 255;
+    return x.str() == "   7\nchatty ff\n";
+  })();
+
+  test::make("Numbers are printed exactly as an ostream prints them", []() {
+    std::ostringstream x, expected;
+    BasicLogger<std::ostringstream, INFO> Logger(x);
+
+    int i = 42;
+    const void *null = nullptr;
+    auto print = [&](auto &&s) {
+      s << -7 << ' ' << 0u << ' ' << -9223372036854775807LL << ' '
+        << 18446744073709551615ULL << ' ' << short(-3) << ' ' << 1.234 << ' '
+        << 1e300 * 10 << ' ' << -0.0 << ' ' << 123456789.0 << ' ' << 1e-5
+        << ' ' << 0.1f << ' ' << 2.5L << ' ' << true << ' ' << &i << ' '
+        << null << ' ' << std::hex << 255 << ' ' << std::showpos << 1.5;
+    };
+    print(Logger.log<ERROR>({__FILE__, __func__, __LINE__, ERROR}));
+    print(expected);
+    expected << '\n';
+    return x.str() == expected.str();
+  })();
+}
+
+/**
+ * @brief Tests for the asynchronous logger and its queue.
+ */
+void test_async() {
+  using namespace logger;
+  test::make("Lock-free queue pops values in push order", []() {
+    MPSCQueue<int> q(4);
+    int v = 0;
+    bool ok = q.try_push(1) && q.try_push(2) && q.try_push(3) &&
+              q.try_push(4) && !q.try_push(5);
+    for (int i = 1; i <= 4; ++i)
+      ok = ok && q.try_pop(v) && v == i;
+    return ok && !q.try_pop(v) && q.size() == 0;
+  })();
+
+  test::make("Async logger writes every record once flushed", []() {
+    std::ostringstream x;
+    AsyncLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(x, 16);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&Logger]() {
+        for (int i = 0; i < 100; ++i)
+          CLOG(Logger, INFO) << "line";
+      });
+    for (auto &t : threads)
+      t.join();
+    Logger.flush();
+
+    std::istringstream lines(x.str());
+    int count = 0;
+    for (std::string l; std::getline(lines, l); ++count)
+      if (l != "line")
+        return false;
+    return count == 400;
+  })();
+
+  test::make("Async logger keeps the context of the logging thread", []() {
+    std::ostringstream x;
+    std::thread::id id;
+    {
+      AsyncLogger<std::ostringstream, DEBUG, basic_fmt, prop_thread> Logger(x);
+      std::thread([&]() {
+        id = std::this_thread::get_id();
+        CLOG(Logger, INFO) << "hi";
+      }).join();
+    }
+    std::ostringstream y;
+    y << std::hex << std::showbase << id << "\n";
+    return x.str() == y.str();
+  })();
+
+  test::make("Merging logger writes records in order of capture", []() {
+    std::ostringstream x;
+    MergingLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(
+        x, 16, std::chrono::seconds(10));
+
+    CLOG(Logger, INFO) << "0";
+    {
+      // captured now, but only pushed after the other thread's record
+      auto r = Logger.log<INFO>({__FILE__, __func__, __LINE__, INFO});
+      r << "1";
+      std::thread([&Logger]() { CLOG(Logger, INFO) << "2"; }).join();
+    }
+    Logger.flush();
+    return x.str() == "0\n1\n2\n";
+  })();
+
+  test::make("Merging logger writes every record from exited threads", []() {
+    std::ostringstream x;
+    {
+      MergingLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(x,
+                                                                           8);
+      std::vector<std::thread> threads;
+      for (int t = 0; t < 4; ++t)
+        threads.emplace_back([&Logger]() {
+          for (int i = 0; i < 100; ++i)
+            CLOG(Logger, INFO) << "line";
+        });
+      for (auto &t : threads)
+        t.join();
+    }
+    std::string out = x.str();
+    return std::count(out.begin(), out.end(), '\n') == 400;
+  })();
+
+  // holds the writer on the first record it writes until go is set, so that
+  // the queues fill up
+  static std::atomic<bool> held, go;
+  auto hold = [](Line &) {
+    held = true;
+    while (!go)
+      std::this_thread::yield();
+    return true;
+  };
+  auto lines = [](const std::string &s) {
+    std::vector<std::string> l;
+    std::istringstream in(s);
+    for (std::string line; std::getline(in, line);)
+      l.push_back(line);
+    return l;
+  };
+
+  test::make("Async logger drops the newest records when asked to", [&]() {
+    held = go = false;
+    std::ostringstream x;
+    AsyncLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(
+        x, 4, {Backpressure::DROP_NEWEST});
+    Logger.set_filter(hold);
+    CLOG(Logger, INFO) << "first";
+    while (!held)
+      std::this_thread::yield();
+    for (int i = 0; i < 10; ++i)
+      CLOG(Logger, INFO) << i;
+    go = true;
+    Logger.flush();
+    CLOG(Logger, INFO) << "after";
+    Logger.flush();
+
+    clayer::analyser::Parser parser;
+    std::istringstream in(x.str());
+    parser.read_stream<clayer::MESG>(in, std::regex("(.*)"));
+    return x.str() == "first\n0\n1\n2\n3\nafter dropped=6\n" &&
+           Logger.dropped() == 6 && Logger.dropped(INFO) == 6 &&
+           Logger.dropped(ERROR) == 0 && parser.dropped() == 6;
+  })();
+
+  test::make("Async logger keeps room for severe records", [&]() {
+    held = go = false;
+    std::ostringstream x;
+    AsyncLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(
+        x, 8, {Backpressure::DROP_BELOW, WARNING});
+    Logger.set_filter(hold);
+    CLOG(Logger, INFO) << "first";
+    while (!held)
+      std::this_thread::yield();
+    for (int i = 0; i < 8; ++i)
+      CLOG(Logger, INFO) << i;
+    CLOG(Logger, WARNING) << "w";
+    CLOG(Logger, ERROR) << "e";
+    go = true;
+    Logger.flush();
+    auto l = lines(x.str());
+    return l.size() == 9 && l[6] == "5" && l[7] == "w dropped=2" &&
+           l[8] == "e" && Logger.dropped(INFO) == 2 && Logger.dropped() == 2;
+  })();
+
+  test::make("Async logger writes the priority lane first", [&]() {
+    held = go = false;
+    std::ostringstream x;
+    AsyncLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(
+        x, 8, {Backpressure::PRIORITY});
+    Logger.set_filter(hold);
+    CLOG(Logger, INFO) << "first";
+    while (!held)
+      std::this_thread::yield();
+    for (int i = 0; i < 10; ++i)
+      CLOG(Logger, INFO) << i;
+    CLOG(Logger, ERROR) << "e";
+    CLOG(Logger, CRITICAL) << "c";
+    go = true;
+    Logger.flush();
+    auto l = lines(x.str());
+    return l.size() == 11 && l[0] == "first" && l[1] == "e dropped=2" &&
+           l[2] == "c" && l[3] == "0" && l[10] == "7" &&
+           Logger.dropped(INFO) == 2;
+  })();
+
+  test::make("Merging logger reports drops left when it stops", [&]() {
+    held = go = false;
+    std::ostringstream x;
+    std::uint64_t dropped;
+    {
+      MergingLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(
+          x, 4, std::chrono::milliseconds(2), {Backpressure::DROP_NEWEST});
+      Logger.set_filter(hold);
+      CLOG(Logger, INFO) << "first";
+      while (!held)
+        std::this_thread::yield();
+      for (int i = 0; i < 6; ++i)
+        CLOG(Logger, INFO) << i;
+      dropped = Logger.dropped();
+      go = true;
+    }
+    auto l = lines(x.str());
+    // the ring still holds the first record while it is being written
+    return dropped == 3 && l.size() == 5 &&
+           l[4] == "dropped records dropped=3";
+  })();
+}
+
+/**
+ * @brief Tests for the binary logger and its decoder.
+ */
+void test_binary() {
+  using namespace logger;
+  test::make("Binary log decodes to the text the text logger prints", []() {
+    std::ostringstream text, bin;
+    Logger<std::ostringstream, DEBUG, my_format, prop_time, prop_level,
+           prop_thread, prop_file, prop_func, prop_line, prop_msg>
+        TextLogger(text);
+    BinaryLogger<std::ostringstream, DEBUG, my_format, prop_time, prop_level,
+                 prop_thread, prop_file, prop_func, prop_line, prop_msg>
+        BinLogger(bin);
+
+    int n = -42;
+    auto emit = [&n](auto &l) {
+      CLOG(l, ERROR) << "n=" << n << " u=" << 7u << " f=" << 1.5f << ' '
+                     << std::string("str") << " " << true << " " << &n;
+    };
+    emit(TextLogger);
+    emit(BinLogger);
+    emit(BinLogger);
+
+    std::istringstream in(bin.str());
+    binary::Reader reader(in);
+    std::ostringstream decoded;
+    int count = 0;
+    for (Line line; reader.next(line); ++count) {
+      reader.print(decoded, line);
+      decoded << "\n";
+    }
+    // the time may have ticked between the two loggers
+    auto strip = [](std::string s) { return s.substr(s.find(']')); };
+    std::string first = decoded.str().substr(0, decoded.str().find('\n') + 1);
+    return reader && count == 2 && strip(first) == strip(text.str());
+  })();
+
+  test::make("Binary log keeps the thread that logged each record", []() {
+    std::ostringstream bin;
+    BinaryLogger<std::ostringstream, DEBUG, basic_fmt, prop_thread> Logger(
+        bin);
+    std::thread::id id;
+    std::thread([&]() {
+      id = std::this_thread::get_id();
+      CLOG(Logger, INFO) << "from a worker";
+    }).join();
+
+    std::istringstream in(bin.str());
+    binary::Reader reader(in);
+    std::ostringstream decoded;
+    Line line;
+    if (!reader.next(line))
+      return false;
+    reader.print(decoded, line);
+    return line.thread == id && decoded.str() == render_thread_id(id);
+  })();
+
+  test::make("Binary log tells apart statements on the same line", []() {
+    std::ostringstream bin;
+    BinaryLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(bin);
+    // clang-format off
+    CLOG(Logger, INFO) << "first " << 1; CLOG(Logger, INFO) << "second";
+    // clang-format on
+
+    std::istringstream in(bin.str());
+    binary::Reader reader(in);
+    std::ostringstream decoded;
+    std::set<std::uint64_t> sites;
+    for (Line line; reader.next(line); decoded << "\n") {
+      sites.insert(line.info.site);
+      reader.print(decoded, line);
+    }
+    return sites.size() == 2 && decoded.str() == "first 1\nsecond\n";
+  })();
+
+  test::make("Binary log writes each site's context only once", []() {
+    std::ostringstream once, twice;
+    BinaryFullLogger<std::ostringstream, DEBUG> Once(once), Twice(twice);
+    auto emit = [](auto &l, int n) {
+      for (int i = 0; i < n; ++i)
+        CLOG(l, INFO) << i;
+    };
+    emit(Once, 1);
+    emit(Twice, 2);
+    // the second record costs its fixed part and one tagged integer
+    return twice.str().size() - once.str().size() == binary::PAYLOAD_AT + 9;
+  })();
+
+  test::make("Parser reads binary logs directly", []() {
+    const char *name = "test_binary.log";
+    {
+      std::ofstream f(name, std::ios::binary);
+      BinaryFullLogger<std::ostream, DEBUG> Logger(f);
+      CLOG(Logger, WARNING) << "balance " << 100 << " after " << 2.5;
+    }
+    clayer::analyser::Parser parser;
+    auto recs = parser.read_binary_file(name);
+    std::remove(name);
+    return recs.size() == 1 && recs[0].code.level == "WARNING" &&
+           recs[0].code.func == "operator()" &&
+           recs[0].message == "balance 100 after 2.5" &&
+           recs[0].numbers.size() == 2 && recs[0].numbers[1] == 2.5f;
+  })();
+
+  test::make("Parser groups records by the statement that wrote them", []() {
+    const char *name = "test_binary.log";
+    {
+      std::ofstream f(name, std::ios::binary);
+      BinaryFullLogger<std::ostream, DEBUG> Logger(f);
+      for (int i = 0; i < 3; ++i)
+        CLOG(Logger, INFO) << "step " << i;
+      CLOG(Logger, INFO) << "done";
+    }
+    clayer::analyser::Parser parser;
+    auto recs = parser.read_binary_file(name);
+    std::remove(name);
+    auto groups = parser.group_by_hash();
+    return recs.size() == 4 && groups.size() == 2 &&
+           groups[recs[0].code.hash].size() == 3 &&
+           groups[recs[3].code.hash] == std::vector<std::size_t>{3};
+  })();
+}
+
+/**
+ * @brief Tests for the sinks and their flush policies.
+ */
+void test_sink() {
+  using namespace logger;
+  // the contents of a file, as written so far
+  auto contents = [](const char *name) {
+    std::ifstream f(name);
+    return std::string(std::istreambuf_iterator<char>(f),
+                       std::istreambuf_iterator<char>());
+  };
+
+  test::make("Buffered sink writes nothing until it is flushed", [&]() {
+    const char *name = "test_sink.log";
+    std::remove(name);
+    FdSink sink(name, FlushPolicy::when_full());
+    BasicLogger<FdSink, DEBUG> Logger(sink);
+
+    CLOG(Logger, CRITICAL) << "one";
+    CLOG(Logger, INFO) << "two";
+    std::string before = contents(name);
+    sink.flush();
+    std::string after = contents(name);
+    std::remove(name);
+    return before.empty() && after == "one\ntwo\n";
+  })();
+
+  test::make("Buffered sink flushes severe records and all before them", [&]() {
+    const char *name = "test_sink.log";
+    std::remove(name);
+    FdSink sink(name, FlushPolicy{1 << 16, std::chrono::hours(1), ERROR});
+    BasicLogger<FdSink, DEBUG> Logger(sink);
+
+    CLOG(Logger, WARNING) << "one";
+    std::string before = contents(name);
+    CLOG(Logger, ERROR) << "two";
+    std::string after = contents(name);
+    std::remove(name);
+    return before.empty() && after == "one\ntwo\n";
+  })();
+
+  test::make("Buffered sink flushes once its interval has passed", [&]() {
+    const char *name = "test_sink.log";
+    std::remove(name);
+    FdSink sink(name, FlushPolicy{1 << 16, std::chrono::milliseconds(0),
+                                  CRITICAL});
+    BasicLogger<FdSink, DEBUG> Logger(sink);
+
+    CLOG(Logger, INFO) << "one";
+    std::string after = contents(name);
+    std::remove(name);
+    return after == "one\n";
+  })();
+
+  test::make("Buffered sink writes full buffers, the rest on close", [&]() {
+    const char *name = "test_sink.log";
+    std::remove(name);
+    std::string expected, full;
+    {
+      FdSink sink(name, FlushPolicy::when_full(64));
+      BasicLogger<FdSink, DEBUG> Logger(sink);
+      for (int i = 0; i < 10; ++i) {
+        CLOG(Logger, INFO) << "record number " << i;
+        expected += "record number " + std::to_string(i) + "\n";
+      }
+      full = contents(name);
+    }
+    std::string closed = contents(name);
+    std::remove(name);
+    return full.size() >= 64 && full.size() < expected.size() &&
+           closed == expected;
+  })();
+
+  // the files in a directory and their contents, gunzipped
+  auto listing = [](const char *dir) {
+    std::map<std::string, std::string> files;
+    for (auto &entry : std::filesystem::directory_iterator(dir)) {
+      std::string text;
+      gzFile f = gzopen(entry.path().c_str(), "rb");
+      char chunk[256];
+      for (int n; (n = gzread(f, chunk, sizeof(chunk))) > 0;)
+        text.append(chunk, n);
+      gzclose(f);
+      files[entry.path().filename().string()] = text;
+    }
+    return files;
+  };
+
+  test::make("Rotating sink rolls over by size and keeps the newest files",
+             [&]() {
+    const char *dir = "test_rotating";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    {
+      RotationPolicy r;
+      r.max_size = 10;
+      r.keep = 2;
+      RotatingSink sink(std::string(dir) + "/app.log", r);
+      BasicLogger<RotatingSink, DEBUG> Logger(sink);
+      for (int i = 0; i < 10; ++i)
+        CLOG(Logger, INFO) << "record " << i << " of 10";
+      CLOG(Logger, INFO) << "last";
+    }
+    auto files = listing(dir);
+    std::filesystem::remove_all(dir);
+    // every record fills a file on its own
+    return files.size() == 3 && files["app.log"] == "last\n" &&
+           files["app.log.9"] == "record 8 of 10\n" &&
+           files["app.log.10"] == "record 9 of 10\n";
+  })();
+
+  test::make("Rotating sink gives back the space it didn't use", [&]() {
+    const char *dir = "test_rotating";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    {
+      RotationPolicy r;
+      r.interval = std::chrono::milliseconds(20);
+      r.max_size = 4 << 20;
+      RotatingSink sink(std::string(dir) + "/app.log", r);
+      BasicLogger<RotatingSink, DEBUG> Logger(sink);
+      CLOG(Logger, INFO) << "one";
+      std::this_thread::sleep_for(std::chrono::milliseconds(30));
+      CLOG(Logger, INFO) << "two";
+    }
+    bool small = true;
+    for (auto &entry : std::filesystem::directory_iterator(dir)) {
+      struct stat st;
+      small = small && ::stat(entry.path().c_str(), &st) == 0 &&
+              st.st_blocks * 512 < (1 << 20);
+    }
+    std::filesystem::remove_all(dir);
+    return small;
+  })();
+
+  test::make("Rotating sink rolls over at the end of its interval", [&]() {
+    const char *dir = "test_rotating";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    {
+      RotationPolicy r;
+      r.interval = std::chrono::milliseconds(50);
+      r.max_size = 1 << 20;
+      RotatingSink sink(std::string(dir) + "/app.log", r);
+      BasicLogger<RotatingSink, DEBUG> Logger(sink);
+      CLOG(Logger, INFO) << "one";
+      CLOG(Logger, INFO) << "two";
+      std::this_thread::sleep_for(std::chrono::milliseconds(60));
+      CLOG(Logger, INFO) << "three";
+    }
+    auto files = listing(dir);
+    std::filesystem::remove_all(dir);
+    // the interval may have ended after the first record or the second
+    std::string all = files["app.log.1"] + files["app.log.2"] + files["app.log"];
+    return (files.size() == 2 || files.size() == 3) &&
+           all == "one\ntwo\nthree\n" && files["app.log"] == "three\n";
+  })();
+
+  test::make("Rotating sink compresses rolled-over files", [&]() {
+    const char *dir = "test_rotating";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    {
+      RotationPolicy r;
+      r.max_size = 1;
+      r.compress = true;
+      RotatingSink sink(std::string(dir) + "/app.log", r);
+      BasicLogger<RotatingSink, DEBUG> Logger(sink);
+      CLOG(Logger, INFO) << "one";
+      CLOG(Logger, INFO) << "two";
+    }
+    auto files = listing(dir);
+    std::filesystem::remove_all(dir);
+    return files.size() == 3 && files["app.log"].empty() &&
+           files["app.log.1.gz"] == "one\n" && files["app.log.2.gz"] == "two\n";
+  })();
+
+  test::make("Mapped sink writes across windows and cuts the file back", [&]() {
+    const char *name = "test_sink.log";
+    std::remove(name);
+    std::string expected;
+    {
+      MmapSink sink(name, 4096);
+      BasicLogger<MmapSink, DEBUG> Logger(sink);
+      for (int i = 0; i < 1000; ++i) {
+        CLOG(Logger, INFO) << "record number " << i;
+        expected += "record number " + std::to_string(i) + "\n";
+      }
+    }
+    std::string closed = contents(name);
+    std::remove(name);
+    return expected.size() > 3 * 4096 && closed == expected;
+  })();
+
+  test::make("Mapped sink appends, and is readable before it is closed", [&]() {
+    const char *name = "test_sink.log";
+    std::remove(name);
+    std::ofstream(name) << "old\n";
+    std::string open;
+    {
+      MmapSink sink(name);
+      BasicLogger<MmapSink, DEBUG> Logger(sink);
+      CLOG(Logger, INFO) << "new";
+      open = contents(name);
+    }
+    std::string closed = contents(name);
+    std::remove(name);
+    // the rest of the window reads as zeros until the sink is closed
+    return open.compare(0, 8, "old\nnew\n") == 0 && open[8] == '\0' &&
+           closed == "old\nnew\n";
+  })();
+
+  test::make("Compressed sink writes whole records in indexed gzip frames",
+             [&]() {
+    const char *name = "test_sink.log.gz";
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    std::string expected;
+    {
+      CompressedSink sink(name, FlushPolicy::when_full(256));
+      BasicLogger<CompressedSink, DEBUG> Logger(sink);
+      for (int i = 0; i < 1000; ++i) {
+        CLOG(Logger, INFO) << "record number " << i;
+        expected += "record number " + std::to_string(i) + "\n";
+      }
+    }
+    auto index = frames::read_index(name);
+    std::string all, text;
+    frames::inflate_frame(contents(name), all);
+    bool whole = !index.empty();
+    for (auto &e : index) {
+      text.clear();
+      frames::inflate_frame(contents(name).substr(e.offset, e.size), text);
+      whole = whole && !text.empty() && text.back() == '\n' &&
+              e.first <= e.last;
+    }
+    clayer::analyser::Parser parser;
+    auto &recs = parser.read_file<clayer::MESG>(name, std::regex("(.*)"));
+    bool ordered = recs.size() == 1000;
+    for (std::size_t i = 0; ordered && i < recs.size(); ++i)
+      ordered = recs[i].message == "record number " + std::to_string(i);
+    std::size_t size = contents(name).size();
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    return all == expected && index.size() > 10 && whole && ordered &&
+           size < expected.size() / 2;
+  })();
+
+  test::make("Parser reads only the frames of a compressed log in a range",
+             [&]() {
+    const char *name = "test_sink.log.gz";
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    std::chrono::system_clock::time_point middle;
+    {
+      // frames open for 5 ms at most: the first record closes its own
+      CompressedSink sink(name, FlushPolicy{1 << 20,
+                                            std::chrono::milliseconds(5),
+                                            CRITICAL});
+      BasicLogger<CompressedSink, DEBUG> Logger(sink);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      CLOG(Logger, INFO) << "early";
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      middle = std::chrono::system_clock::now();
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      CLOG(Logger, INFO) << "late";
+      CLOG(Logger, INFO) << "later";
+    }
+    clayer::analyser::Parser parser;
+    std::regex all("(.*)");
+    auto before = parser.read_file<clayer::MESG>(name, all, {}, middle);
+    auto after = parser.read_file<clayer::MESG>(name, all, middle);
+    auto both = parser.read_file<clayer::MESG>(name, all);
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    return before.size() == 1 && before[0].message == "early" &&
+           after.size() == 2 && after[1].message == "later" &&
+           both.size() == 3;
+  })();
+
+  test::make("Compressed sink writes records out on flush, in the same frame",
+             [&]() {
+    const char *name = "test_sink.log.gz";
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    clayer::analyser::Parser parser;
+    std::regex all("(.*)");
+    std::size_t open_records, open_frames;
+    {
+      CompressedSink sink(name, FlushPolicy::when_full());
+      BasicLogger<CompressedSink, DEBUG> Logger(sink);
+      for (int i = 0; i < 10; ++i) {
+        CLOG(Logger, INFO) << "record number " << i;
+        sink.flush();
+      }
+      open_records = parser.read_file<clayer::MESG>(name, all).size();
+      open_frames = frames::read_index(name).size();
+    }
+    auto recs = parser.read_file<clayer::MESG>(name, all);
+    auto index = frames::read_index(name);
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    return open_records == 10 && open_frames == 0 && recs.size() == 10 &&
+           recs[9].message == "record number 9" && index.size() == 1;
+  })();
+
+  test::make("Compressed frames are found by when their records were logged",
+             [&]() {
+    const char *name = "test_sink.log.gz";
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    auto logged = std::chrono::system_clock::now() - std::chrono::seconds(1);
+    {
+      // a record a queue held for a second before the sink got it
+      CompressedSink sink(name, FlushPolicy::when_full());
+      Line line({__FILE__, __func__, __LINE__, INFO});
+      line.time = logged;
+      sink << "queued\n";
+      record_ended(sink, line);
+    }
+    clayer::analyser::Parser parser;
+    auto recs = parser.read_file<clayer::MESG>(
+        name, std::regex("(.*)"), {}, logged + std::chrono::milliseconds(1));
+    auto index = frames::read_index(name);
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    return recs.size() == 1 && recs[0].message == "queued" &&
+           index.size() == 1 && index[0].first == frames::nanoseconds(logged);
+  })();
+
+  test::make("Queued loggers leave closing frames to a compressed sink",
+             [&]() {
+    const char *name = "test_sink.log.gz";
+    auto frames_of = [&](auto log) {
+      std::remove(name);
+      std::remove(frames::index_path(name).c_str());
+      {
+        CompressedSink sink(name, FlushPolicy::when_full());
+        log(sink);
+      }
+      std::size_t n = frames::read_index(name).size();
+      std::remove(name);
+      std::remove(frames::index_path(name).c_str());
+      return n;
+    };
+    auto spaced = [](auto &l) {
+      for (int i = 0; i < 50; ++i) {
+        CLOG(l, INFO) << "record number " << i;
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+      }
+    };
+    std::size_t async = frames_of([&](CompressedSink &sink) {
+      AsyncLogger<CompressedSink, DEBUG, basic_fmt, prop_msg> Logger(sink);
+      spaced(Logger);
+    });
+    std::size_t merging = frames_of([&](CompressedSink &sink) {
+      MergingLogger<CompressedSink, DEBUG, basic_fmt, prop_msg> Logger(sink);
+      spaced(Logger);
+    });
+    return async == 1 && merging == 1;
+  })();
+
+  // a collector's socket, bound to a path, that takes as much as the kernel
+  // lets it without being read
+  auto collector = [](const char *path) {
+    ::unlink(path);
+    int fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address = socket_address(path);
+    ::bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+    return fd;
+  };
+
+  test::make("Socket sink sends records in batches of whole records", [&]() {
+    const char *path = "test_socket.sock";
+    int fd = collector(path);
+    std::string expected;
+    std::uint64_t delivered;
+    {
+      SocketSink sink(path, FlushPolicy::when_full(64));
+      BasicLogger<SocketSink, DEBUG> Logger(sink);
+      for (int i = 0; i < 10; ++i) {
+        CLOG(Logger, INFO) << "record number " << i;
+        expected += "record number " + std::to_string(i) + "\n";
+      }
+      sink.flush();
+      delivered = sink.delivered();
+    }
+    std::vector<std::string> datagrams;
+    char data[1 << 16];
+    for (ssize_t n; (n = ::recv(fd, data, sizeof(data), MSG_DONTWAIT)) > 0;)
+      datagrams.emplace_back(data, n);
+    ::close(fd);
+    ::unlink(path);
+    std::string all;
+    bool whole = datagrams.size() > 1;
+    for (auto &d : datagrams) {
+      whole = whole && d.size() <= 64 && d.back() == '\n';
+      all += d;
+    }
+    return whole && all == expected && delivered == 10;
+  })();
+
+  test::make("Socket sink drops and counts records rather than block", [&]() {
+    const char *path = "test_socket.sock";
+    ::unlink(path);
+    std::uint64_t absent, delivered, dropped;
+    {
+      // nothing listens yet
+      SocketSink sink(path, FlushPolicy::when_full(64));
+      BasicLogger<SocketSink, DEBUG> Logger(sink);
+      for (int i = 0; i < 5; ++i)
+        CLOG(Logger, INFO) << "record number " << i;
+      sink.flush();
+      absent = sink.dropped();
+
+      // then never reads
+      int fd = collector(path);
+      for (int i = 0; i < 100000; ++i)
+        CLOG(Logger, INFO) << "record number " << i;
+      sink.flush();
+      delivered = sink.delivered();
+      dropped = sink.dropped() - absent;
+      ::close(fd);
+      ::unlink(path);
+    }
+    return absent == 5 && delivered > 0 && dropped > 0 &&
+           delivered + dropped == 100000;
+  })();
+
+  test::make("Async logger writes through a buffered sink", [&]() {
+    const char *name = "test_sink.log";
+    std::remove(name);
+    {
+      FdSink sink(name, FlushPolicy::when_full());
+      AsyncLogger<FdSink, DEBUG, basic_fmt, prop_msg> Logger(sink);
+      CLOG(Logger, INFO) << "one";
+      Logger.flush();
+      if (contents(name) != "one\n")
+        return false;
+      CLOG(Logger, INFO) << "two";
+    }
+    std::string closed = contents(name);
+    std::remove(name);
+    return closed == "one\ntwo\n";
+  })();
+
+  test::make("Queued loggers write a buffered sink as its policy says", [&]() {
+    // each write to a datagram socket is one datagram, so they can be counted
+    int fds[2];
+    ::socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds);
+    std::string expected;
+    {
+      FdSink sink(fds[0], FlushPolicy::when_full(256));
+      AsyncLogger<FdSink, DEBUG, basic_fmt, prop_msg> Logger(sink);
+      for (int i = 0; i < 100; ++i) {
+        CLOG(Logger, INFO) << "record number " << i;
+        expected += "record number " + std::to_string(i) + "\n";
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    std::string received;
+    int writes = 0;
+    char data[1 << 16];
+    for (ssize_t n; (n = ::recv(fds[1], data, sizeof(data), MSG_DONTWAIT)) > 0;
+         ++writes)
+      received.append(data, n);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return received == expected && writes <= 10;
+  })();
+}
+
+/**
+ * @brief Tests for the crash handler, each crashing a child process.
+ */
+void test_crash() {
+  using namespace logger;
+  auto contents = [](const char *name) {
+    std::ifstream f(name);
+    return std::string(std::istreambuf_iterator<char>(f),
+                       std::istreambuf_iterator<char>());
+  };
+  // runs a function in a child process with the handler installed, and
+  // returns the signal that killed the child, or 0
+  auto crashing = [](auto f) {
+    pid_t child = ::fork();
+    if (child == 0) {
+      rlimit no_core{0, 0};
+      ::setrlimit(RLIMIT_CORE, &no_core);
+      // quieter than the default, which prints a message
+      std::set_terminate([] { std::abort(); });
+      crash::install();
+      f();
+      ::_exit(0);
+    }
+    int status = 0;
+    ::waitpid(child, &status, 0);
+    return WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+  };
+
+  test::make("Crash handler writes out buffered records and a marker", [&]() {
+    const char *name = "test_crash.log";
+    std::remove(name);
+    int sig = crashing([name] {
+      FdSink sink(name, FlushPolicy::when_full());
+      BasicLogger<FdSink, DEBUG> Logger(sink);
+      CLOG(Logger, INFO) << "one";
+      CLOG(Logger, INFO) << "two";
+      ::raise(SIGSEGV);
+    });
+    std::string log = contents(name);
+    std::remove(name);
+    std::size_t marker = log.find('\n', 8) + 1;
+    return sig == SIGSEGV && log.compare(0, 8, "one\ntwo\n") == 0 &&
+           marker == log.size() && contains(log, " CRITICAL [") &&
+           contains(log, "crashed: SIGSEGV\n");
+  })();
+
+  test::make("Crash handler drains an async logger's queue on terminate",
+             [&]() {
+    const char *name = "test_crash.log";
+    std::remove(name);
+    int sig = crashing([name] {
+      FdSink sink(name, FlushPolicy::when_full());
+      AsyncLogger<FdSink, DEBUG, basic_fmt, prop_msg> Logger(sink);
+      // hold the writer on the first record until the handler runs, so that
+      // the others are still queued
+      static std::atomic<bool> holding(false);
+      Logger.set_filter([](Line &) {
+        holding = true;
+        while (!crash::halted())
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return true;
+      });
+      CLOG(Logger, INFO) << "one";
+      CLOG(Logger, WARNING) << "two";
+      CLOG(Logger, ERROR) << "three";
+      while (!holding)
+        std::this_thread::yield();
+      std::terminate();
+    });
+    std::string log = contents(name);
+    std::remove(name);
+    std::istringstream lines(log);
+    std::vector<std::string> l;
+    for (std::string line; std::getline(lines, line);)
+      l.push_back(line);
+    return sig == SIGABRT && l.size() == 4 && l[0] == "one" &&
+           contains(l[1], " WARNING [") && contains(l[1], "]: two") &&
+           contains(l[2], " ERROR [") && contains(l[2], "]: three") &&
+           contains(l[3], "crashed: std::terminate");
+  })();
+
+  test::make("Crash handler ends a compressed log with a readable frame",
+             [&]() {
+    const char *name = "test_crash.log.gz";
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    int sig = crashing([name] {
+      CompressedSink sink(name, FlushPolicy::when_full());
+      BasicLogger<CompressedSink, DEBUG> Logger(sink);
+      CLOG(Logger, INFO) << "one";
+      sink.flush();
+      CLOG(Logger, INFO) << "two";
+      ::raise(SIGFPE);
+    });
+    clayer::analyser::Parser parser;
+    auto recs = parser.read_file<clayer::MESG>(name, std::regex("(.*)"));
+    auto index = frames::read_index(name);
+    std::remove(name);
+    std::remove(frames::index_path(name).c_str());
+    return sig == SIGFPE && index.size() == 1 && recs.size() == 3 &&
+           recs[0].message == "one" && recs[1].message == "two" &&
+           contains(recs[2].message, "crashed: SIGFPE");
+  })();
+}
+
+/**
+ * @brief Tests for the runtime thresholds and the ways to change them.
+ */
+void test_levels() {
+  using namespace logger;
+  test::make("Runtime threshold drops records without recompiling", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    Logger.set_level(ERROR);
+    CLOG(Logger, WARNING) << "dropped";
+    CLOG(Logger, ERROR) << "kept";
+    Logger.set_level(NOTSET);
+    CLOG(Logger, DEBUG) << "kept again";
+    return x.str() == "kept\nkept again\n";
+  })();
+
+  test::make("File thresholds take the place of the logger's", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    Logger.set_level(ERROR);
+    level_registry().set_file("tests.cpp", DEBUG);
+    CLOG(Logger, DEBUG) << "file";
+    level_registry().set_file("elsewhere.cpp", CRITICAL);
+    CLOG(Logger, INFO) << "still file";
+    level_registry().clear_files();
+    CLOG(Logger, WARNING) << "dropped";
+    CLOG(Logger, ERROR) << "logger";
+    return x.str() == "file\nstill file\nlogger\n";
+  })();
+
+  test::make("Config sets thresholds of named loggers and files", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x), Other(x);
+    Logger.set_name("tests.named");
+
+    std::istringstream config("# comment\n"
+                              "tests.named CRITICAL\n"
+                              "file:nowhere.cpp 10\n"
+                              "tests.other bogus\n");
+    int errors = apply_levels(config);
+    level_registry().clear_files();
+    CLOG(Logger, ERROR) << "dropped";
+    CLOG(Other, ERROR) << "other";
+    return errors == 1 && Logger.level() == CRITICAL && x.str() == "other\n";
+  })();
+
+  test::make("Context filter drops statements before their record", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_context_filter(
+        [](const ContextInfo &c) { return c.level >= ERROR; });
+
+    int evaluated = 0;
+    CLOG(Logger, WARNING) << "dropped " << ++evaluated;
+    CLOG(Logger, ERROR) << "kept " << ++evaluated;
+    Logger.set_context_filter(nullptr);
+    CLOG(Logger, WARNING) << "kept again";
+    return x.str() == "kept 1\nkept again\n" && evaluated == 1;
+  })();
+
+  test::make("Context filter verdicts are cached per statement", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    static int calls;
+    calls = 0;
+    Logger.set_context_filter([](const ContextInfo &c) {
+      ++calls;
+      return std::string(c.fn) != "operator()";
+    });
+
+    for (int i = 0; i < 10; ++i)
+      CLOG(Logger, INFO) << "dropped";
+    int first = calls;
+    Logger.set_context_filter([](const ContextInfo &c) {
+      ++calls;
+      return true;
+    });
+    for (int i = 0; i < 10; ++i)
+      CLOG(Logger, INFO) << "kept";
+    std::string s = x.str();
+    return first == 1 && calls == 2 &&
+           std::count(s.begin(), s.end(), '\n') == 10 && contains(s, "kept");
+  })();
+
+  test::make("Context filter can be removed while threads log", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    std::atomic<bool> done(false);
+    std::thread t([&]() {
+      while (!done)
+        CLOG(Logger, INFO) << "line";
+    });
+    for (int i = 0; i < 2000; ++i) {
+      Logger.set_context_filter(
+          [](const ContextInfo &c) { return c.level >= ERROR; });
+      Logger.set_context_filter(nullptr);
+    }
+    done = true;
+    t.join();
+    return true;
+  })();
+
+  // polls until the logger's level is the expected one or a second passes
+  auto settles = [](auto &logger, int level) {
+    for (int i = 0; i < 100 && logger.level() != level; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return logger.level() == level;
+  };
+
+  test::make("Watched config file is applied when it changes", [&]() {
+    const char *name = "test_levels.conf";
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_name("tests.watched");
+
+    std::ofstream(name) << "tests.watched WARNING\n";
+    LevelWatcher watcher(std::chrono::milliseconds(5));
+    watcher.watch_file(name);
+    bool first = settles(Logger, WARNING);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::ofstream(name) << "tests.watched ERROR\n";
+    ::utimensat(AT_FDCWD, name, nullptr, 0);
+    bool second = settles(Logger, ERROR);
+    std::remove(name);
+    return first && second;
+  })();
+
+  test::make("Shared control block sets thresholds", [&]() {
+    std::string name = "/clayer-test-" + std::to_string(::getpid());
+    ControlBlock *block = map_control_block(name.c_str());
+    if (block == nullptr)
+      return false;
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_name("tests.shared");
+
+    edit_control_block(name.c_str(), *block, [block] {
+      std::strcpy(block->entries[0].target, "tests.shared");
+      block->entries[0].level = CRITICAL;
+      block->count = 1;
+    });
+
+    LevelWatcher watcher(std::chrono::milliseconds(5));
+    watcher.watch_shared(name.c_str());
+    bool applied = settles(Logger, CRITICAL);
+
+    // a logger can't be unset: the entry is skipped
+    BasicLogger<std::ostringstream, DEBUG> Other(x);
+    Other.set_name("tests.other");
+    edit_control_block(name.c_str(), *block, [block] {
+      block->entries[0].level = unset_level;
+      std::strcpy(block->entries[1].target, "tests.other");
+      block->entries[1].level = ERROR;
+      block->count = 2;
+    });
+    bool other = settles(Other, ERROR);
+    ::munmap(block, sizeof(ControlBlock));
+    ::shm_unlink(name.c_str());
+    return applied && other && Logger.level() == CRITICAL;
+  })();
+
+  test::make("Shared control block is private and edited in turns", [&]() {
+    std::string name = "/clayer-test-" + std::to_string(::getpid());
+    ControlBlock *block = map_control_block(name.c_str());
+    if (block == nullptr)
+      return false;
+    struct stat st;
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    bool owner_only = fd >= 0 && ::fstat(fd, &st) == 0 &&
+                      (st.st_mode & 0077) == 0;
+    ::close(fd);
+
+    // each edit reads and rewrites the level, as clayerctl looks up entries
+    std::uint32_t before = block->sequence.load();
+    auto writer = [&] {
+      for (int i = 0; i < 200; ++i)
+        edit_control_block(name.c_str(), *block, [block] {
+          int level = block->entries[0].level;
+          std::this_thread::yield();
+          block->entries[0].level = level + 1;
+        });
+    };
+    block->entries[0].level = 0;
+    std::thread a(writer), b(writer);
+    a.join();
+    b.join();
+    bool turns = block->entries[0].level == 400 &&
+                 block->sequence.load() == before + 800;
+    ::munmap(block, sizeof(ControlBlock));
+    ::shm_unlink(name.c_str());
+    return owner_only && turns;
+  })();
+}
+
+/**
+ * @brief Tests for the sampled and rate limited logging macros.
+ */
+void test_sampling() {
+  using namespace logger;
+  test::make("Every-N statement logs each n-th call with a count", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    for (int i = 0; i < 10; ++i)
+      CLOG_EVERY_N(Logger, INFO, 4) << "call " << i;
+    return x.str() ==
+           "call 0\n[suppressed 3] call 4\n[suppressed 3] call 8\n";
+  })();
+
+  test::make("First-N statement doesn't evaluate suppressed calls", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    int evaluated = 0;
+    for (int i = 0; i < 5; ++i)
+      CLOG_FIRST_N(Logger, INFO, 2) << "call " << ++evaluated;
+    return x.str() == "call 1\ncall 2\n" && evaluated == 2;
+  })();
+
+  test::make("Every-T statement logs once per period", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    auto log = [&](int i) { CLOG_EVERY_T(Logger, INFO, 0.2) << "call " << i; };
+    for (int i = 0; i < 4; ++i)
+      log(i);
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    log(4);
+    return x.str() == "call 0\n[suppressed 3] call 4\n";
+  })();
+
+  test::make("Rate limited statement lets a burst through", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    for (int i = 0; i < 20; ++i)
+      CLOG_RATE(Logger, INFO, 5) << "call";
+    std::string s = x.str();
+    return std::count(s.begin(), s.end(), '\n') == 5;
+  })();
+
+  test::make("Rate limited statement with no rate lets nothing through", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    for (double rate : {0.0, -1.0, 1e-30})
+      for (int i = 0; i < 3; ++i)
+        CLOG_RATE(Logger, INFO, rate) << "call";
+    // the tiny rate lets its first call through, then none for ages
+    return x.str() == "[suppressed 6] call\n";
+  })();
+}
+
+/**
+ * @brief Tests for collapsing repeated messages.
+ */
+void test_dedup() {
+  using namespace logger;
+  test::make("Consecutive copies collapse into a repeat count", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_dedup(std::chrono::hours(1), 1);
+
+    for (int i = 0; i < 6; ++i)
+      CLOG(Logger, INFO) << (i < 5 ? "storm" : "calm");
+    return x.str() == "storm\nlast message repeated 4 times\ncalm\n";
+  })();
+
+  test::make("Messages with different text are not collapsed", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_dedup(std::chrono::hours(1));
+
+    for (int i = 0; i < 3; ++i)
+      CLOG(Logger, INFO) << "value " << i;
+    return x.str() == "value 0\nvalue 1\nvalue 2\n";
+  })();
+
+  test::make("Pending repeat counts are written on flush", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_dedup(std::chrono::hours(1));
+
+    for (int i = 0; i < 3; ++i)
+      CLOG(Logger, INFO) << "storm";
+    std::string before = x.str();
+    Logger.flush();
+    return before == "storm\n" &&
+           x.str() == "storm\nlast message repeated 2 times\n";
+  })();
+
+  test::make("Repeat counts are written once their window passes", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_dedup(std::chrono::milliseconds(50));
+
+    auto log = [&](const char *s) { CLOG(Logger, INFO) << s; };
+    log("storm");
+    log("storm");
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    log("calm");
+    log("storm");
+    return x.str() ==
+           "storm\nlast message repeated 1 times\ncalm\nstorm\n";
+  })();
+
+  test::make("Each thread collapses its own copies", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_dedup(std::chrono::hours(1));
+    auto storm = [&Logger]() {
+      for (int i = 0; i < 3; ++i)
+        CLOG(Logger, INFO) << "storm";
+    };
+    std::thread(storm).join();
+    std::thread(storm).join();
+    Logger.flush();
+    return x.str() == "storm\nstorm\nlast message repeated 2 times\n"
+                      "last message repeated 2 times\n";
+  })();
+
+  test::make("Collapsing can be switched on by racing threads", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&Logger]() {
+        Logger.set_dedup(std::chrono::hours(1));
+        for (int i = 0; i < 100; ++i)
+          CLOG(Logger, INFO) << "storm";
+      });
+    for (auto &t : threads)
+      t.join();
+    Logger.flush();
+    std::string s = x.str();
+    return std::count(s.begin(), s.end(), '\n') <= 8 && contains(s, "storm");
+  })();
+
+  test::make("Async logger collapses copies on its writer thread", []() {
+    std::ostringstream x;
+    {
+      AsyncLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(x);
+      Logger.set_dedup(std::chrono::hours(1));
+      for (int i = 0; i < 100; ++i)
+        CLOG(Logger, INFO) << "storm";
+    }
+    return x.str() == "storm\nlast message repeated 99 times\n";
+  })();
+}
+
+/**
+ * @brief Tests for the counters of what logging costs.
+ */
+void test_metrics() {
+  using namespace logger;
+  test::make("Metrics count records, bytes and filtered records", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.set_filter([](Line &l) { return l.message.view() != "skip"; });
+    Logger.enable_metrics();
+
+    for (int i = 0; i < 3; ++i)
+      CLOG(Logger, INFO) << "info " << i;
+    CLOG(Logger, WARNING) << "skip";
+    CLOG(Logger, ERROR) << "error";
+    MetricsSnapshot m = Logger.metrics();
+    return m.records() == 4 && m.emitted[2] == 3 && m.emitted[4] == 1 &&
+           m.dropped() == 1 && m.filtered[3] == 1 &&
+           m.bytes == x.str().size() && m.waiting == 0 &&
+           m.peak_waiting == 1 && m.peak_depth == 0;
+  })();
+
+  test::make("Metrics add up the counts of every thread", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.enable_metrics();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&Logger]() {
+        for (int i = 0; i < 1000; ++i)
+          CLOG(Logger, INFO) << "line " << i;
+      });
+    for (auto &t : threads)
+      t.join();
+    MetricsSnapshot m = Logger.metrics();
+    return m.records() == 4000 && m.emitted[2] == 4000 &&
+           m.bytes == x.str().size() && m.waiting == 0 &&
+           m.peak_waiting >= 1 && m.peak_waiting <= 4;
+  })();
+
+  test::make("Metrics are written through the logger periodically", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.enable_metrics(std::chrono::milliseconds(20), WARNING);
+
+    CLOG(Logger, INFO) << "a";
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CLOG(Logger, INFO) << "b";
+    CLOG(Logger, INFO) << "c";
+    std::istringstream in(x.str());
+    std::vector<std::string> l;
+    for (std::string line; std::getline(in, line);)
+      l.push_back(line);
+    return l.size() == 4 && l[1] == "b" && l[3] == "c" &&
+           l[2].find("logger metrics records=2 filtered=0 bytes=4 ") == 0 &&
+           l[2].find(" info=2") != std::string::npos &&
+           Logger.metrics().emitted[3] == 1;
+  })();
+
+  test::make("Metrics count statements below the runtime level", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    Logger.enable_metrics();
+    Logger.set_level(WARNING);
+    CLOG(Logger, INFO) << "below";
+    CLOG(Logger, ERROR) << "above";
+    MetricsSnapshot m = Logger.metrics();
+    return m.filtered[2] == 1 && m.emitted[4] == 1 && m.records() == 1;
+  })();
+
+  test::make("Metrics of an async logger give the depth of its queue", []() {
+    static std::atomic<bool> held, go;
+    held = go = false;
+    std::ostringstream x;
+    AsyncLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(x, 8);
+    Logger.enable_metrics();
+    Logger.set_filter([](Line &) {
+      held = true;
+      while (!go)
+        std::this_thread::yield();
+      return true;
+    });
+    CLOG(Logger, INFO) << "first";
+    while (!held)
+      std::this_thread::yield();
+    for (int i = 0; i < 5; ++i)
+      CLOG(Logger, INFO) << i;
+    MetricsSnapshot during = Logger.metrics();
+    go = true;
+    Logger.flush();
+    MetricsSnapshot after = Logger.metrics();
+    return during.depth == 5 && during.peak_depth == 5 && after.depth == 0 &&
+           after.peak_depth == 5 && after.records() == 6 &&
+           after.bytes == x.str().size() && after.peak_waiting == 0;
+  })();
+
+  test::make("Metrics count the bytes written to sinks", []() {
+    const char *name = "test_metrics.log", *gz = "test_metrics.log.gz";
+    std::remove(gz);
+    std::remove(logger::frames::index_path(gz).c_str());
+    std::string expected;
+    MetricsSnapshot queued, direct;
+    {
+      FdSink sink(name, FlushPolicy::when_full());
+      CompressedSink compressed(gz, FlushPolicy::when_full());
+      AsyncLogger<FdSink, DEBUG, basic_fmt, prop_msg> Async(sink);
+      BasicLogger<CompressedSink, DEBUG> Logger(compressed);
+      Async.enable_metrics();
+      Logger.enable_metrics();
+      for (int i = 0; i < 100; ++i) {
+        CLOG(Async, INFO) << "record number " << i;
+        CLOG(Logger, INFO) << "record number " << i;
+        expected += "record number " + std::to_string(i) + "\n";
+      }
+      Async.flush();
+      queued = Async.metrics();
+      direct = Logger.metrics();
+    }
+    std::remove(name);
+    std::remove(gz);
+    std::remove(logger::frames::index_path(gz).c_str());
+    return queued.records() == 100 && queued.bytes == expected.size() &&
+           direct.records() == 100 && direct.bytes == expected.size();
+  })();
+
+  test::make("Metrics of a merging logger are written by its writer", []() {
+    std::ostringstream x;
+    {
+      MergingLogger<std::ostringstream, DEBUG, basic_fmt, prop_msg> Logger(x);
+      Logger.enable_metrics();
+      for (int i = 0; i < 3; ++i)
+        CLOG(Logger, INFO) << i;
+      Logger.flush();
+      Logger.report_metrics();
+    }
+    return contains(x.str(), "0\n1\n2\nlogger metrics records=3 ");
+  })();
+
+  test::make("Metrics can be switched on by racing threads", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&Logger]() {
+        Logger.enable_metrics();
+        for (int i = 0; i < 100; ++i)
+          CLOG(Logger, INFO) << "line";
+      });
+    for (auto &t : threads)
+      t.join();
+    return Logger.metrics().records() <= 400 &&
+           Logger.metrics().records() > 0;
+  })();
+
+  test::make("Metrics stay at zero until they are switched on", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+    CLOG(Logger, INFO) << "a";
+    Logger.report_metrics();
+    return x.str() == "a\n" && Logger.metrics().records() == 0;
+  })();
+}
+
+namespace logger {
+/**
+ * @brief A Prop that counts how many times it is evaluated.
+ */
+static int prop_calls = 0;
+template <typename Stream> void prop_counted(Stream &o, const Line &l) {
+  o << ++prop_calls;
+}
+}
+
+/**
+ * @brief Tests for loggers with several outputs.
+ */
+void test_multi() {
+  using namespace logger;
+  test::make("Sends each record to the outputs that take its level", []() {
+    std::ostringstream x, y;
+    MultiLogger<Output<std::ostringstream, WARNING, pair_format, prop_level,
+                       prop_msg>,
+                Output<std::ostringstream, DEBUG, basic_fmt, prop_msg>>
+        Logger(x, y);
+
+    CLOG(Logger, DEBUG) << "a";
+    CLOG(Logger, ERROR) << "b";
+    return x.str() == "[ERROR] b\n" && y.str() == "a\nb\n";
+  })();
+
+  test::make("Evaluates the Props the outputs share once per record", []() {
+    std::ostringstream x, y, z;
+    MultiLogger<Output<std::ostringstream, DEBUG, pair_format, prop_counted,
+                       prop_msg>,
+                Output<std::ostringstream, DEBUG, pair_format, prop_counted,
+                       prop_msg>,
+                Output<std::ostringstream, ERROR, pair_format, prop_counted,
+                       prop_msg>>
+        Logger(x, y, z);
+
+    prop_calls = 0;
+    CLOG(Logger, INFO) << "a";
+    CLOG(Logger, ERROR) << "b";
+    return prop_calls == 2 && x.str() == "[1] a\n[2] b\n" &&
+           y.str() == x.str() && z.str() == "[2] b\n";
+  })();
+
+  test::make("Skips statements below the level of every output", []() {
+    std::ostringstream x, y;
+    MultiLogger<Output<std::ostringstream, WARNING, basic_fmt, prop_msg>,
+                Output<std::ostringstream, INFO, basic_fmt, prop_msg>>
+        Logger(x, y);
+
+    int evaluated = 0;
+    CLOG(Logger, DEBUG) << ++evaluated;
+    bool none = std::is_same<decltype(Logger.log<DEBUG>({})), NoRecord>::value;
+    return none && evaluated == 0 && x.str().empty() && y.str().empty();
+  })();
+}
+
+/**
+ * @brief Tests for structured logging: fields, their encoders, and reading
+ * them back.
+ */
+void test_fields() {
+  using namespace logger;
+  test::make("Prints fields after the message in the text format", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    CLOG(Logger, INFO) << "served" << kv("user", 42) << kv("ok", true)
+                       << kv("name", std::string("bob")) << kv("t", 1.5);
+    return x.str() == "served user=42 ok=true name=bob t=1.5\n";
+  })();
+
+  test::make("Formats other field values as the message would", []() {
+    std::ostringstream x;
+    BasicLogger<std::ostringstream, DEBUG> Logger(x);
+
+    CLOG(Logger, INFO) << std::hex << 255 << kv("bits", std::bitset<4>(5))
+                       << kv("n", 255) << " " << 255;
+    return x.str() == "ff ff bits=0101 n=255\n";
+  })();
+
+  test::make("Encodes messages and fields as JSON", []() {
+    constexpr static const char fmt[] = "{\"msg\":%%}";
+    std::ostringstream x;
+    Logger<std::ostringstream, DEBUG, fmt, prop_json_msg, prop_json_fields>
+        Logger(x);
+
+    CLOG(Logger, INFO) << "say \"hi\"\n" << kv("who", "a\\b\x01")
+                       << kv("n", -3) << kv("u", 7u) << kv("ok", false)
+                       << kv("inf", 1.0 / 0.0);
+    return x.str() == "{\"msg\":\"say \\\"hi\\\"\\n\",\"who\":\"a\\\\b\\u0001\","
+                      "\"n\":-3,\"u\":7,\"ok\":false,\"inf\":null}\n";
+  })();
+
+  test::make("Encodes messages and fields as logfmt", []() {
+    constexpr static const char fmt[] = "msg=%%";
+    std::ostringstream x;
+    Logger<std::ostringstream, DEBUG, fmt, prop_logfmt_msg, prop_logfmt_fields>
+        Logger(x);
+
+    CLOG(Logger, INFO) << "two words" << kv("user", "bob")
+                       << kv("q", "say \"hi\"") << kv("empty", "")
+                       << kv("t", 2.25);
+    return x.str() ==
+           "msg=\"two words\" user=bob q=\"say \\\"hi\\\"\" empty=\"\" t=2.25\n";
+  })();
+
+  test::make("Analyser reads JSON and logfmt logs by field name", []() {
+    const char *json = "test_fields.json", *logfmt = "test_fields.logfmt";
+    {
+      std::ofstream j(json), l(logfmt);
+      JsonLogger<std::ostream, DEBUG> Json(j);
+      LogfmtLogger<std::ostream, DEBUG> Logfmt(l);
+      auto emit = [](auto &l) {
+        CLOG(l, WARNING) << "slow \"request\" 3" << kv("user", 42)
+                         << kv("latency_us", 1250.5) << kv("path", "/a b");
+      };
+      emit(Json);
+      emit(Logfmt);
+    }
+    clayer::analyser::Parser parser;
+    auto check = [](const std::vector<clayer::LogRecord> &recs) {
+      return recs.size() == 1 && recs[0].code.level == "WARNING" &&
+             recs[0].code.func == "operator()" && recs[0].code.hash != 0 &&
+             recs[0].message == "slow \"request\" 3" &&
+             recs[0].numbers == std::vector<float>{3} &&
+             *recs[0].field("user") == "42" &&
+             *recs[0].field("latency_us") == "1250.5" &&
+             *recs[0].field("path") == "/a b" && !recs[0].field("none");
+    };
+    bool ok = check(parser.read_json_file(json)) &&
+              check(parser.read_logfmt_file(logfmt));
+    std::remove(json);
+    std::remove(logfmt);
+    return ok;
+  })();
+
+  test::make("Escapes keys, control characters and thread names", []() {
+    const char *json = "test_escape.json", *logfmt = "test_escape.logfmt";
+    std::thread([&] {
+      set_thread_name("w\"1\\");
+      std::ofstream j(json), l(logfmt);
+      JsonLogger<std::ostream, DEBUG> Json(j);
+      LogfmtLogger<std::ostream, DEBUG> Logfmt(l);
+      auto emit = [](auto &l) {
+        CLOG(l, INFO) << "bell\x07" << kv("a b=\"c", "x\x01y");
+      };
+      emit(Json);
+      emit(Logfmt);
+    }).join();
+    clayer::analyser::Parser parser;
+    auto check = [](const std::vector<clayer::LogRecord> &recs,
+                    const char *key) {
+      return recs.size() == 1 && recs[0].run.thread == "w\"1\\" &&
+             recs[0].message == "bell\x07" && recs[0].fields.size() == 1 &&
+             recs[0].fields[0].first == key &&
+             recs[0].fields[0].second == "x\x01y";
+    };
+    bool ok = check(parser.read_json_file(json), "a b=\"c") &&
+              check(parser.read_logfmt_file(logfmt), "a_b__c");
+    std::remove(json);
+    std::remove(logfmt);
+    return ok;
+  })();
+
+  test::make("Binary logs keep fields", []() {
+    const char *name = "test_fields.bin";
+    {
+      std::ofstream f(name, std::ios::binary);
+      BinaryFullLogger<std::ostream, DEBUG> Logger(f);
+      CLOG(Logger, INFO) << "served" << kv("user", 42) << kv("ok", true);
+    }
+    clayer::analyser::Parser parser;
+    auto recs = parser.read_binary_file(name);
+    std::remove(name);
+    return recs.size() == 1 && recs[0].message == "served" &&
+           recs[0].fields.size() == 2 && *recs[0].field("user") == "42" &&
+           *recs[0].field("ok") == "true";
+  })();
+}
+
 void test_analyse() {
   using namespace clayer;
   test::make("Single Property correctly read and written", []() {
@@ -304,6 +2131,17 @@ int main() {
   test_basic();
   test_props();
   test_format();
+  test_buffer();
+  test_async();
+  test_binary();
+  test_sink();
+  test_crash();
+  test_levels();
+  test_sampling();
+  test_dedup();
+  test_metrics();
+  test_multi();
+  test_fields();
   test_analyse();
 
   return 0;